@@ -0,0 +1,44 @@
+#ifndef _ARCHIVE_H_
+#define _ARCHIVE_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "writer.h"
+
+//zstd level responses are archived at, low enough to keep up with fetching
+#define ARCHIVE_LEVEL 3
+//Status logged for a document pushed by a WebSub hub, replayed like a 226 with only new items
+#define ARCHIVE_PUSH  0
+
+struct __feed;
+struct __summary;
+
+//Keeps every feed document read in "<DIR>/.rssm archive" so item files can be rebuilt without fetching again
+//Bodies are zstd frames in "xx/<sha256>", named by the SHA256 of the body so a feed that didn't change is only
+//kept once, and every one read gets a "<unix time>\t<tag>\t<status>\t<sha256>\t<size>" line in "log", in the order read
+struct __archive {
+	char* dir;
+	FILE* log;
+	pthread_mutex_t lock;
+	//since the last report
+	size_t stored, deduped, bytes, packed;
+};
+typedef struct __archive rssm_archive;
+
+//Set up "<dir>/.rssm archive", returns 0 on success
+int archiveOpen(rssm_archive* a, const char* dir);
+//Keep the body of a response of tag read with HTTP status code, buf is len bytes
+//returns 0 on success
+int archiveStore(rssm_archive* a, const char* tag, long code, const char* buf, size_t len);
+//Log what was archived since the last report
+void archiveReport(rssm_archive* a, FILE* log);
+void archiveClose(rssm_archive* a);
+
+//Read every document in the archive of rss directory dir through the feeds of the same tag again, in the order
+//they were fetched, on up to jobs threads with each feed on one thread at a time, filling in sum
+//Documents of tags not in feeds are skipped, queued items are written through writer early if they fill the memory budget
+//returns 0 if the archive was read, -1 if it can't be
+int archiveReplay(const char* dir, struct __feed** feeds, int jobs, rssm_writer* writer, FILE* log, int v, struct __summary* sum);
+
+#endif //_ARCHIVE_H_
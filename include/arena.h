@@ -0,0 +1,45 @@
+#ifndef _ARENA_H_
+#define _ARENA_H_
+
+#include <stddef.h>
+
+//Size of a regular arena chunk, bigger requests get a chunk of their own
+#define ARENA_CHUNK (64 * 1024)
+//How many bytes of chunks an arena keeps around after a reset
+#define ARENA_KEEP  (1024 * 1024)
+
+//A block of memory the arena bumps allocations out of
+struct __arenaChunk {
+	struct __arenaChunk* next;
+	size_t size, off;
+	char data[];
+};
+
+//Bump allocator for everything that only lives as long as one fetch
+//A zeroed rssm_arena is an empty, useable arena
+struct __arena {
+	struct __arenaChunk* head;
+	struct __arenaChunk* spare;
+	size_t used, peak;
+};
+typedef struct __arena rssm_arena;
+
+//Allocate size bytes out of the arena, returns NULL if malloc fails
+void* arenaAlloc(rssm_arena* a, size_t size);
+//Grow or shrink an arena allocation, extends in place when ptr was the last allocation
+void* arenaRealloc(rssm_arena* a, void* ptr, size_t size);
+//Copy a string into the arena
+char* arenaStrdup(rssm_arena* a, const char* str);
+//returns 1 if ptr was handed out by the arena since its last reset
+int arenaOwns(const rssm_arena* a, const void* ptr);
+//Throw away every allocation at once, keeping up to ARENA_KEEP bytes of chunks for reuse
+void arenaReset(rssm_arena* a);
+//Give every chunk back to the system
+void arenaFree(rssm_arena* a);
+
+//Install the libxml2 allocation hooks, must be called before libxml2 allocates anything
+int arenaXmlSetup(void);
+//Route libxml2 allocations made on this thread into a (NULL routes them back to malloc)
+void arenaXmlBind(rssm_arena* a);
+
+#endif //_ARENA_H_
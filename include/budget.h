@@ -0,0 +1,63 @@
+#ifndef _BUDGET_H_
+#define _BUDGET_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <pthread.h>
+
+//What memory is used for, usage is reported per stage
+//response bodies
+#define BUDGET_FETCH  0
+//document trees and formatting temporaries
+#define BUDGET_PARSE  1
+//items waiting for the end of the check to be written
+#define BUDGET_WRITE  2
+#define BUDGET_STAGES 3
+
+//libxml2 trees take a few times the size of the text they're parsed from
+#define PARSE_FACTOR 4
+
+//Memory budget shared by every fetch
+//New transfers and parses wait while the budget is used up, ones already running always finish
+struct __budget {
+	//0 for no limit, usage is still counted
+	size_t limit;
+	size_t used, peak;
+	size_t stage[BUDGET_STAGES], stagePeak[BUDGET_STAGES];
+	//fetches and parses running
+	int active, parsing;
+	//times a transfer or parse had to wait
+	size_t deferred;
+	pthread_mutex_t lock;
+	pthread_cond_t freed;
+};
+typedef struct __budget rssm_budget;
+
+//What one fetch has charged to the budget
+struct __budgetuse {
+	size_t stage[BUDGET_STAGES];
+	int parsing;
+};
+typedef struct __budgetuse rssm_budgetuse;
+
+void budgetInit(rssm_budget* b, size_t limit);
+void budgetFree(rssm_budget* b);
+
+//Wait until a new transfer expected to need estimate bytes fits
+void budgetEnter(rssm_budget* b, rssm_budgetuse* u, size_t estimate);
+//Wait until a parse of about estimate bytes fits
+void budgetParse(rssm_budget* b, rssm_budgetuse* u, size_t estimate);
+//Count bytes more of stage, against u if it isn't NULL
+void budgetCharge(rssm_budget* b, rssm_budgetuse* u, int stage, size_t bytes);
+//Give back bytes of stage charged without a budgetuse
+void budgetRelease(rssm_budget* b, int stage, size_t bytes);
+//Give back everything u charged and end its fetch
+void budgetLeave(rssm_budget* b, rssm_budgetuse* u);
+
+//returns 1 once queued writes hold half the budget and should be flushed early
+int budgetWriteFull(rssm_budget* b);
+
+//Log current and peak usage by stage
+void budgetReport(rssm_budget* b, FILE* log);
+
+#endif //_BUDGET_H_
@@ -0,0 +1,47 @@
+#ifndef _COLD_H_
+#define _COLD_H_
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "setting.h"
+#include "itemfile.h"
+
+//"COLD" at the start of every block header
+#define COLD_MAGIC 0x444c4f43u
+//Most raw bytes sealed into one block
+#define COLD_BLOCK (256 * 1024)
+//Size of a trained dictionary, and how many sample bytes it takes to train one
+#define COLD_DICT  (16 * 1024)
+#define COLD_TRAIN (COLD_DICT * 8)
+#define COLD_LEVEL 9
+
+//Header before each zstd frame in "<TAG> cold"
+struct __coldblock {
+	uint32_t magic, raw, comp, items;
+	//fetched time of the newest item in the block
+	int64_t newest;
+};
+typedef struct __coldblock rssm_coldblock;
+
+//Compress count items (contiguous in buf) onto the end of path's cold file, oldest first
+//The first seal with enough items trains path's dictionary
+//returns 0 on success, -1 on error
+int coldSeal(const char* path, const char* buf, const rssm_itemspan* items, size_t count);
+
+//Call fn for every item in path's cold file, oldest first
+//Spans are relative to the decompressed block, returns the number of items or -1 on error
+long coldScan(const char* path, rssm_itemfn fn, void* data);
+
+//Find the oldest blocks of path's cold file that fall outside r once the hot file's items are counted, all for every block
+//fn is called for each of their items and *keep is set to where the blocks kept start, for coldDrop once they're accounted for
+//returns the number of items found or -1 on error
+long coldTrim(const char* path, const rssm_retention* r, size_t hotItems, size_t hotBytes, int all, rssm_itemfn fn, void* data, size_t* keep);
+//Drop the blocks before keep from path's cold file, blocks sealed since coldTrim stay
+//returns 0 on success, -1 on error
+int coldDrop(const char* path, size_t keep);
+
+//Write every item of path, cold ones first, to out
+int coldCat(const char* path, FILE* out);
+
+#endif //_COLD_H_
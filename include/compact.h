@@ -0,0 +1,30 @@
+#ifndef _COMPACT_H_
+#define _COMPACT_H_
+
+#include <stdio.h>
+
+#include "setting.h"
+
+//Most expired identities kept per feed, older ones fell out of the feed long ago
+#define EXPIRED_KEEP 16384
+
+//Arguements for compactThread
+struct __compactArgs {
+	rssm_feeditem** feeds;
+	FILE* log;
+	int v, mins;
+	//compactThread returns once this is 0
+	int* loop;
+	//Leases on the shards this node writes when feeds are shared with other nodes, NULL if they aren't
+	rssm_leases* leases;
+};
+typedef struct __compactArgs rssm_compactargs;
+
+//Cut a feed's item file down to its retention policy, rewriting it atomically
+//returns the number of items dropped, -1 on error
+int compactFeed(rssm_feeditem* feed, FILE* log, int v);
+
+//Compact every feed with a retention policy each args->mins minutes until *args->loop is 0
+void* compactThread(void* args);
+
+#endif //_COMPACT_H_
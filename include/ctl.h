@@ -0,0 +1,43 @@
+#ifndef _CTL_H_
+#define _CTL_H_
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "setting.h"
+#include "scheduler.h"
+
+//Unix socket in the rss directory a running daemon takes commands on
+#define CTL_NAME "/.rssm ctl"
+//Longest command accepted
+#define CTL_LINE 4096
+
+//Listener for rssm ctl, one command a connection and one connection at a time
+//A command is a line of words, answered with "ok" or "error <why>" on a line of its own and what it asked for after an ok
+struct __ctl {
+	int fd;
+	char* path;
+	rssm_sched* sched;
+	//what feeds added over the socket are set up with, their files go in items
+	const char* dir;
+	const char* items;
+	int layout, format;
+	int stop, started;
+	pthread_t thread;
+	FILE* log;
+	int v;
+};
+typedef struct __ctl rssm_ctl;
+
+//Listen on "<dir>/.rssm ctl" for commands on the feeds sched fetches, returns 0 on success
+int ctlOpen(rssm_ctl* c, const rssm_options* opts, rssm_sched* sched, FILE* log, int v);
+//Start answering commands
+int ctlStart(rssm_ctl* c);
+//Stop answering and remove the socket
+void ctlClose(rssm_ctl* c);
+
+//rssm ctl, send a command to the daemon of a rss directory and print its answer
+//argv[0] is "ctl", returns the exit status
+int ctlMain(int argc, char** argv);
+
+#endif //_CTL_H_
@@ -0,0 +1,73 @@
+#ifndef _ENCLOSURE_H_
+#define _ENCLOSURE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "keyset.h"
+#include "identity.h"
+
+//Threads downloading enclosures, on top of the ones fetching feeds
+#define ENCLOSURE_JOBS     4
+//Downloads from one host at a time
+#define ENCLOSURE_PER_HOST 2
+//Tries before an enclosure is given up on, each waiting twice as long as the last
+#define ENCLOSURE_TRIES    5
+#define ENCLOSURE_RETRY    60
+
+//An enclosure waiting to be downloaded
+struct __download {
+	char *tag, *url;
+	char id[IDENTITY_HEX + 1];
+	//hash of the url's host, for the per host limit
+	uint64_t host;
+	int tries;
+	//not tried again before this
+	time_t after;
+};
+
+//Downloads the enclosures of new items into "<DIR>/.rssm media", named by the SHA256 of their content
+//"<DIR>/.rssm media/queue" keeps what is still to download across restarts, partly downloaded
+//enclosures are kept as "<hash of url>.part" with the ETag or Last-Modified of their response in
+//"<hash of url>.validator" and resumed with a range request only if that still holds, and every finished
+//one gets a "<unix time>\t<tag>\t<identity>\t<sha256 or ->\t<size>\t<url>" line in "<DIR>/.rssm media/index"
+struct __enclosures {
+	char* dir;
+	FILE *queueFile, *index;
+	struct __download* queue;
+	size_t count, cap;
+	//url hashes of every enclosure queued or done, so each is only downloaded once
+	rssm_keyset known;
+	//host hash to the number of downloads from it
+	rssm_keyset hosts;
+	//bandwidth cap in bytes a second, 0 for none, and the bytes that may be read right now
+	size_t rate;
+	double tokens, last;
+	int stop, active, started;
+	pthread_t workers[ENCLOSURE_JOBS];
+	pthread_mutex_t lock;
+	pthread_cond_t work, idle;
+	//since the last report
+	size_t done, failed, deduped, bytes;
+	FILE* log;
+	int v;
+};
+typedef struct __enclosures rssm_enclosures;
+
+//Set up "<dir>/.rssm media" and load what's left in its queue, rate is in bytes a second
+//returns 0 on success
+int enclosureOpen(rssm_enclosures* e, const char* dir, size_t rate, FILE* log, int v);
+//Start the download threads
+int enclosureStart(rssm_enclosures* e);
+//Queue url, an enclosure of item id of feed tag, unless it was already queued or downloaded
+void enclosureQueue(rssm_enclosures* e, const char* tag, const char* id, const char* url);
+//Log what was downloaded since the last report
+void enclosureReport(rssm_enclosures* e, FILE* log);
+//Wait until every download that can run now is done, ones waiting to be retried are left
+void enclosureDrain(rssm_enclosures* e);
+//Stop the downloads, unfinished ones stay in the queue and are resumed next time
+void enclosureClose(rssm_enclosures* e);
+
+#endif //_ENCLOSURE_H_
@@ -0,0 +1,27 @@
+#ifndef _EVENTS_H_
+#define _EVENTS_H_
+
+#include <stddef.h>
+
+//The journal is moved to "<DIR>/.rssm events.old" once it grows past this
+#define EVENTS_MAX (64L * 1024 * 1024)
+
+//Append-only journal of what rssm wrote, one line per event:
+//<unix time>\t<item|compact>\t<tag>\t<offset>\t<length>\t<identity or ->\n
+struct __events {
+	int fd;
+	char* path;
+};
+typedef struct __events rssm_events;
+
+//Open (creating if needed) the journal in dir, returns 0 on success
+int eventsOpen(rssm_events* e, const char* dir);
+//An item of length bytes was written at offset of tag's item file
+int eventItem(rssm_events* e, const char* tag, long offset, long length, const char* id);
+//tag's item file was rewritten and is now size bytes, earlier offsets are void
+int eventCompact(rssm_events* e, const char* tag, long size);
+//Start a new journal if this one grew past EVENTS_MAX
+int eventsRotate(rssm_events* e);
+void eventsClose(rssm_events* e);
+
+#endif //_EVENTS_H_
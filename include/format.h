@@ -0,0 +1,48 @@
+#ifndef _FORMAT_H_
+#define _FORMAT_H_
+
+#include <stddef.h>
+#include <sys/types.h>
+
+//What items are written as besides the item file, text writes nothing more
+#define FORMAT_TEXT   0
+#define FORMAT_JSON   1
+#define FORMAT_BINARY 2
+
+//A stream is moved to "<stream>.old" once it grows past this
+#define FORMAT_MAX (64L * 1024 * 1024)
+
+//Binary streams start with this, followed by one record per item:
+//u32 length of the rest of the record, u16 number of fields,
+//a u16 name length and u32 value length per field, then every field's name and value
+//Numbers are little endian, names and values are UTF-8 and not \0 terminated
+#define FORMAT_MAGIC "RSSMREC1"
+
+//A name and value of an item, value is len bytes
+struct __field {
+	const char* name;
+	const char* value;
+	size_t len;
+};
+typedef struct __field rssm_field;
+
+//A feed's items in a machine friendly format, "<item file> jsonl" or "<item file> rec"
+struct __stream {
+	int fd, format;
+	char* path;
+	//bytes in the stream, to know when to rotate it
+	off_t size;
+};
+typedef struct __stream rssm_stream;
+
+//returns the FORMAT_ named text, json or binary, -1 for any other name
+int formatParse(const char* name);
+//Open the stream of item file path in s->format, text opens nothing
+//returns 0 on success
+int streamOpen(rssm_stream* s, const char* path);
+//Append an item made of n fields, with a single write so readers never see part of one
+//returns 0 on success
+int streamWrite(rssm_stream* s, const rssm_field* fields, size_t n);
+void streamClose(rssm_stream* s);
+
+#endif //_FORMAT_H_
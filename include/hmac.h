@@ -0,0 +1,33 @@
+#ifndef _HMAC_H_
+#define _HMAC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA1_LEN   20
+#define SHA256_LEN 32
+//Both hashes work on 64 byte blocks and differ only in their state and compression
+#define SHA_BLOCK  64
+
+//A SHA1 or SHA256 hash being computed
+struct __sha {
+	uint32_t h[8];
+	uint8_t buf[SHA_BLOCK];
+	size_t fill;
+	uint64_t total;
+	void (*compress)(uint32_t* h, const uint8_t* block);
+	int words;
+};
+typedef struct __sha rssm_sha;
+
+//Start a SHA256 hash if sha256 is set, SHA1 otherwise
+void shaInit(rssm_sha* s, int sha256);
+void shaUpdate(rssm_sha* s, const void* data, size_t len);
+//out gets SHA1_LEN or SHA256_LEN bytes
+void shaFinal(rssm_sha* s, uint8_t* out);
+
+//HMAC of data under key, out gets SHA1_LEN or SHA256_LEN bytes
+void hmacSha1(const void* key, size_t keyLen, const void* data, size_t len, uint8_t* out);
+void hmacSha256(const void* key, size_t keyLen, const void* data, size_t len, uint8_t* out);
+
+#endif //_HMAC_H_
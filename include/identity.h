@@ -0,0 +1,41 @@
+#ifndef _IDENTITY_H_
+#define _IDENTITY_H_
+
+#include <stdint.h>
+
+#include <libxml/tree.h>
+
+#include "keyset.h"
+
+//Length of an identity written as hex, not counting the \0
+#define IDENTITY_HEX 32
+
+//128 bit identity of an item
+struct __itemid {
+	uint64_t hi, lo;
+};
+typedef struct __itemid rssm_itemid;
+
+//Copy str to out without new lines, repeated spaces or surrounding whitespace
+//out needs strlen(str) + 1 bytes, returns the length written
+size_t cleanValue(const char* str, char* out);
+//Lowercase the scheme and host, drop the fragment, default ports and tracking parameters of link
+//out needs strlen(link) + 1 bytes
+void normalizeLink(const char* link, char* out);
+
+//Identity from a guid or atom id, else the normalized link, else the title and description
+//Any of the arguements can be NULL
+rssm_itemid makeIdentity(const char* guid, const char* link, const char* title, const char* text);
+//Identity of an rss <item> or atom <entry> parsed by namesParse, link is the item's link or NULL
+rssm_itemid itemIdentity(const xmlNode* item, const char* link);
+
+//Write id as IDENTITY_HEX hex characters plus \0
+void identityFormat(rssm_itemid id, char* out);
+//returns 0 and sets *id if hex is a formatted identity, -1 otherwise
+int identityParse(const char* hex, rssm_itemid* id);
+
+//Identity sets are keysets from the low half to the high half
+int identityHas(const rssm_keyset* s, rssm_itemid id);
+int identityAdd(rssm_keyset* s, rssm_itemid id);
+
+#endif //_IDENTITY_H_
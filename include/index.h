@@ -0,0 +1,37 @@
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//One record per item of an item file, in file order, kept in "<path> index"
+//Fetched items are appended in fetched order, but replayed ones keep the time they were first fetched at
+//and the clock may step back, so records are usually but not always sorted by fetched
+struct __indexrec {
+	int64_t fetched;
+	//identity of the item
+	uint64_t hi, lo;
+	//linkKey of the item's link, 0 if it has none
+	uint64_t link;
+	//byte range of the item in the item file
+	uint64_t off, len;
+};
+typedef struct __indexrec rssm_indexrec;
+
+//Hash of the normalized form of len bytes of link
+uint64_t linkKey(const char* link, size_t len);
+
+//Add a record for every item in len bytes of path's item file written at base
+//returns the number of records added, -1 on error
+int indexAppend(const char* path, const char* buf, size_t len, size_t base);
+//Write path's index from scratch from the item file
+int indexRebuild(const char* path);
+//Rebuild path's index unless its last record ends where the item file does
+//returns 1 if it was rebuilt, 0 if it was fine and -1 on error
+int indexCheck(const char* path);
+
+//Map path's index, *count is set to the number of records
+//returns NULL if there is no index, unmap with unmapFile(buf, count * sizeof(rssm_indexrec))
+rssm_indexrec* indexMap(const char* path, size_t* count);
+
+#endif //_INDEX_H_
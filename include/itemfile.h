@@ -0,0 +1,37 @@
+#ifndef _ITEMFILE_H_
+#define _ITEMFILE_H_
+
+#include <stddef.h>
+#include <time.h>
+
+#include "identity.h"
+
+//Line ending every item in an item file
+#define ITEM_SEP "ITEMS\n"
+
+//Where an item sits in an item file and what it is
+struct __itemspan {
+	//byte range of the item, including its ITEMS line
+	size_t off, len;
+	//when rssm wrote the item, 0 if it predates fetched: lines
+	time_t fetched;
+	rssm_itemid id;
+	//value of the item's link line inside the scanned buffer, NULL if it has none
+	const char* link;
+	size_t linkLen;
+};
+typedef struct __itemspan rssm_itemspan;
+
+//Called for every item, a non-zero return stops the scan
+typedef int (*rssm_itemfn)(const rssm_itemspan* item, void* data);
+
+//Split len bytes of an item file into items
+//returns the offset just past the last complete item, anything after it is a partially written item
+size_t itemScan(const char* buf, size_t len, rssm_itemfn fn, void* data);
+
+//Map a whole file read only, *len is set to its size
+//returns NULL if it can't be mapped, an empty file gives a non-NULL pointer to nothing
+char* mapFile(const char* path, size_t* len);
+void unmapFile(char* buf, size_t len);
+
+#endif //_ITEMFILE_H_
@@ -0,0 +1,26 @@
+#ifndef _KEYSET_H_
+#define _KEYSET_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Open addressing hash map from 64 bit keys to 64 bit values
+//A zeroed rssm_keyset is an empty, useable set
+struct __keyset {
+	uint64_t *keys, *vals;
+	size_t cap, count;
+};
+typedef struct __keyset rssm_keyset;
+
+//64 bit FNV-1a hash of len bytes of data
+uint64_t keyHash(const void* data, size_t len);
+
+//Insert key or update its value
+//returns 0 on success, -1 if memory can't be allocated
+int keysetPut(rssm_keyset* s, uint64_t key, uint64_t val);
+//returns 1 and sets *val (if not NULL) if key is in the set, 0 if it isn't
+int keysetGet(const rssm_keyset* s, uint64_t key, uint64_t* val);
+//Free the set's tables, leaving it empty
+void keysetFree(rssm_keyset* s);
+
+#endif //_KEYSET_H_
@@ -0,0 +1,68 @@
+#ifndef _LEASE_H_
+#define _LEASE_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+//Feeds are split into this many shards by the hash of their tag, a node fetches the shards it holds a lease on
+//One bit per shard fits in a uint64_t
+#define LEASE_SHARDS 64
+//How long a lease or a node's heartbeat lasts without being renewed, and how often they are renewed
+#define LEASE_TTL    30
+#define LEASE_RENEW  10
+//Longest node name, "<hostname>.<pid>"
+#define LEASE_NODE   128
+
+//Shares the feeds between rssm daemons using one directory, typically on a shared filesystem
+//"<dir>/nodes/<node>" says until when each node is alive, "<dir>/shards/<shard>" which node holds a shard until when,
+//both as a "<node> <unix time>" line. Every node tries to hold its share of the shards, taking ones nobody holds or whose
+//lease ran out and giving up the ones over its share, so the shards of a node that dies are taken over once its leases run out
+//Times are compared across nodes, so their clocks have to agree to well within LEASE_TTL - LEASE_RENEW
+struct __leases {
+	char* dir;
+	char node[LEASE_NODE];
+	//shards held, and when each lease was last written
+	char held[LEASE_SHARDS];
+	time_t renewed[LEASE_SHARDS];
+	//nodes alive at the last renewal, this one included
+	int nodes;
+	//shards taken and given up since the last report
+	int taken, released;
+	int stop, started;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	//Called with the shards about to be given up, bit n set for shard n, while they are still held
+	//so everything fetched for them is in their item files before another node writes to them
+	void (*drain)(void* data, uint64_t shards);
+	void* drainData;
+	//held around every drain call
+	pthread_mutex_t drainLock;
+	FILE* log;
+	int v;
+};
+typedef struct __leases rssm_leases;
+
+//Join the nodes sharing dir, making its directories if needed
+//returns 0 on success
+int leaseOpen(rssm_leases* l, const char* dir, FILE* log, int v);
+//Take this node's share of the shards and keep it up to date every LEASE_RENEW seconds
+int leaseStart(rssm_leases* l);
+//returns the shard of a feed whose tag hashes to hash
+int leaseShard(uint64_t hash);
+//returns the shards this node holds, bit n set for shard n
+uint64_t leaseMask(rssm_leases* l);
+//returns 1 if the feed tagged tag is in one of shards
+int leaseOwns(uint64_t shards, const char* tag);
+//Call drain(data, shards) before giving up shards over this node's share, NULL for nothing
+//Waits for a call that is running, so data can go once drain is changed
+void leaseDrain(rssm_leases* l, void (*drain)(void* data, uint64_t shards), void* data);
+//Log the shards held and the nodes alive
+void leaseReport(rssm_leases* l, FILE* log);
+//Stop renewing, taking and giving up shards, the ones held stay held until leaseClose
+void leaseStop(rssm_leases* l);
+//Give up every lease and leave, so the other nodes take the shards over right away
+void leaseClose(rssm_leases* l);
+
+#endif //_LEASE_H_
@@ -0,0 +1,27 @@
+#ifndef _NAMES_H_
+#define _NAMES_H_
+
+#include <libxml/parser.h>
+#include <libxml/tree.h>
+
+//Element and attribute names rssm dispatches on, indexes into names
+enum {
+	NAME_RSS, NAME_FEED, NAME_CHANNEL, NAME_ITEM, NAME_ENTRY,
+	NAME_LINK, NAME_HREF, NAME_REL,
+	NAME_GUID, NAME_ID, NAME_TITLE, NAME_DESCRIPTION, NAME_SUMMARY, NAME_CONTENT,
+	NAME_ENCLOSURE, NAME_URL, NAME_GROUP,
+	NAME_COUNT
+};
+
+//The interned names, nodes namesParse builds point at these same strings
+extern const xmlChar* names[NAME_COUNT];
+
+//Intern the names in the dictionary every parse shares
+//Call once before any parse with libxml2 allocating from the heap, returns 0 on success
+int namesInit(void);
+//Parse buf like xmlReadMemory, but with element and attribute names looked up in the shared dictionary
+//so they can be compared with names by pointer
+xmlDocPtr namesParse(const char* buf, int len);
+void namesFree(void);
+
+#endif //_NAMES_H_
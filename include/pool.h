@@ -0,0 +1,26 @@
+#ifndef _POOL_H_
+#define _POOL_H_
+
+#include <stdio.h>
+
+#include "setting.h"
+
+//Most fetch threads rssm runs at once
+#define POOL_MAX 64
+
+//What a batch of fetches did
+struct __summary {
+	size_t ok, failed, items;
+	double secs;
+};
+typedef struct __summary rssm_summary;
+
+//Default number of fetch threads, fetching is mostly waiting on the network
+int poolJobs(void);
+
+//Fetch every feed once on up to jobs threads, filling in sum
+//Queued items are written through writer early if they fill the memory budget
+//returns 0 if every thread ran, -1 if none could be started
+int poolRun(rssm_feeditem** feeds, int jobs, rssm_writer* writer, FILE* log, int v, rssm_summary* sum);
+
+#endif //_POOL_H_
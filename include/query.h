@@ -0,0 +1,10 @@
+#ifndef _QUERY_H_
+#define _QUERY_H_
+
+//rssm query, look items up in the indexes of a rss directory
+//argv[0] is "query", returns the exit status
+int queryMain(int argc, char** argv);
+//rssm search, look words up in the full-text index of a rss directory
+int searchMain(int argc, char** argv);
+
+#endif //_QUERY_H_
@@ -5,6 +5,10 @@
 
 #define REPLY_SIZE 4096
 
+//Item files straight in the directory, or spread over <DIR>/xx/yy/ by tag hash
+#define LAYOUT_FLAT    0
+#define LAYOUT_SHARDED 1
+
 //Prints the time to the file in the format [%H:%M:%S]
 //returns the same as fprintf
 int printtime(FILE* f);
@@ -14,6 +18,35 @@ int makeDir(const char* path, FILE* log, int v);
 //Make a fifo
 int makeFile(const char* path, FILE* log, int v);
 
-void getNewRss(const rssm_feeditem* feed, FILE* log, int v);
+//Path of tag's item file under dir, making the directories the layout needs
+//returns NULL if a directory can't be made
+char* makeFeedPath(const char* dir, const char* tag, int layout, FILE* log, int v);
+//Make and open the item and desc files of feed under dir, its stream and what it already holds
+//format is used if the feed has no [output] of its own
+//returns -1 if the files can't be opened, what was opened is left for freeFeed
+int openFeed(rssm_feeditem* feed, const char* dir, int layout, int format, FILE* log, int v);
+//Write <dir>/.rssm manifest, a "<tag>\t<path relative to dir>" line for every feed, or its full path if it isn't in dir
+int writeManifest(const char* dir, rssm_feeditem** feeds, FILE* log);
+
+//Remember the identities of the items already in the feed's item file
+int loadIdentities(rssm_feeditem* feed, FILE* log, int v);
+
+//Remember the latest value of each field in the feed's desc file
+int loadDesc(rssm_feeditem* feed, FILE* log, int v);
+//Open the feed's item and desc files again and read what they hold afresh, for when another node wrote them last
+//returns -1 if they can't be opened, the feed keeps what it had then
+int reloadFeed(rssm_feeditem* feed, FILE* log, int v);
+
+//Fetch a feed and write its new items
+//returns the number of new items, -1 if the feed couldn't be fetched or parsed
+int getNewRss(rssm_feeditem* feed, FILE* log, int v);
+//Write the new items of a feed document pushed to us, buf is len bytes and \0 terminated
+//returns the number of new items, -1 if it couldn't be parsed
+int pushRss(rssm_feeditem* feed, const char* buf, size_t len, FILE* log, int v);
+//Read a feed document again, like one fetched with delta set if it holds only the items new since the one before
+//at unix time fetched (0 for now), buf is len bytes and \0 terminated, returns the number of new items, -1 if it couldn't be parsed
+int replayRss(rssm_feeditem* feed, const char* buf, size_t len, int delta, long fetched, FILE* log, int v);
+//Free the fetch memory of a thread that called getNewRss or pushRss
+void rssmioThreadDone(void);
 
 #endif //_RSSIO_H_
@@ -0,0 +1,64 @@
+#ifndef _RSSMREAD_H_
+#define _RSSMREAD_H_
+
+#include <stddef.h>
+
+//Reader for rssm item files, link with -lrssm
+//The file is mapped read only and every view points straight into the mapping, nothing is copied
+//Views are not \0 terminated and stay valid until rssmClose()
+
+//A mapped item file
+struct __rssmfile {
+	const char* buf;
+	size_t len;
+	//offset just past the last complete item, anything after it is still being written
+	size_t end;
+};
+typedef struct __rssmfile rssm_file;
+
+//An item, without its ITEMS line
+struct __rssmitem {
+	const char* buf;
+	size_t len;
+	//offset of the item in the file, the same offsets rssm's events and index use
+	size_t off;
+};
+typedef struct __rssmitem rssm_item;
+
+//A "name: value" line of an item
+struct __rssmfield {
+	const char* name;
+	size_t nameLen;
+	const char* value;
+	size_t valueLen;
+};
+typedef struct __rssmfield rssm_field;
+
+//Position of an iteration over a file's items or an item's fields
+struct __rssmcursor {
+	const char* buf;
+	size_t pos, end;
+};
+typedef struct __rssmcursor rssm_cursor;
+
+//Map the item file at path, returns 0 on success and -1 with errno set otherwise
+int rssmOpen(rssm_file* f, const char* path);
+void rssmClose(rssm_file* f);
+
+//Start iterating from the newest item, which is the last one in the file
+void rssmNewest(const rssm_file* f, rssm_cursor* c);
+//Step to the next older item, returns 1 and sets *item or 0 once there are no more
+int rssmOlder(rssm_cursor* c, rssm_item* item);
+//Start iterating from the oldest item
+void rssmOldest(const rssm_file* f, rssm_cursor* c);
+//Step to the next newer item, returns 1 and sets *item or 0 once there are no more
+int rssmNewer(rssm_cursor* c, rssm_item* item);
+
+//Start iterating over the fields of item, in the order they are stored
+void rssmFields(const rssm_item* item, rssm_cursor* c);
+//returns 1 and sets *field to the next field, 0 once there are no more
+int rssmNextField(rssm_cursor* c, rssm_field* field);
+//Find the first field called name, returns 1 and sets *field if the item has one
+int rssmGet(const rssm_item* item, const char* name, rssm_field* field);
+
+#endif //_RSSMREAD_H_
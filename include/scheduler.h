@@ -0,0 +1,133 @@
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "setting.h"
+#include "pool.h"
+#include "lease.h"
+
+//How often a tier is fetched when a feed doesn't say, in multiples of the check interval
+//critical feeds default to CRITICAL_EVERY seconds whatever the interval is
+#define CRITICAL_EVERY 30
+#define LOW_CHECKS     4
+//Feeds that can be added to a running scheduler, the feed list needs this many spare places
+#define SCHED_ADDS     64
+
+//Why a feed isn't fetched when it comes due
+#define SCHED_PAUSED   1
+#define SCHED_REMOVED  2
+//A feed that keeps failing waits twice as long after each failure, up to this many times its interval
+#define SCHED_BACKOFF  8
+//Longest interval a feed is fetched at, it has to fit the hot record's every
+#define SCHED_EVERY_MAX INT32_MAX
+
+//What is looked at for every feed every second, in one contiguous array so the scan for due feeds stays in cache
+//The feed itself, with its strings and files, is only touched once it's fetched
+struct __hot {
+	time_t due;
+	int32_t every;
+	//failed fetches in a row
+	uint16_t fails;
+	//tier, whether it is queued or being fetched, SCHED_ held, whether to fetch it again
+	//once the running fetch is done, its shard and whether its files are read again before the next fetch
+	uint8_t tier, busy, held, again, shard, stale;
+	//hash of the tag, so feeds are found without comparing tags
+	uint64_t hash;
+};
+
+//Feeds due for a fetch in one tier, each feed is in at most one queue at a time
+struct __tierqueue {
+	size_t* idx;
+	size_t head, count;
+};
+
+//How late a tier's fetches finished since the last report
+//lag is from when a feed was due until its fetch was done
+struct __tierstat {
+	size_t fetches, failed;
+	double lagSum, lagMax;
+};
+
+//Fetches feeds on worker threads as they come due, most urgent tier first
+//One extra worker only takes critical feeds, so they never wait behind a full pool
+struct __sched {
+	rssm_feeditem** feeds;
+	size_t nfeeds, cap;
+	struct __hot* hot;
+	//per feed: when it was last fetched and how many new items that found, -1 if it failed
+	time_t* last;
+	int* result;
+	//Leases on the shards this node fetches when feeds are shared with other nodes, NULL if they aren't
+	rssm_leases* leases;
+	//shards held at the last schedQueue, feeds of shards taken over since were last written by another node
+	uint64_t shards;
+	//shards being given up, their feeds aren't started any more
+	uint64_t draining;
+	//the check interval in seconds
+	long normal;
+	struct __tierqueue queue[TIERS];
+	//fetches asked for right away, taken before any tier
+	struct __tierqueue urgent;
+	struct __tierstat stats[TIERS];
+	//fetches finished since schedTake was last called
+	size_t done;
+	int running, paused, stop;
+	//workers still to start that only take critical feeds
+	int reserve;
+	pthread_t threads[POOL_MAX + 1];
+	int started;
+	//queued items are written early through writer if they fill the memory budget
+	rssm_writer* writer;
+	//held around every writerFlush of the feeds
+	pthread_mutex_t flushLock;
+	pthread_mutex_t lock;
+	pthread_cond_t work, idle;
+	FILE* log;
+	int v;
+};
+typedef struct __sched rssm_sched;
+
+//Work out every feed's interval from its priority and mins, and start jobs general workers
+//plus the critical one if any feed is critical, every feed is due right away
+//returns 0 on success, -1 if memory ran out or no thread could be started
+int schedStart(rssm_sched* s, rssm_feeditem** feeds, int jobs, int mins, rssm_writer* writer, FILE* log, int v);
+//Queue every feed due by now that isn't already queued, being fetched, held or in a shard another node holds
+void schedQueue(rssm_sched* s, time_t now);
+//Stop starting the feeds in shards, wait for their running fetches and write and sync what those fetched
+//s is a rssm_sched, to be called by the leases before the shards are given up
+void schedDrain(void* s, uint64_t shards);
+//Fetch a feed added after schedStart as well, feed goes in the feed list's next spare place
+//returns its index, -1 if there is no place left
+long schedAdd(rssm_sched* s, rssm_feeditem* feed);
+//returns the index of the feed tagged tag, -1 if there is none
+long schedFind(rssm_sched* s, const char* tag);
+//Fetch feed i ahead of everything queued, or once more right after its running fetch
+//returns -1 if it was removed, -2 if another node fetches it
+int schedNow(rssm_sched* s, size_t i);
+//Hold feed i back as SCHED_PAUSED or SCHED_REMOVED, or fetch it again with 0
+//returns -1 if a removed feed would be resumed
+int schedHold(rssm_sched* s, size_t i, int held);
+//Bring back removed feed i fetching url, which the feed takes
+//returns -1 if it wasn't removed or its last fetch is still running
+int schedRevive(rssm_sched* s, size_t i, char* url);
+//Fetch feed i every secs seconds, 0 for its priority's interval
+//returns the interval it has now
+long schedEvery(rssm_sched* s, size_t i, long secs);
+//Write a "<tag>\t<tier>\t<state>\t<interval>\t<next due>\t<last fetch>\t<new items>\t<poll or push>\t<url>"
+//line for feed i, or every feed if i is -1
+void schedDump(rssm_sched* s, long i, FILE* out);
+//returns how many fetches finished since the last call
+size_t schedTake(rssm_sched* s);
+//Stop handing out feeds and wait for the running fetches, schedResume starts again
+void schedPause(rssm_sched* s);
+void schedResume(rssm_sched* s);
+//Log the freshness lag of each tier since the last report and start counting again
+void schedReport(rssm_sched* s, FILE* log);
+//Let running fetches finish and join the workers
+void schedStop(rssm_sched* s);
+
+#endif //_SCHEDULER_H_
@@ -0,0 +1,64 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include <stdint.h>
+#include <stddef.h>
+#include <pthread.h>
+
+#include "identity.h"
+#include "keyset.h"
+
+#define SEARCH_MAGIC "RSSMSRCH"
+//Segments of about the same size are merged once there are this many of them
+#define SEARCH_MERGE 8
+//Longest word indexed, longer ones are cut
+#define SEARCH_TERM 32
+
+//A document of the search index, the nth record of "<DIR>/.rssm search/docs" is document n
+struct __searchdoc {
+	uint64_t hi, lo;
+	//keyHash of the item's tag
+	uint64_t tag;
+};
+typedef struct __searchdoc rssm_searchdoc;
+
+//Documents containing a term
+struct __postings {
+	char* term;
+	uint32_t* docs;
+	size_t count, cap;
+};
+
+//Incremental full-text index of item titles, descriptions and categories, kept in "<DIR>/.rssm search/"
+//Items indexed during a check go into an in-memory segment, written out as a new segment file when the check ends
+//Every segment file is a sorted term dictionary followed by delta+varint encoded postings
+struct __search {
+	char* dir;
+	//document id of the first in-memory document, the number of documents on disk
+	uint32_t base;
+	rssm_searchdoc* docs;
+	size_t ndocs, docCap;
+	struct __postings* terms;
+	size_t nterms, termCap;
+	rssm_keyset termIndex;
+	pthread_mutex_t lock;
+};
+typedef struct __search rssm_search;
+
+//Open the index under dir, creating it if needed, returns 0 on success
+int searchOpen(rssm_search* s, const char* dir);
+//Index len bytes of a rendered item of tag
+int searchAdd(rssm_search* s, const char* tag, rssm_itemid id, const char* buf, size_t len);
+//Write the in-memory segment and merge segments if there are too many
+int searchFlush(rssm_search* s);
+void searchClose(rssm_search* s);
+
+//Call fn with every indexable word of text, lowercased
+void searchWords(const char* text, size_t len, void (*fn)(const char* word, size_t len, void* data), void* data);
+//Documents of the index under dir containing every one of the nterms terms, in increasing order
+//returns the number of documents and sets *docs, which the caller frees, or -1 on error
+long searchFind(const char* dir, char** terms, size_t nterms, uint32_t** docs);
+//Map the document table of the index under dir, unmap with unmapFile(buf, count * sizeof(rssm_searchdoc))
+rssm_searchdoc* searchDocs(const char* dir, size_t* count);
+
+#endif //_SEARCH_H_
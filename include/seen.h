@@ -0,0 +1,41 @@
+#ifndef _SEEN_H_
+#define _SEEN_H_
+
+#include <stdint.h>
+#include <pthread.h>
+
+#include "keyset.h"
+
+//What to do with an item another feed already wrote
+#define SEEN_SKIP 1
+#define SEEN_REF  2
+
+//Set of every item written by any feed, shared across feeds
+//A bloom filter answers most misses before the exact set is probed
+struct __seen {
+	uint64_t* bloom;
+	size_t bits;
+	rssm_keyset keys;
+	//tags of the feeds items were first written to, keys map to indexes in here
+	char** tags;
+	size_t ntags;
+	rssm_keyset tagIndex;
+	int mode, dirty;
+	char* path;
+	//held by callers around a check and its add
+	pthread_mutex_t lock;
+};
+typedef struct __seen rssm_seen;
+
+//Load the seen set persisted at path, a missing file gives an empty set
+//returns 0 on success, -1 if the file is corrupt or memory runs out
+int seenLoad(rssm_seen* s, const char* path, int mode);
+//returns 1 and sets *origin to the first feed's tag if key was seen, 0 otherwise
+int seenCheck(const rssm_seen* s, uint64_t key, const char** origin);
+//Record key as first written by the feed tag
+int seenAdd(rssm_seen* s, uint64_t key, const char* tag);
+//Write the set back to its path if it changed, returns 0 on success
+int seenSave(rssm_seen* s);
+void seenFree(rssm_seen* s);
+
+#endif //_SEEN_H_
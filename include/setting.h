@@ -3,6 +3,20 @@
 
 #include <stdlib.h>
 #include <argp.h>
+#include <stdio.h>
+#include <pthread.h>
+
+#include "seen.h"
+#include "keyset.h"
+#include "events.h"
+#include "wal.h"
+#include "writer.h"
+#include "search.h"
+#include "budget.h"
+#include "websub.h"
+#include "format.h"
+#include "enclosure.h"
+#include "archive.h"
 
 //This prevents linker error, only define this in main.c
 #ifdef MAIN_FILE
@@ -19,27 +33,124 @@ struct argp_option options[] = {
 	{"nodaemon",  'D', 0,      0, "Don't run as a daemon (logs to stdout)"},
 	{"checks",    'c', "MINS", 0, "Set the number of minutes between rss feed checks (default is 5)"},
 	{"force",     'F', 0,      0, "Force a SIGTERM on any running rssm daemons"},
+	{"cat",       'C', "FILE", 0, "Print every item of the item file FILE, including sealed ones, and exit"},
+	{"layout",    'L', "TYPE", 0, "Put item files straight in DIR (flat, the default) or spread over hashed subdirectories (sharded)"},
+	{"events",    'e', 0,      0, "Journal every item written to DIR/.rssm events"},
+	{"crossdedup",'x', "MODE", 0, "Check items against every feed's items: skip duplicates (skip) or write a reference to the first feed (ref)"},
+	{"once",      'o', 0,      0, "Fetch every feed once in parallel, print a summary and exit (logs to stdout, no lock file)"},
+	{"jobs",      'j', "N",    0, "Fetch up to N feeds at once (default is 4 per cpu, at most 64)"},
+	{"uring",     'u', 0,      0, "Write each check's items with one io_uring submission (falls back to pwrite if unavailable)"},
+	{"search",    'S', 0,      0, "Keep a full-text index of item titles, descriptions and categories in DIR/.rssm search for rssm search"},
+	{"memory",    'm', "SIZE", 0, "Hold fetches and parses back once they use SIZE bytes (k, M or G suffix) and report memory use by stage"},
+	{"websub",    'W', "URL",  0, "Subscribe to the WebSub hubs feeds name, with hubs reaching this daemon at URL (rssm listens on its port)"},
+	{"enclosures",'E', "RATE", 0, "Download the enclosures of new items to DIR/.rssm media at up to RATE bytes a second (k, M or G suffix, 0 for no cap)"},
+	{"partition", 'P', "DIR",  0, "Share the feeds with the rssm daemons on other hosts using DIR too, each fetching only the shards it holds a lease on"},
+	{"archive",   'A', 0,      0, "Keep every response read in DIR/.rssm archive, compressed and stored once per distinct body"},
+	{"reprocess", 'R', "DIR",  0, "Read everything archived in DIR again on one thread per cpu, writing to this run's directory without fetching, and exit"},
+	{"output",    'O', "FORMAT",0, "Also write items as json (JSON Lines) or binary (length prefixed records) next to the item files (default is text, nothing more)"},
 	{ 0 }
 };
 #endif //MAIN_FILE
 
 //Contain all the options of rssm
 struct __options {
-	int verbose, daemon, mins, force;
+	int verbose, daemon, mins, force, crossdedup, events, layout;
+	//fetch everything once on jobs threads and exit
+	int once, jobs;
+	int uring, search;
+	//memory budget in bytes, 0 for none
+	size_t memory;
+	//WebSub callback url, NULL to only poll
+	char* websub;
+	//FORMAT_ of feeds without an [output] line
+	int format;
+	//download enclosures, at up to rate bytes a second if it isn't 0
+	int enclosures;
+	size_t rate;
+	//directory shared with the other nodes fetching the same feeds, NULL to fetch every feed
+	char* partition;
+	//where the item files go, the rss directory unless they're shared with the other nodes under partition
+	char* items;
+	//archive responses read, and the rss directory whose archive is read again instead of fetching, NULL normally
+	int archive;
+	char* reprocess;
 	char* list;
+	//item file to print with its cold storage, NULL normally
+	char* cat;
 	char* directory;
 	char* log;
 };
 typedef struct __options rssm_options;
 
+//How much of a feed's items compaction keeps, 0 means no limit
+//hot is how many of the newest stay plain text, the rest are sealed into cold storage
+struct __retention {
+	long items, age, bytes, hot;
+};
+typedef struct __retention rssm_retention;
+
+//Priority tiers, lower is more urgent
+#define TIER_CRITICAL 0
+#define TIER_NORMAL   1
+#define TIER_LOW      2
+#define TIERS         3
+
+//How urgently a feed is fetched and how often, every is in seconds and 0 means the tier's default
+struct __priority {
+	int tier;
+	long every;
+};
+typedef struct __priority rssm_priority;
+
 //A tag and url for an rss feed
 struct __feed {
 	char* url;
 	char* tag;
+	//path of the item file, the desc file is path + " desc"
+	char* path;
 	FILE *desc, *out;
+	//held while the item file is written or compacted
+	pthread_mutex_t lock;
+	rssm_retention retention;
+	rssm_priority priority;
+	//Items already written by any feed, NULL unless cross-feed dedup is on
+	rssm_seen *seen;
+	//Items in a machine friendly format, format is -1 until set
+	rssm_stream stream;
+	//Journal new items are announced on, NULL unless events are on
+	rssm_events *events;
+	//Write-ahead log items go through before their item file
+	rssm_wal *wal;
+	//Full-text index new items are added to, NULL unless searching is on
+	rssm_search *search;
+	//Downloader the enclosures of new items are queued on, NULL unless it is on
+	rssm_enclosures *enclosures;
+	//Where the responses read are kept, NULL unless archiving is on
+	rssm_archive *archive;
+	//Listener hubs push to, NULL unless WebSub is on
+	rssm_websub *websub;
+	rssm_hub hub;
+	//Memory budget fetches are charged to
+	rssm_budget *budget;
+	//Size of the last response, what the next fetch is expected to need
+	size_t lastSize;
+	//ETag of the last response read, sent back so the server can answer with only new items
+	char* etag;
+	//out was written since the last checkpoint of the log
+	int dirty;
+	//Items written this check, appended to out by writerFlush
+	rssm_pending pending;
+	//Identities of the items in out
+	rssm_keyset ids;
+	//Hash of each desc field's name to the hash of its latest value
+	rssm_keyset fields;
 };
 typedef struct __feed rssm_feeditem;
 
+//The control socket adds feeds while other threads walk the list without the scheduler's lock,
+//schedAdd publishes them with a release store and walkers read entries with this
+#define feedAt(feeds, i) __atomic_load_n(&(feeds)[i], __ATOMIC_ACQUIRE)
+
 //Parse an arguement
 //Return is handled by argp
 error_t parseArg(int key, char* arg, struct argp_state *state);
@@ -54,6 +165,13 @@ char* getLogPath(const rssm_options *opts, int v);
 
 //Read in feedlists from a file
 rssm_feeditem** getFeeds(const char* list, FILE* log, int v);
+//A feed with nothing opened yet and the defaults of a feed the list says nothing else about
+//returns NULL if memory ran out
+rssm_feeditem* newFeed(const char* tag, const char* url);
+//Close a feed's files and free it
+void freeFeed(rssm_feeditem* feed);
+//Parse a priority like "critical 30s" into p, returns -1 if it isn't one
+int parsePriority(const char* str, rssm_priority* p, FILE* log);
 
 //Check lock file
 //returns pid if it exists, 0 if it doesn't, and -1 if it can't create a new one
@@ -0,0 +1,47 @@
+#ifndef _WAL_H_
+#define _WAL_H_
+
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+
+#include "identity.h"
+#include "lease.h"
+
+//Magic starting every write-ahead log record
+#define WAL_MAGIC "RSWL"
+//The log is checkpointed once it grows past this
+#define WAL_MAX (8L * 1024 * 1024)
+
+struct __feed;
+
+//Write-ahead log of items, "<DIR>/.rssm wal"
+//Every item is appended here before it goes to its item file, one fdatasync of the log per check
+//makes the whole check durable and item files are only synced when the log is checkpointed
+struct __wal {
+	int fd;
+	char* path;
+	//records written since the last commit
+	size_t pending;
+	pthread_mutex_t lock;
+};
+typedef struct __wal rssm_wal;
+
+//Open (creating if needed) the log in dir, returns 0 on success
+int walOpen(rssm_wal* w, const char* dir);
+//Log len bytes of item id that are about to be appended to tag's item file
+int walAppend(rssm_wal* w, const char* tag, rssm_itemid id, const char* buf, size_t len);
+//Make every record logged so far durable
+int walCommit(rssm_wal* w);
+//returns 1 once the log has grown past WAL_MAX and should be checkpointed
+int walFull(rssm_wal* w);
+//Sync every item file written since the last checkpoint, then empty the log
+//The log is kept if a feed has items not written to its item file yet, returns -1 then or on an error
+int walCheckpoint(rssm_wal* w, struct __feed** feeds, FILE* log);
+//Append every logged item that didn't make it to its item file, call after loading the feeds' identities
+//When feeds are shared with other nodes only the items of feeds in shards held in leases are, NULL for every feed
+//returns the number of items written back, -1 if the log can't be read
+int walReplay(rssm_wal* w, struct __feed** feeds, rssm_leases* leases, FILE* log, int v);
+void walClose(rssm_wal* w);
+
+#endif //_WAL_H_
@@ -0,0 +1,77 @@
+#ifndef _WEBSUB_H_
+#define _WEBSUB_H_
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "lease.h"
+
+//Lease asked of hubs, they may grant a shorter one but not a longer one
+#define WEBSUB_LEASE (10L * 24 * 60 * 60)
+//How long to wait before trying a hub again after it failed or never verified
+#define WEBSUB_RETRY 300
+//Biggest pushed body accepted
+#define WEBSUB_BODY  (16L * 1024 * 1024)
+//Feeds a hub pushes are still polled, every this many check intervals
+#define WEBSUB_CHECKS 12
+
+//Where a feed's subscription is at
+#define HUB_NONE    0
+#define HUB_PENDING 1
+#define HUB_ACTIVE  2
+#define HUB_DENIED  3
+
+struct __feed;
+
+//A feed's hub, guarded by its websub's lock
+struct __hub {
+	//hub and topic urls, NULL until a <link rel="hub"> was seen
+	char *hub, *topic;
+	int state;
+	//lease end, and when a subscription may next be asked for
+	time_t expires, retry;
+	//HMAC key given to the hub, pushes must be signed with it
+	char secret[41];
+	//Callback query naming this subscription, a hub verifying it echoes it back
+	char nonce[17];
+	//last part of the callback url, hex of the tag's hash
+	char id[17];
+};
+typedef struct __hub rssm_hub;
+
+//Local HTTP listener hubs verify subscriptions with and push new content to
+struct __websub {
+	int fd;
+	//callback url the listener is reachable at, each feed's is base/<id>
+	char* base;
+	struct __feed** feeds;
+	//pushes ingested since websubTake was last called
+	size_t pushed;
+	int stop, started;
+	pthread_t listener, subscriber;
+	pthread_mutex_t lock;
+	//held around every push written, so the log can be checkpointed without one in between
+	pthread_mutex_t ingest;
+	//Leases on the shards this node writes when feeds are shared with other nodes, NULL if they aren't
+	rssm_leases* leases;
+	FILE* log;
+	int v;
+};
+typedef struct __websub rssm_websub;
+
+//Listen on the port of the callback url base, returns 0 on success
+int websubOpen(rssm_websub* w, const char* base, struct __feed** feeds, FILE* log, int v);
+//Give a feed added after websubOpen its callback url
+void websubAdd(rssm_websub* w, struct __feed* feed);
+//Start answering hubs and subscribing to the hubs feeds name
+int websubStart(rssm_websub* w);
+//A fetch of feed found hub, topic is the feed's self link or its url
+void websubDiscover(rssm_websub* w, struct __feed* feed, const char* hub, const char* topic);
+//returns 1 if a hub is pushing feed, so it only needs a safety net poll
+int websubActive(struct __feed* feed);
+//returns how many pushes were written since the last call
+size_t websubTake(rssm_websub* w);
+void websubClose(rssm_websub* w);
+
+#endif //_WEBSUB_H_
@@ -0,0 +1,61 @@
+#ifndef _WRITER_H_
+#define _WRITER_H_
+
+#include <stdio.h>
+#include <stddef.h>
+#include <linux/io_uring.h>
+
+#include "identity.h"
+#include "lease.h"
+
+//Submission queue size of the io_uring, feeds past it go in further submissions
+#define WRITER_RING 256
+
+struct __feed;
+
+//An item waiting in a feed's pending buffer
+struct __pendingItem {
+	size_t off, len;
+	rssm_itemid id;
+};
+
+//Items a feed wrote this check that haven't reached its item file yet
+struct __pending {
+	char* buf;
+	size_t len, cap;
+	struct __pendingItem* items;
+	size_t count, itemCap;
+};
+typedef struct __pending rssm_pending;
+
+//Writes every feed's pending items at the end of a check, one write per feed
+//With an io_uring all the writes go to the kernel in one submission, otherwise they are plain pwrite()s
+struct __writer {
+	//io_uring fd, -1 when using pwrite
+	int ring;
+	unsigned entries;
+	unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+	unsigned *cqHead, *cqTail, *cqMask;
+	struct io_uring_sqe* sqes;
+	struct io_uring_cqe* cqes;
+	void *sqMap, *cqMap;
+	size_t sqLen, cqLen, sqesLen;
+	//Leases on the shards this node writes when feeds are shared with other nodes, NULL if they aren't
+	rssm_leases* leases;
+};
+typedef struct __writer rssm_writer;
+
+//Set up a writer, trying an io_uring if uring is set
+//returns 1 when an io_uring is in use and 0 when falling back to pwrite
+int writerOpen(rssm_writer* w, int uring);
+//Queue len bytes of item id for p's item file
+int writerQueue(rssm_pending* p, rssm_itemid id, const char* buf, size_t len);
+//Append every feed's pending items to its item file and announce them
+//Items of feeds in a shard another node holds are dropped, that node writes them
+//returns the number of items written, -1 if any feed couldn't be written
+int writerFlush(rssm_writer* w, struct __feed** feeds, FILE* log);
+void writerClose(rssm_writer* w);
+//Free a feed's pending buffer
+void pendingFree(rssm_pending* p);
+
+#endif //_WRITER_H_
@@ -0,0 +1,386 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include <zstd.h>
+
+#include "archive.h"
+#include "setting.h"
+#include "pool.h"
+#include "rssmio.h"
+#include "itemfile.h"
+#include "hmac.h"
+
+//One document in the archive's log, waiting to be read again
+struct __replay {
+	size_t feed;
+	long code;
+	//when it was read, so replayed items keep the time they were first fetched at
+	long fetched;
+	char hex[SHA256_LEN * 2 + 1];
+};
+
+//Shared between the threads of one archiveReplay
+struct __replayer {
+	const char* dir;
+	rssm_feeditem** feeds;
+	//documents grouped by feed in the order fetched, feed i's are first[i] up to first[i+1]
+	struct __replay* docs;
+	size_t* first;
+	size_t nfeeds, next;
+	rssm_writer* writer;
+	pthread_mutex_t flushLock;
+	FILE* log;
+	int v;
+	rssm_summary* sum;
+	size_t bytes;
+	pthread_mutex_t lock;
+};
+
+int archiveOpen(rssm_archive* a, const char* dir) {
+	memset(a, 0, sizeof(rssm_archive));
+	pthread_mutex_init(&a->lock, NULL);
+	
+	a->dir = malloc(strlen(dir) + 15);
+	if (a->dir == NULL)
+		return -1;
+	sprintf(a->dir, "%s/.rssm archive", dir);
+	if (mkdir(a->dir, 0755) != 0 && errno != EEXIST)
+		return -1;
+	
+	char path[strlen(a->dir) + 5];
+	sprintf(path, "%s/log", a->dir);
+	a->log = fopen(path, "a");
+	return a->log != NULL ? 0 : -1;
+}
+
+int archiveStore(rssm_archive* a, const char* tag, long code, const char* buf, size_t len) {
+	rssm_sha sha;
+	uint8_t sum[SHA256_LEN];
+	char hex[SHA256_LEN * 2 + 1];
+	shaInit(&sha, 1);
+	shaUpdate(&sha, buf, len);
+	shaFinal(&sha, sum);
+	int i;
+	for (i = 0; i < SHA256_LEN; i++)
+		sprintf(hex + i * 2, "%02x", sum[i]);
+	
+	//Bodies are spread over 256 directories by the first byte of their hash
+	char path[strlen(a->dir) + SHA256_LEN * 2 + 8];
+	sprintf(path, "%s/%.2s", a->dir, hex);
+	if (mkdir(path, 0755) != 0 && errno != EEXIST)
+		return -1;
+	sprintf(path, "%s/%.2s/%s", a->dir, hex, hex);
+	
+	//A feed polled again without changing is only logged
+	int stored = 0;
+	size_t packed = 0;
+	if (access(path, F_OK) != 0) {
+		size_t bound = ZSTD_compressBound(len);
+		char* comp = malloc(bound);
+		if (comp == NULL)
+			return -1;
+		packed = ZSTD_compress(comp, bound, buf, len, ARCHIVE_LEVEL);
+		if (ZSTD_isError(packed)) {
+			free(comp);
+			return -1;
+		}
+		
+		//Written aside first so a reader never sees half a body, two threads storing the same one write the same bytes
+		char tmp[strlen(path) + 24];
+		sprintf(tmp, "%s.%lx.tmp", path, (unsigned long)pthread_self());
+		FILE* f = fopen(tmp, "w");
+		int ok = f != NULL && fwrite(comp, 1, packed, f) == packed;
+		if (f != NULL && fclose(f) != 0)
+			ok = 0;
+		free(comp);
+		if (!ok || rename(tmp, path) != 0) {
+			remove(tmp);
+			return -1;
+		}
+		stored = 1;
+	}
+	
+	pthread_mutex_lock(&a->lock);
+	fprintf(a->log, "%lld\t%s\t%ld\t%s\t%zu\n", (long long)time(NULL), tag, code, hex, len);
+	fflush(a->log);
+	if (stored) {
+		a->stored++;
+		a->packed += packed;
+	} else {
+		a->deduped++;
+	}
+	a->bytes += len;
+	pthread_mutex_unlock(&a->lock);
+	
+	return 0;
+}
+
+void archiveReport(rssm_archive* a, FILE* log) {
+	pthread_mutex_lock(&a->lock);
+	printtime(log);
+	fprintf(log, "Archived %zu responses (%zu bytes) since the last report, %zu new ones stored in %zu bytes and %zu unchanged.\n",
+	        a->stored + a->deduped, a->bytes, a->stored, a->packed, a->deduped);
+	a->stored  = 0;
+	a->deduped = 0;
+	a->bytes   = 0;
+	a->packed  = 0;
+	pthread_mutex_unlock(&a->lock);
+}
+
+void archiveClose(rssm_archive* a) {
+	if (a->log != NULL)
+		fclose(a->log);
+	a->log = NULL;
+	free(a->dir);
+	a->dir = NULL;
+	pthread_mutex_destroy(&a->lock);
+}
+
+//Read the body of doc back, \0 terminated, into *buf which is grown as needed
+//returns its length, -1 if it is missing or corrupt
+static long long readBody(struct __replayer* r, ZSTD_DCtx* dctx, const struct __replay* doc, char** buf, size_t* cap) {
+	char path[strlen(r->dir) + SHA256_LEN * 2 + 24];
+	sprintf(path, "%s/.rssm archive/%.2s/%s", r->dir, doc->hex, doc->hex);
+	size_t len;
+	char* comp = mapFile(path, &len);
+	if (comp == NULL)
+		return -1;
+	
+	unsigned long long size = ZSTD_getFrameContentSize(comp, len);
+	if (size == ZSTD_CONTENTSIZE_UNKNOWN || size == ZSTD_CONTENTSIZE_ERROR) {
+		unmapFile(comp, len);
+		return -1;
+	}
+	if (size + 1 > *cap) {
+		char* grown = realloc(*buf, size + 1);
+		if (grown == NULL) {
+			unmapFile(comp, len);
+			return -1;
+		}
+		*buf = grown;
+		*cap = size + 1;
+	}
+	
+	size_t got = ZSTD_decompressDCtx(dctx, *buf, size, comp, len);
+	unmapFile(comp, len);
+	if (ZSTD_isError(got) || got != size)
+		return -1;
+	(*buf)[got] = '\0';
+	return got;
+}
+
+//Take feeds off the list and read their documents again in order until there are none left
+static void* replayWorker(void* arg) {
+	struct __replayer* r = arg;
+	ZSTD_DCtx* dctx = ZSTD_createDCtx();
+	char* buf = NULL;
+	size_t cap = 0;
+	
+	while (dctx != NULL) {
+		pthread_mutex_lock(&r->lock);
+		while (r->next < r->nfeeds && r->first[r->next] == r->first[r->next + 1])
+			r->next++;
+		size_t i = r->next;
+		if (i < r->nfeeds)
+			r->next++;
+		pthread_mutex_unlock(&r->lock);
+		
+		if (i >= r->nfeeds)
+			break;
+		
+		rssm_feeditem* feed = r->feeds[i];
+		size_t d;
+		for (d = r->first[i]; d < r->first[i + 1]; d++) {
+			const struct __replay* doc = &r->docs[d];
+			long long len = readBody(r, dctx, doc, &buf, &cap);
+			int items = -1;
+			if (len < 0) {
+				printtime(r->log);
+				fprintf(r->log, "Archived response %s of %s is missing or corrupt, skipping it.\n", doc->hex, feed->tag);
+			} else {
+				items = replayRss(feed, buf, len, doc->code == 226 || doc->code == ARCHIVE_PUSH, doc->fetched, r->log, r->v);
+			}
+			
+			pthread_mutex_lock(&r->lock);
+			if (items < 0) {
+				r->sum->failed++;
+			} else {
+				r->sum->ok++;
+				r->sum->items += items;
+				r->bytes += len;
+			}
+			pthread_mutex_unlock(&r->lock);
+			
+			//One thread flushes while the others keep reading
+			if (feed->budget != NULL && budgetWriteFull(feed->budget) && pthread_mutex_trylock(&r->flushLock) == 0) {
+				if (writerFlush(r->writer, r->feeds, r->log) < 0) {
+					printtime(r->log);
+					fprintf(r->log, "Error writing some of the new items.\n");
+				}
+				pthread_mutex_unlock(&r->flushLock);
+			}
+		}
+	}
+	
+	free(buf);
+	ZSTD_freeDCtx(dctx);
+	rssmioThreadDone();
+	return NULL;
+}
+
+//Split a "a\tb\t...\n" line in place into n fields, returns how many it had
+static int splitLine(char* line, char** fields, int n) {
+	line[strcspn(line, "\n")] = '\0';
+	
+	int i;
+	for (i = 0; i < n && line != NULL; i++) {
+		fields[i] = line;
+		line = strchr(line, '\t');
+		if (line != NULL && i < n - 1)
+			*line++ = '\0';
+		else
+			line = NULL;
+	}
+	return i;
+}
+
+int archiveReplay(const char* dir, rssm_feeditem** feeds, int jobs, rssm_writer* writer, FILE* log, int v, rssm_summary* sum) {
+	struct __replayer r;
+	memset(&r, 0, sizeof(r));
+	r.dir    = dir;
+	r.feeds  = feeds;
+	r.writer = writer;
+	r.log    = log;
+	r.v      = v;
+	r.sum    = sum;
+	
+	char path[strlen(dir) + 20];
+	sprintf(path, "%s/.rssm archive/log", dir);
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	
+	//Tags are looked up by hash, value is the feed's place in the list plus one
+	rssm_keyset tags;
+	memset(&tags, 0, sizeof(rssm_keyset));
+	while (feeds[r.nfeeds] != NULL) {
+		keysetPut(&tags, keyHash(feeds[r.nfeeds]->tag, strlen(feeds[r.nfeeds]->tag)), r.nfeeds + 1);
+		r.nfeeds++;
+	}
+	
+	struct __replay* docs = NULL;
+	size_t count = 0, docCap = 0, skipped = 0;
+	char* line = NULL;
+	size_t lineCap = 0;
+	char* fields[5];
+	while (getline(&line, &lineCap, f) > 0) {
+		uint64_t place;
+		if (splitLine(line, fields, 5) != 5 || strlen(fields[3]) != SHA256_LEN * 2)
+			continue;
+		if (!keysetGet(&tags, keyHash(fields[1], strlen(fields[1])), &place)) {
+			skipped++;
+			continue;
+		}
+		if (count == docCap) {
+			size_t grown = docCap > 0 ? docCap * 2 : 256;
+			//Replaying only part of the log would leave the feeds looking complete, so none of it is
+			struct __replay* more = realloc(docs, sizeof(struct __replay) * grown);
+			if (more == NULL) {
+				free(docs);
+				free(line);
+				fclose(f);
+				keysetFree(&tags);
+				return -1;
+			}
+			docs   = more;
+			docCap = grown;
+		}
+		docs[count].feed    = place - 1;
+		docs[count].code    = atol(fields[2]);
+		docs[count].fetched = atol(fields[0]);
+		strcpy(docs[count].hex, fields[3]);
+		count++;
+	}
+	free(line);
+	fclose(f);
+	keysetFree(&tags);
+	
+	//Each feed's documents are read in the order they were fetched, so they're grouped by feed keeping that order
+	r.first = calloc(r.nfeeds + 1, sizeof(size_t));
+	r.docs  = malloc(sizeof(struct __replay) * (count > 0 ? count : 1));
+	if (r.first == NULL || r.docs == NULL) {
+		free(r.first);
+		free(r.docs);
+		free(docs);
+		return -1;
+	}
+	size_t i;
+	for (i = 0; i < count; i++)
+		r.first[docs[i].feed + 1]++;
+	for (i = 0; i < r.nfeeds; i++)
+		r.first[i + 1] += r.first[i];
+	size_t* fill = calloc(r.nfeeds + 1, sizeof(size_t));
+	if (fill != NULL) {
+		memcpy(fill, r.first, sizeof(size_t) * (r.nfeeds + 1));
+		for (i = 0; i < count; i++)
+			r.docs[fill[docs[i].feed]++] = docs[i];
+		free(fill);
+	}
+	free(docs);
+	if (fill == NULL) {
+		free(r.first);
+		free(r.docs);
+		return -1;
+	}
+	
+	if (v || skipped > 0) {
+		printtime(log);
+		fprintf(log, "Reading %zu archived responses again, %zu of feeds not in the feedlist are skipped.\n", count, skipped);
+	}
+	
+	pthread_mutex_init(&r.lock, NULL);
+	pthread_mutex_init(&r.flushLock, NULL);
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	//No point in more threads than feeds
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > POOL_MAX)
+		jobs = POOL_MAX;
+	if ((size_t)jobs > r.nfeeds)
+		jobs = r.nfeeds;
+	
+	pthread_t threads[POOL_MAX];
+	int started = 0;
+	for (; started < jobs; started++) {
+		if (pthread_create(&threads[started], NULL, replayWorker, &r) != 0) {
+			printtime(log);
+			fprintf(log, "Could only start %d of %d replay threads.\n", started, jobs);
+			break;
+		}
+	}
+	if (started == 0)
+		replayWorker(&r);
+	for (i = 0; i < (size_t)started; i++)
+		pthread_join(threads[i], NULL);
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sum->secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	pthread_mutex_destroy(&r.lock);
+	pthread_mutex_destroy(&r.flushLock);
+	
+	//As a benchmark this is the parse and write rate with the network taken out
+	printtime(log);
+	fprintf(log, "Read %zu bytes of archived responses on %d threads, %.1f MB/s and %.0f responses/s.\n", r.bytes, started > 0 ? started : 1,
+	        sum->secs > 0 ? r.bytes / sum->secs / (1024 * 1024) : 0, sum->secs > 0 ? (sum->ok + sum->failed) / sum->secs : 0);
+	
+	free(r.first);
+	free(r.docs);
+	return 0;
+}
@@ -0,0 +1,211 @@
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <libxml/xmlmemory.h>
+
+#include "arena.h"
+
+//Every allocation is 16 byte aligned and carries its size in the 16 bytes before it
+#define ARENA_ALIGN(x) (((x) + 15) & ~((size_t)15))
+#define ARENA_HEAD 16
+
+//The size of an allocation, stored right before it
+static size_t* sizeOf(void* ptr) {
+	return (size_t *)((char *)ptr - sizeof(size_t));
+}
+
+//Get a chunk with at least min bytes of room, reusing a spare one if possible
+static struct __arenaChunk* newChunk(rssm_arena* a, size_t min) {
+	struct __arenaChunk** prev;
+	struct __arenaChunk* c;
+
+	for (prev = &a->spare; *prev != NULL; prev = &(*prev)->next) {
+		if ((*prev)->size >= min) {
+			c = *prev;
+			*prev = c->next;
+			c->off = 0;
+			return c;
+		}
+	}
+
+	size_t size = min > ARENA_CHUNK ? min : ARENA_CHUNK;
+	c = malloc(sizeof(struct __arenaChunk) + size);
+	if (c == NULL)
+		return NULL;
+	c->size = size;
+	c->off  = 0;
+	return c;
+}
+
+//Find the chunk holding ptr
+static struct __arenaChunk* chunkOf(const rssm_arena* a, const void* ptr) {
+	struct __arenaChunk* c;
+	for (c = a->head; c != NULL; c = c->next)
+		if ((const char *)ptr >= c->data && (const char *)ptr < c->data + c->off)
+			return c;
+	return NULL;
+}
+
+//Bump an allocation of size bytes out of the arena
+void* arenaAlloc(rssm_arena* a, size_t size) {
+	size_t need = ARENA_ALIGN(size) + ARENA_HEAD + 15;
+	struct __arenaChunk* c = a->head;
+
+	if (c == NULL || c->off + need > c->size) {
+		c = newChunk(a, need);
+		if (c == NULL)
+			return NULL;
+
+		//Oversized allocations get their own chunk, which goes behind the head so the head keeps bumping
+		if (need > ARENA_CHUNK / 4 && a->head != NULL) {
+			c->next = a->head->next;
+			a->head->next = c;
+		} else {
+			c->next = a->head;
+			a->head = c;
+		}
+
+		a->used += c->size;
+		if (a->used > a->peak)
+			a->peak = a->used;
+	}
+
+	uintptr_t start = ((uintptr_t)(c->data + c->off) + 15) & ~((uintptr_t)15);
+	char* ptr = (char *)start + ARENA_HEAD;
+	*sizeOf(ptr) = size;
+	c->off = (ptr + ARENA_ALIGN(size)) - c->data;
+
+	return ptr;
+}
+
+//Resize an arena allocation
+void* arenaRealloc(rssm_arena* a, void* ptr, size_t size) {
+	if (ptr == NULL)
+		return arenaAlloc(a, size);
+
+	size_t old = *sizeOf(ptr);
+	struct __arenaChunk* c = chunkOf(a, ptr);
+
+	//The last allocation of a chunk can grow into the rest of the chunk
+	if (c != NULL && (char *)ptr + ARENA_ALIGN(old) == c->data + c->off) {
+		size_t off = ((char *)ptr - c->data) + ARENA_ALIGN(size);
+		if (off <= c->size) {
+			c->off = off;
+			*sizeOf(ptr) = size;
+			return ptr;
+		}
+	}
+
+	if (size <= old) {
+		*sizeOf(ptr) = size;
+		return ptr;
+	}
+
+	void* ret = arenaAlloc(a, size);
+	if (ret == NULL)
+		return NULL;
+	memcpy(ret, ptr, old);
+
+	return ret;
+}
+
+//Copy str into the arena
+char* arenaStrdup(rssm_arena* a, const char* str) {
+	size_t len = strlen(str) + 1;
+	char* ret = arenaAlloc(a, len);
+	if (ret != NULL)
+		memcpy(ret, str, len);
+	return ret;
+}
+
+//Check if ptr was allocated from a
+int arenaOwns(const rssm_arena* a, const void* ptr) {
+	return chunkOf(a, ptr) != NULL;
+}
+
+//Drop all allocations, keeping ARENA_KEEP bytes worth of chunks so the next fetch doesn't hit malloc
+void arenaReset(rssm_arena* a) {
+	struct __arenaChunk* c;
+	struct __arenaChunk* next;
+
+	for (c = a->head; c != NULL; c = next) {
+		next = c->next;
+		c->next  = a->spare;
+		a->spare = c;
+	}
+	a->head = NULL;
+
+	size_t kept = 0;
+	struct __arenaChunk** prev = &a->spare;
+	while (*prev != NULL) {
+		c = *prev;
+		if (kept + c->size > ARENA_KEEP) {
+			*prev = c->next;
+			free(c);
+			continue;
+		}
+		kept += c->size;
+		prev = &c->next;
+	}
+
+	a->used = 0;
+}
+
+//Free the arena
+void arenaFree(rssm_arena* a) {
+	arenaReset(a);
+
+	struct __arenaChunk* c;
+	struct __arenaChunk* next;
+	for (c = a->spare; c != NULL; c = next) {
+		next = c->next;
+		free(c);
+	}
+	a->spare = NULL;
+}
+
+//The arena libxml2 allocates out of on this thread, NULL for plain malloc
+static __thread rssm_arena* xmlArena = NULL;
+
+static void* xmlArenaMalloc(size_t size) {
+	if (xmlArena != NULL)
+		return arenaAlloc(xmlArena, size);
+	return malloc(size);
+}
+
+//Pointers malloc'd before the arena was bound stay on the system heap
+static void* xmlArenaRealloc(void* ptr, size_t size) {
+	if (ptr == NULL)
+		return xmlArenaMalloc(size);
+	if (xmlArena != NULL && arenaOwns(xmlArena, ptr))
+		return arenaRealloc(xmlArena, ptr, size);
+	return realloc(ptr, size);
+}
+
+//Freeing an arena pointer does nothing, the whole arena goes at once in arenaReset()
+static void xmlArenaFree(void* ptr) {
+	if (ptr == NULL)
+		return;
+	if (xmlArena != NULL && arenaOwns(xmlArena, ptr))
+		return;
+	free(ptr);
+}
+
+static char* xmlArenaStrdup(const char* str) {
+	size_t len = strlen(str) + 1;
+	char* ret = xmlArenaMalloc(len);
+	if (ret != NULL)
+		memcpy(ret, str, len);
+	return ret;
+}
+
+//Hook libxml2's allocator
+int arenaXmlSetup(void) {
+	return xmlMemSetup(xmlArenaFree, xmlArenaMalloc, xmlArenaRealloc, xmlArenaStrdup);
+}
+
+//Set which arena libxml2 uses on this thread
+void arenaXmlBind(rssm_arena* a) {
+	xmlArena = a;
+}
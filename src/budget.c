@@ -0,0 +1,134 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "budget.h"
+#include "rssmio.h"
+
+static const char* stageNames[BUDGET_STAGES] = {"fetch", "parse", "write"};
+
+void budgetInit(rssm_budget* b, size_t limit) {
+	memset(b, 0, sizeof(rssm_budget));
+	b->limit = limit;
+	pthread_mutex_init(&b->lock, NULL);
+	pthread_cond_init(&b->freed, NULL);
+}
+
+void budgetFree(rssm_budget* b) {
+	pthread_mutex_destroy(&b->lock);
+	pthread_cond_destroy(&b->freed);
+}
+
+//Only called with the lock held
+static void charge(rssm_budget* b, int stage, size_t bytes) {
+	b->stage[stage] += bytes;
+	b->used += bytes;
+	if (b->stage[stage] > b->stagePeak[stage])
+		b->stagePeak[stage] = b->stage[stage];
+	if (b->used > b->peak)
+		b->peak = b->used;
+}
+
+void budgetEnter(rssm_budget* b, rssm_budgetuse* u, size_t estimate) {
+	memset(u, 0, sizeof(rssm_budgetuse));
+	
+	pthread_mutex_lock(&b->lock);
+	//Something running will free memory, with nothing running the fetch goes ahead anyway
+	if (b->limit > 0 && b->used + estimate > b->limit && b->active > 0) {
+		b->deferred++;
+		while (b->used + estimate > b->limit && b->active > 0)
+			pthread_cond_wait(&b->freed, &b->lock);
+	}
+	b->active++;
+	pthread_mutex_unlock(&b->lock);
+}
+
+void budgetParse(rssm_budget* b, rssm_budgetuse* u, size_t estimate) {
+	pthread_mutex_lock(&b->lock);
+	//Parses never wait on anything but other parses, so one always gets to run
+	if (b->limit > 0 && b->used + estimate > b->limit && b->parsing > 0) {
+		b->deferred++;
+		while (b->used + estimate > b->limit && b->parsing > 0)
+			pthread_cond_wait(&b->freed, &b->lock);
+	}
+	b->parsing++;
+	u->parsing = 1;
+	pthread_mutex_unlock(&b->lock);
+}
+
+void budgetCharge(rssm_budget* b, rssm_budgetuse* u, int stage, size_t bytes) {
+	pthread_mutex_lock(&b->lock);
+	charge(b, stage, bytes);
+	pthread_mutex_unlock(&b->lock);
+	
+	if (u != NULL)
+		u->stage[stage] += bytes;
+}
+
+void budgetRelease(rssm_budget* b, int stage, size_t bytes) {
+	pthread_mutex_lock(&b->lock);
+	b->stage[stage] -= bytes;
+	b->used -= bytes;
+	pthread_cond_broadcast(&b->freed);
+	pthread_mutex_unlock(&b->lock);
+}
+
+void budgetLeave(rssm_budget* b, rssm_budgetuse* u) {
+	pthread_mutex_lock(&b->lock);
+	int i;
+	for (i = 0; i < BUDGET_STAGES; i++) {
+		b->stage[i] -= u->stage[i];
+		b->used -= u->stage[i];
+	}
+	if (u->parsing)
+		b->parsing--;
+	b->active--;
+	pthread_cond_broadcast(&b->freed);
+	pthread_mutex_unlock(&b->lock);
+	
+	memset(u, 0, sizeof(rssm_budgetuse));
+}
+
+int budgetWriteFull(rssm_budget* b) {
+	pthread_mutex_lock(&b->lock);
+	int full = b->limit > 0 && b->stage[BUDGET_WRITE] >= b->limit / 2;
+	pthread_mutex_unlock(&b->lock);
+	return full;
+}
+
+//Print bytes with a k, M or G suffix
+static void printSize(FILE* f, size_t bytes) {
+	if (bytes >= 1024L * 1024 * 1024)
+		fprintf(f, "%.1fG", bytes / (1024.0 * 1024 * 1024));
+	else if (bytes >= 1024 * 1024)
+		fprintf(f, "%.1fM", bytes / (1024.0 * 1024));
+	else
+		fprintf(f, "%.1fk", bytes / 1024.0);
+}
+
+void budgetReport(rssm_budget* b, FILE* log) {
+	pthread_mutex_lock(&b->lock);
+	
+	printtime(log);
+	fprintf(log, "Memory use:");
+	int i;
+	for (i = 0; i < BUDGET_STAGES; i++) {
+		fprintf(log, " %s ", stageNames[i]);
+		printSize(log, b->stage[i]);
+		fprintf(log, " (peak ");
+		printSize(log, b->stagePeak[i]);
+		fprintf(log, "),");
+	}
+	fprintf(log, " total ");
+	printSize(log, b->used);
+	fprintf(log, " (peak ");
+	printSize(log, b->peak);
+	fprintf(log, ")");
+	if (b->limit > 0) {
+		fprintf(log, " of ");
+		printSize(log, b->limit);
+		fprintf(log, ", %zu fetches or parses deferred", b->deferred);
+	}
+	fprintf(log, ".\n");
+	
+	pthread_mutex_unlock(&b->lock);
+}
@@ -0,0 +1,322 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include <zstd.h>
+#include <zdict.h>
+
+#include "cold.h"
+
+//Path of a file that sits next to the item file
+static char* sidePath(const char* path, const char* suffix) {
+	char* ret = malloc(strlen(path) + strlen(suffix) + 2);
+	sprintf(ret, "%s %s", path, suffix);
+	return ret;
+}
+
+//Read path's dictionary, *len is 0 when the feed has none
+static char* readDict(const char* path, size_t* len) {
+	char* dictPath = sidePath(path, "dict");
+	char* dict = mapFile(dictPath, len);
+	free(dictPath);
+	
+	if (dict == NULL)
+		*len = 0;
+	return dict;
+}
+
+//Train a dictionary on the items about to be sealed, leaving none if there aren't enough of them
+static void trainDict(const char* path, const char* buf, const rssm_itemspan* items, size_t count) {
+	size_t total = items[count-1].off + items[count-1].len - items[0].off;
+	if (total < COLD_TRAIN || count < 16)
+		return;
+	
+	//Without the memory to train one the items are sealed without a dictionary
+	size_t* sizes = malloc(sizeof(size_t) * count);
+	char* dict = malloc(COLD_DICT);
+	if (sizes == NULL || dict == NULL) {
+		free(sizes);
+		free(dict);
+		return;
+	}
+	size_t i;
+	for (i = 0; i < count; i++)
+		sizes[i] = items[i].len;
+	
+	size_t len = ZDICT_trainFromBuffer(dict, COLD_DICT, buf + items[0].off, sizes, count);
+	free(sizes);
+	
+	if (!ZDICT_isError(len)) {
+		char* dictPath = sidePath(path, "dict");
+		FILE* f = fopen(dictPath, "w");
+		if (f != NULL) {
+			fwrite(dict, 1, len, f);
+			fsync(fileno(f));
+			fclose(f);
+		}
+		free(dictPath);
+	}
+	free(dict);
+}
+
+int coldSeal(const char* path, const char* buf, const rssm_itemspan* items, size_t count) {
+	if (count == 0)
+		return 0;
+	
+	//The dictionary is trained once, every frame after depends on it
+	size_t dictLen;
+	char* dict = readDict(path, &dictLen);
+	if (dictLen == 0) {
+		unmapFile(dict, dictLen);
+		trainDict(path, buf, items, count);
+		dict = readDict(path, &dictLen);
+	}
+	
+	ZSTD_CCtx* cctx = ZSTD_createCCtx();
+	ZSTD_CDict* cdict = dictLen > 0 ? ZSTD_createCDict(dict, dictLen, COLD_LEVEL) : NULL;
+	
+	char* coldPath = sidePath(path, "cold");
+	FILE* f = fopen(coldPath, "a");
+	free(coldPath);
+	
+	int ret = f == NULL || cctx == NULL ? -1 : 0;
+	size_t i = 0;
+	while (ret == 0 && i < count) {
+		//As many items as fit a block, at least one
+		rssm_coldblock block = {COLD_MAGIC, 0, 0, 0, 0};
+		size_t first = i;
+		do {
+			block.raw += items[i].len;
+			if (items[i].fetched > block.newest)
+				block.newest = items[i].fetched;
+			block.items++;
+			i++;
+		} while (i < count && block.raw + items[i].len <= COLD_BLOCK);
+		
+		size_t bound = ZSTD_compressBound(block.raw);
+		char* comp = malloc(bound);
+		if (comp == NULL) {
+			ret = -1;
+			break;
+		}
+		size_t len;
+		if (cdict != NULL)
+			len = ZSTD_compress_usingCDict(cctx, comp, bound, buf + items[first].off, block.raw, cdict);
+		else
+			len = ZSTD_compressCCtx(cctx, comp, bound, buf + items[first].off, block.raw, COLD_LEVEL);
+		
+		if (ZSTD_isError(len)) {
+			ret = -1;
+		} else {
+			block.comp = len;
+			if (fwrite(&block, sizeof(block), 1, f) != 1 || fwrite(comp, 1, len, f) != len)
+				ret = -1;
+		}
+		free(comp);
+	}
+	
+	//Sealed items have to be durable before compaction drops them from the item file
+	if (f != NULL) {
+		if (fflush(f) != 0 || fsync(fileno(f)) != 0)
+			ret = -1;
+		fclose(f);
+	}
+	ZSTD_freeCDict(cdict);
+	ZSTD_freeCCtx(cctx);
+	unmapFile(dict, dictLen);
+	
+	return ret;
+}
+
+//Walks the blocks of a mapped cold file
+struct __coldfile {
+	char* buf;
+	size_t len;
+	char* dict;
+	size_t dictLen;
+	ZSTD_DCtx* dctx;
+	ZSTD_DDict* ddict;
+};
+
+static int coldOpen(struct __coldfile* c, const char* path) {
+	memset(c, 0, sizeof(struct __coldfile));
+	
+	char* coldPath = sidePath(path, "cold");
+	c->buf = mapFile(coldPath, &c->len);
+	free(coldPath);
+	if (c->buf == NULL)
+		return -1;
+	
+	c->dict  = readDict(path, &c->dictLen);
+	c->dctx  = ZSTD_createDCtx();
+	c->ddict = c->dictLen > 0 ? ZSTD_createDDict(c->dict, c->dictLen) : NULL;
+	
+	return 0;
+}
+
+static void coldClose(struct __coldfile* c) {
+	ZSTD_freeDDict(c->ddict);
+	ZSTD_freeDCtx(c->dctx);
+	unmapFile(c->dict, c->dictLen);
+	unmapFile(c->buf, c->len);
+}
+
+//Header of the block at off, NULL at the end of the file or if the block is cut short
+static const rssm_coldblock* blockAt(const struct __coldfile* c, size_t off) {
+	if (off + sizeof(rssm_coldblock) > c->len)
+		return NULL;
+	
+	const rssm_coldblock* b = (const rssm_coldblock *)(c->buf + off);
+	if (b->magic != COLD_MAGIC || off + sizeof(rssm_coldblock) + b->comp > c->len)
+		return NULL;
+	
+	return b;
+}
+
+//Decompress the block at off, returns the malloc'd items and sets *len, NULL on error
+static char* decompressBlock(struct __coldfile* c, size_t off, size_t* len) {
+	const rssm_coldblock* b = blockAt(c, off);
+	char* raw = malloc(b->raw);
+	if (raw == NULL)
+		return NULL;
+	const char* comp = c->buf + off + sizeof(rssm_coldblock);
+	
+	if (c->ddict != NULL)
+		*len = ZSTD_decompress_usingDDict(c->dctx, raw, b->raw, comp, b->comp, c->ddict);
+	else
+		*len = ZSTD_decompressDCtx(c->dctx, raw, b->raw, comp, b->comp);
+	
+	if (ZSTD_isError(*len)) {
+		free(raw);
+		return NULL;
+	}
+	
+	return raw;
+}
+
+//Decompress the block at off and scan its items, returns the number of items or -1
+static long scanBlock(struct __coldfile* c, size_t off, rssm_itemfn fn, void* data) {
+	size_t len;
+	char* raw = decompressBlock(c, off, &len);
+	if (raw == NULL)
+		return -1;
+	
+	itemScan(raw, len, fn, data);
+	free(raw);
+	
+	return blockAt(c, off)->items;
+}
+
+long coldScan(const char* path, rssm_itemfn fn, void* data) {
+	struct __coldfile c;
+	if (coldOpen(&c, path) < 0)
+		return 0;
+	
+	long count = 0;
+	size_t off = 0;
+	const rssm_coldblock* b;
+	for (; (b = blockAt(&c, off)) != NULL; off += sizeof(rssm_coldblock) + b->comp) {
+		long n = scanBlock(&c, off, fn, data);
+		if (n < 0) {
+			count = -1;
+			break;
+		}
+		count += n;
+	}
+	
+	coldClose(&c);
+	return count;
+}
+
+long coldTrim(const char* path, const rssm_retention* r, size_t hotItems, size_t hotBytes, int all, rssm_itemfn fn, void* data, size_t* keep) {
+	*keep = 0;
+	struct __coldfile c;
+	if (coldOpen(&c, path) < 0)
+		return 0;
+	
+	//Totals over the whole cold file first
+	size_t items = 0, bytes = 0, off;
+	const rssm_coldblock* b;
+	for (off = 0; (b = blockAt(&c, off)) != NULL; off += sizeof(rssm_coldblock) + b->comp) {
+		items += b->items;
+		bytes += b->raw;
+	}
+	
+	//Blocks are oldest first, drop from the front while over the limits
+	time_t now = time(NULL);
+	long dropped = 0;
+	for (off = 0; (b = blockAt(&c, off)) != NULL; off += sizeof(rssm_coldblock) + b->comp) {
+		if (!all && !(r->items > 0 && items + hotItems > (size_t)r->items) && !(r->bytes > 0 && bytes + hotBytes > (size_t)r->bytes) &&
+		    !(r->age > 0 && b->newest != 0 && now - b->newest > r->age))
+			break;
+		
+		if (scanBlock(&c, off, fn, data) < 0) {
+			coldClose(&c);
+			return -1;
+		}
+		items   -= b->items;
+		bytes   -= b->raw;
+		dropped += b->items;
+	}
+	
+	//Past the last block when every block goes, blocks sealed after this are kept
+	*keep = dropped > 0 ? off : 0;
+	coldClose(&c);
+	return dropped;
+}
+
+int coldDrop(const char* path, size_t keep) {
+	if (keep == 0)
+		return 0;
+	
+	char* coldPath = sidePath(path, "cold");
+	size_t len;
+	char* buf = mapFile(coldPath, &len);
+	if (buf == NULL || keep > len) {
+		unmapFile(buf, len);
+		free(coldPath);
+		return -1;
+	}
+	
+	//Keep the remaining blocks, replacing the file in one rename
+	char* tmp = sidePath(path, "cold.tmp");
+	FILE* f = fopen(tmp, "w");
+	int ok = f != NULL && fwrite(buf + keep, 1, len - keep, f) == len - keep && fflush(f) == 0 && fsync(fileno(f)) == 0;
+	if (f != NULL)
+		fclose(f);
+	ok = ok && rename(tmp, coldPath) == 0;
+	if (!ok)
+		remove(tmp);
+	
+	free(coldPath);
+	free(tmp);
+	unmapFile(buf, len);
+	
+	return ok ? 0 : -1;
+}
+
+int coldCat(const char* path, FILE* out) {
+	struct __coldfile c;
+	if (coldOpen(&c, path) == 0) {
+		size_t off, len;
+		const rssm_coldblock* b;
+		for (off = 0; (b = blockAt(&c, off)) != NULL; off += sizeof(rssm_coldblock) + b->comp) {
+			char* raw = decompressBlock(&c, off, &len);
+			if (raw != NULL)
+				fwrite(raw, 1, len, out);
+			free(raw);
+		}
+		coldClose(&c);
+	}
+	
+	size_t len;
+	char* hot = mapFile(path, &len);
+	if (hot == NULL)
+		return -1;
+	fwrite(hot, 1, len, out);
+	unmapFile(hot, len);
+	
+	return 0;
+}
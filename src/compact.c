@@ -0,0 +1,260 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "compact.h"
+#include "rssmio.h"
+#include "itemfile.h"
+#include "cold.h"
+#include "index.h"
+
+//Growable list of an item file's items
+struct __spans {
+	rssm_itemspan* items;
+	size_t count, cap;
+};
+
+static int collectSpan(const rssm_itemspan* item, void* data) {
+	struct __spans* s = data;
+	
+	if (s->count == s->cap) {
+		size_t cap = s->cap == 0 ? 256 : s->cap * 2;
+		rssm_itemspan* items = realloc(s->items, sizeof(rssm_itemspan) * cap);
+		if (items == NULL)
+			return -1;
+		s->items = items;
+		s->cap   = cap;
+	}
+	
+	s->items[s->count++] = *item;
+	return 0;
+}
+
+//Index of the oldest item the policy keeps, items are stored oldest first
+static size_t firstKept(const struct __spans* s, const rssm_retention* r) {
+	time_t now = time(NULL);
+	size_t bytes = 0;
+	size_t i;
+	
+	for (i = s->count; i > 0; i--) {
+		const rssm_itemspan* item = &s->items[i-1];
+		
+		if (r->items > 0 && s->count - (i - 1) > (size_t)r->items)
+			return i;
+		if (r->bytes > 0 && bytes + item->len > (size_t)r->bytes)
+			return i;
+		//Items from before fetched: lines existed never expire by age
+		if (r->age > 0 && item->fetched != 0 && now - item->fetched > r->age)
+			return i;
+		bytes += item->len;
+	}
+	
+	return 0;
+}
+
+//Remember what compaction drops so it isn't fetched again, keeping the newest EXPIRED_KEEP
+static int writeExpired(const rssm_feeditem* feed, const rssm_itemspan* items, size_t count) {
+	char path[strlen(feed->path) + 9];
+	sprintf(path, "%s expired", feed->path);
+	
+	FILE* f = fopen(path, "a+");
+	if (f == NULL)
+		return -1;
+	
+	char hex[IDENTITY_HEX + 1];
+	size_t i;
+	for (i = 0; i < count; i++) {
+		identityFormat(items[i].id, hex);
+		fprintf(f, "%s\n", hex);
+	}
+	//Synced, because the items go from the item file and cold storage right after
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+		fclose(f);
+		return -1;
+	}
+	
+	long size = ftell(f);
+	long keep = (long)EXPIRED_KEEP * (IDENTITY_HEX + 1);
+	if (size <= keep)
+		return fclose(f);
+	
+	//Lines are fixed width, so the newest ones are the last keep bytes
+	//Without the memory to trim it the file just stays longer until the next compaction
+	char* buf = malloc(keep);
+	if (buf == NULL)
+		return fclose(f);
+	fseek(f, size - keep, SEEK_SET);
+	size_t got = fread(buf, 1, keep, f);
+	fclose(f);
+	
+	char tmp[strlen(path) + 5];
+	sprintf(tmp, "%s.tmp", path);
+	f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(buf);
+		return -1;
+	}
+	fwrite(buf, 1, got, f);
+	free(buf);
+	
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0) {
+		fclose(f);
+		return -1;
+	}
+	if (fclose(f) != 0)
+		return -1;
+	return rename(tmp, path);
+}
+
+int compactFeed(rssm_feeditem* feed, FILE* log, int v) {
+	const rssm_retention* r = &feed->retention;
+	if (r->items <= 0 && r->age <= 0 && r->bytes <= 0 && r->hot <= 0)
+		return 0;
+	
+	pthread_mutex_lock(&feed->lock);
+	fflush(feed->out);
+	
+	size_t len;
+	char* buf = mapFile(feed->path, &len);
+	if (buf == NULL) {
+		pthread_mutex_unlock(&feed->lock);
+		printtime(log);
+		fprintf(log, "Error reading %s for compaction.\n", feed->path);
+		return -1;
+	}
+	
+	struct __spans s    = {NULL, 0, 0};
+	struct __spans cold = {NULL, 0, 0};
+	size_t end = itemScan(buf, len, collectSpan, &s);
+	size_t i;
+	int ret = -1;
+	
+	//Items before cut are dropped, items from cut to seal move to cold storage
+	size_t cut  = firstKept(&s, r);
+	size_t seal = cut;
+	if (r->hot > 0 && s.count - cut > (size_t)r->hot)
+		seal = s.count - r->hot;
+	
+	//Cold items are older than anything in the item file, so they all go once any hot item expires
+	//Expired blocks are only found here, they are dropped once their identities are saved
+	long coldDropped = 0;
+	size_t coldKeep = 0;
+	if (cut > 0)
+		coldDropped = coldTrim(feed->path, r, 0, 0, 1, collectSpan, &cold, &coldKeep);
+	
+	if (coldDropped >= 0 && seal > cut && coldSeal(feed->path, buf, s.items + cut, seal - cut) < 0) {
+		printtime(log);
+		fprintf(log, "Error sealing items of %s into cold storage.\n", feed->tag);
+		goto done;
+	}
+	
+	if (coldDropped >= 0 && cut == 0) {
+		size_t hotBytes = 0;
+		for (i = seal; i < s.count; i++)
+			hotBytes += s.items[i].len;
+		coldDropped = coldTrim(feed->path, r, s.count - seal, hotBytes, 0, collectSpan, &cold, &coldKeep);
+	}
+	
+	if (coldDropped < 0) {
+		printtime(log);
+		fprintf(log, "Error trimming cold storage of %s .\n", feed->tag);
+		goto done;
+	}
+	
+	//The expired identities have to be on disk before the items go, or a restart would fetch them again
+	if ((cut > 0 && writeExpired(feed, s.items, cut) != 0) || (cold.count > 0 && writeExpired(feed, cold.items, cold.count) != 0)) {
+		printtime(log);
+		fprintf(log, "Error writing expired items of %s .\n", feed->tag);
+		goto done;
+	}
+	
+	//Blocks that can't be dropped now are found again next time, their items are already expired
+	if (coldDrop(feed->path, coldKeep) < 0) {
+		printtime(log);
+		fprintf(log, "Error dropping expired blocks from the cold storage of %s .\n", feed->tag);
+	}
+	
+	ret = cut + coldDropped;
+	if (seal == 0)
+		goto done;
+	
+	//Write the kept items to a new file and rename it over the old one so readers never see half a file
+	char* tmp = malloc(strlen(feed->path) + 9);
+	if (tmp == NULL) {
+		printtime(log);
+		fprintf(log, "Error allocating memory to compact %s .\n", feed->tag);
+		ret = -1;
+		goto done;
+	}
+	sprintf(tmp, "%s.compact", feed->path);
+	FILE* f = fopen(tmp, "w");
+	
+	size_t from = seal < s.count ? s.items[seal].off : end;
+	//New items go to the compacted file once it's renamed, so it's opened for them first and
+	//the item file is left as it is if it can't be
+	FILE* out = NULL;
+	if (f == NULL || fwrite(buf + from, 1, len - from, f) != len - from || fflush(f) != 0 || fsync(fileno(f)) != 0 ||
+	    (out = fopen(tmp, "a+")) == NULL || rename(tmp, feed->path) != 0) {
+		printtime(log);
+		fprintf(log, "Error replacing %s with its compacted items.\n", feed->path);
+		if (f != NULL)
+			fclose(f);
+		if (out != NULL)
+			fclose(out);
+		remove(tmp);
+		free(tmp);
+		ret = -1;
+		goto done;
+	}
+	fclose(f);
+	free(tmp);
+	
+	fclose(feed->out);
+	feed->out = out;
+	//The rewritten file was synced before the rename
+	feed->dirty = 0;
+	if (indexRebuild(feed->path) < 0) {
+		printtime(log);
+		fprintf(log, "Error rebuilding the index of %s .\n", feed->path);
+	}
+	
+	if (feed->events != NULL)
+		eventCompact(feed->events, feed->tag, len - from);
+	
+	if (v) {
+		printtime(log);
+		fprintf(log, "Compacted %s , dropped %zu items, sealed %zu into cold storage.\n", feed->tag, cut + cold.count, seal - cut);
+	}
+	
+done:
+	unmapFile(buf, len);
+	free(s.items);
+	free(cold.items);
+	pthread_mutex_unlock(&feed->lock);
+	
+	return ret;
+}
+
+void* compactThread(void* args) {
+	rssm_compactargs* a = args;
+	int secs = a->mins > 0 ? a->mins * 60 : 300;
+	
+	while (*a->loop) {
+		//Sleep in small steps so a SIGTERM doesn't wait on us
+		int i;
+		for (i = 0; *a->loop && i < secs; i++)
+			sleep(1);
+		
+		//Shared item files are only rewritten by the node writing them
+		uint64_t held = a->leases != NULL ? leaseMask(a->leases) : ~0ULL;
+		size_t j;
+		rssm_feeditem* feed;
+		for (j = 0; *a->loop && (feed = feedAt(a->feeds, j)) != NULL; j++)
+			if (leaseOwns(held, feed->tag))
+				compactFeed(feed, a->log, a->v);
+	}
+	
+	return NULL;
+}
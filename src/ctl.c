@@ -0,0 +1,425 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <argp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "ctl.h"
+#include "rssmio.h"
+
+int ctlOpen(rssm_ctl* c, const rssm_options* opts, rssm_sched* sched, FILE* log, int v) {
+	memset(c, 0, sizeof(rssm_ctl));
+	c->fd     = -1;
+	c->sched  = sched;
+	c->dir    = opts->directory;
+	c->items  = opts->items;
+	c->layout = opts->layout;
+	c->format = opts->format;
+	c->log    = log;
+	c->v      = v;
+	
+	c->path = malloc(strlen(opts->directory) + strlen(CTL_NAME) + 1);
+	if (c->path == NULL)
+		return -1;
+	sprintf(c->path, "%s%s", opts->directory, CTL_NAME);
+	
+	//The socket is made in a directory only we can enter and moved into place once it's 0600,
+	//so nobody can connect while bind's umask mode is on it, and the umask stays as the other threads expect
+	char dir[strlen(c->path) + 8];
+	sprintf(dir, "%s.XXXXXX", c->path);
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(dir) + 2 >= sizeof(addr.sun_path) || mkdtemp(dir) == NULL)
+		return -1;
+	sprintf(addr.sun_path, "%s/s", dir);
+	
+	//We hold the lock, so a socket left there is from a daemon that didn't get to remove it
+	unlink(c->path);
+	c->fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (c->fd < 0 || bind(c->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || chmod(addr.sun_path, 0600) != 0 ||
+	    rename(addr.sun_path, c->path) != 0 || listen(c->fd, 8) != 0) {
+		if (c->fd >= 0)
+			close(c->fd);
+		c->fd = -1;
+		unlink(addr.sun_path);
+		rmdir(dir);
+		return -1;
+	}
+	rmdir(dir);
+	
+	return 0;
+}
+
+//A tag added over the socket names files in the rss directory
+static int validTag(const char* tag) {
+	return *tag != '\0' && *tag != '.' && strchr(tag, '/') == NULL && strlen(tag) < 256;
+}
+
+//An interval like 90, 30s, 5m, 2h or 1d in seconds, -1 if it isn't one or is longer than SCHED_EVERY_MAX
+static long parseEvery(const char* arg) {
+	char* unit;
+	long val = strtol(arg, &unit, 10);
+	if (unit == arg || val < 0)
+		return -1;
+	long mult;
+	switch (*unit) {
+		case '\0': case 's': mult = 1; break;
+		case 'm': mult = 60; break;
+		case 'h': mult = 60 * 60; break;
+		case 'd': mult = 24 * 60 * 60; break;
+		default: return -1;
+	}
+	if (val > SCHED_EVERY_MAX / mult)
+		return -1;
+	return *unit != '\0' && unit[1] != '\0' ? -1 : val * mult;
+}
+
+//Set up feed tag fetching url like the ones in the feedlist, priority is the rest of the command
+static void addFeed(rssm_ctl* c, const char* tag, const char* url, const char* priority, FILE* out) {
+	rssm_sched* s = c->sched;
+	
+	long i = schedFind(s, tag);
+	if (i >= 0) {
+		//Adding a removed tag back starts fetching it again, from the url given this time
+		char* copy = strdup(url);
+		if (copy == NULL || schedRevive(s, i, copy) < 0) {
+			free(copy);
+			fprintf(out, "error %s is already a feed\n", tag);
+			return;
+		}
+		printtime(c->log);
+		fprintf(c->log, "Fetching %s again from %s , as asked over the control socket.\n", tag, url);
+		fprintf(out, "ok\n");
+		return;
+	}
+	
+	rssm_feeditem* feed = newFeed(tag, url);
+	if (feed == NULL) {
+		fprintf(out, "error out of memory\n");
+		return;
+	}
+	if (priority != NULL && parsePriority(priority, &feed->priority, c->log) < 0) {
+		freeFeed(feed);
+		fprintf(out, "error %s is not a priority, it should be critical, normal or low and an optional interval\n", priority);
+		return;
+	}
+	if (openFeed(feed, c->items, c->layout, c->format, c->log, c->v) < 0) {
+		freeFeed(feed);
+		fprintf(out, "error can not set up the files of %s , see the log\n", tag);
+		return;
+	}
+	
+	//Whatever the feeds share is shared with it too
+	rssm_feeditem* first = s->feeds[0];
+	feed->seen       = first->seen;
+	feed->events     = first->events;
+	feed->wal        = first->wal;
+	feed->search     = first->search;
+	feed->budget     = first->budget;
+	feed->enclosures = first->enclosures;
+	feed->archive    = first->archive;
+	feed->websub     = first->websub;
+	if (feed->websub != NULL)
+		websubAdd(feed->websub, feed);
+	
+	if (schedAdd(s, feed) < 0) {
+		freeFeed(feed);
+		fprintf(out, "error no more feeds can be added, restart rssm with it in the feedlist\n");
+		return;
+	}
+	writeManifest(c->dir, s->feeds, c->log);
+	
+	printtime(c->log);
+	fprintf(c->log, "Added %s fetching %s , as asked over the control socket. It's gone after a restart unless it's in the feedlist.\n", tag, url);
+	fprintf(out, "ok\n");
+}
+
+//Carry out one command, writing the answer to out
+static void command(rssm_ctl* c, char* line, FILE* out) {
+	rssm_sched* s = c->sched;
+	
+	char* save = NULL;
+	char* cmd  = strtok_r(line, " \t\r\n", &save);
+	char* tag  = strtok_r(NULL, " \t\r\n", &save);
+	if (cmd == NULL) {
+		fprintf(out, "error no command\n");
+		return;
+	}
+	
+	if (strcmp(cmd, "state") == 0) {
+		long i = tag != NULL ? schedFind(s, tag) : -1;
+		if (tag != NULL && i < 0) {
+			fprintf(out, "error there is no feed %s\n", tag);
+			return;
+		}
+		fprintf(out, "ok\n");
+		schedDump(s, i, out);
+		return;
+	}
+	
+	if (tag == NULL) {
+		fprintf(out, "error %s needs a tag\n", cmd);
+		return;
+	}
+	
+	if (strcmp(cmd, "add") == 0) {
+		char* url = strtok_r(NULL, " \t\r\n", &save);
+		//The priority is the rest of the line, like in the feedlist
+		char* priority = save != NULL ? save + strspn(save, " \t") : NULL;
+		if (priority != NULL)
+			priority[strcspn(priority, "\r\n")] = '\0';
+		if (url == NULL)
+			fprintf(out, "error add needs a tag and a url\n");
+		else if (!validTag(tag))
+			fprintf(out, "error %s can not be a tag, tags can't start with . or have a /\n", tag);
+		else
+			addFeed(c, tag, url, priority != NULL && *priority != '\0' ? priority : NULL, out);
+		return;
+	}
+	
+	long i = schedFind(s, tag);
+	if (i < 0) {
+		fprintf(out, "error there is no feed %s\n", tag);
+		return;
+	}
+	
+	if (strcmp(cmd, "fetch") == 0) {
+		int ret = schedNow(s, i);
+		if (ret < 0) {
+			fprintf(out, ret == -1 ? "error %s was removed\n" : "error %s is fetched by another node\n", tag);
+			return;
+		}
+		if (c->v) {
+			printtime(c->log);
+			fprintf(c->log, "Fetching %s now, as asked over the control socket.\n", tag);
+		}
+	} else if (strcmp(cmd, "remove") == 0 || strcmp(cmd, "pause") == 0 || strcmp(cmd, "resume") == 0) {
+		int held = 0;
+		if (strcmp(cmd, "remove") == 0)
+			held = SCHED_REMOVED;
+		else if (strcmp(cmd, "pause") == 0)
+			held = SCHED_PAUSED;
+		if (schedHold(s, i, held) < 0) {
+			fprintf(out, "error %s was removed, add it again\n", tag);
+			return;
+		}
+		printtime(c->log);
+		fprintf(c->log, "%s %s , as asked over the control socket.\n", held == SCHED_REMOVED ? "Removed" : held ? "Paused" : "Resumed", tag);
+	} else if (strcmp(cmd, "interval") == 0) {
+		char* arg = strtok_r(NULL, " \t\r\n", &save);
+		long secs = arg != NULL ? parseEvery(arg) : -1;
+		if (secs < 0) {
+			fprintf(out, "error interval needs a tag and a number of seconds up to %ld, or one with an s, m, h or d suffix\n", (long)SCHED_EVERY_MAX);
+			return;
+		}
+		secs = schedEvery(s, i, secs);
+		printtime(c->log);
+		fprintf(c->log, "Fetching %s every %lds, as asked over the control socket.\n", tag, secs);
+	} else {
+		fprintf(out, "error unknown command %s\n", cmd);
+		return;
+	}
+	
+	fprintf(out, "ok\n");
+}
+
+//Read a command line from fd and answer it
+static void serve(rssm_ctl* c, int fd) {
+	char line[CTL_LINE + 1];
+	size_t have = 0;
+	while (have < CTL_LINE && memchr(line, '\n', have) == NULL) {
+		ssize_t got = read(fd, line + have, CTL_LINE - have);
+		if (got <= 0)
+			break;
+		have += got;
+	}
+	line[have] = '\0';
+	
+	char* reply = NULL;
+	size_t len  = 0;
+	FILE* out   = open_memstream(&reply, &len);
+	if (out == NULL)
+		return;
+	if (memchr(line, '\n', have) == NULL && have == CTL_LINE)
+		fprintf(out, "error command too long\n");
+	else
+		command(c, line, out);
+	fclose(out);
+	
+	size_t sent = 0;
+	while (sent < len) {
+		ssize_t wrote = write(fd, reply + sent, len - sent);
+		if (wrote <= 0)
+			break;
+		sent += wrote;
+	}
+	free(reply);
+}
+
+static void* ctlThread(void* arg) {
+	rssm_ctl* c = arg;
+	
+	while (!c->stop) {
+		//Wake up every second to notice being stopped
+		struct pollfd p = {c->fd, POLLIN, 0};
+		if (poll(&p, 1, 1000) <= 0)
+			continue;
+		
+		int fd = accept(c->fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		//A client that stops sending mustn't keep the others out
+		struct timeval tv = {5, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		serve(c, fd);
+		close(fd);
+	}
+	
+	return NULL;
+}
+
+int ctlStart(rssm_ctl* c) {
+	if (pthread_create(&c->thread, NULL, ctlThread, c) != 0)
+		return -1;
+	c->started = 1;
+	return 0;
+}
+
+void ctlClose(rssm_ctl* c) {
+	c->stop = 1;
+	if (c->started)
+		pthread_join(c->thread, NULL);
+	if (c->fd >= 0) {
+		close(c->fd);
+		unlink(c->path);
+	}
+	free(c->path);
+	c->fd   = -1;
+	c->path = NULL;
+}
+
+//What rssm ctl sends
+struct __ctlArgs {
+	char* directory;
+	char** words;
+	int nwords;
+};
+
+static char ctlDoc[] = "rssm ctl - send COMMAND to the rssm daemon of a rss directory and print its answer.\v"
+	"Commands:\n"
+	"  fetch TAG                 fetch TAG now, ahead of every feed waiting\n"
+	"  add TAG URL [PRIORITY]    fetch URL as TAG until rssm exits, PRIORITY like in the feedlist\n"
+	"  remove TAG                stop fetching TAG, add brings it back\n"
+	"  pause TAG, resume TAG     stop fetching TAG until it's resumed, fetch still does\n"
+	"  interval TAG TIME         fetch TAG every TIME seconds, or with an s, m, h or d suffix, 0 for its priority's\n"
+	"  state [TAG]               list every feed, or TAG, as \"<tag> <tier> <state> <interval> <next due> <last fetch> "
+	"<new items> <poll or push> <url>\"";
+
+static struct argp_option ctlOptions[] = {
+	{"directory", 'd', "DIR", 0, "rss directory of the daemon (default is $HOME/rss)"},
+	{ 0 }
+};
+
+static error_t parseCtl(int key, char* arg, struct argp_state *state) {
+	struct __ctlArgs* a = state->input;
+	
+	switch (key) {
+		case 'd':
+			a->directory = arg;
+			break;
+		case ARGP_KEY_ARGS:
+			a->words  = state->argv + state->next;
+			a->nwords = state->argc - state->next;
+			state->next = state->argc;
+			break;
+		case ARGP_KEY_NO_ARGS:
+			argp_usage(state);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp ctlArgp = {ctlOptions, parseCtl, "COMMAND [ARG...]", ctlDoc};
+
+int ctlMain(int argc, char** argv) {
+	struct __ctlArgs a;
+	memset(&a, 0, sizeof(a));
+	
+	//Usage messages name the subcommand
+	argv[0] = "rssm ctl";
+	argp_parse(&ctlArgp, argc, argv, 0, 0, &a);
+	
+	char* dir;
+	if (a.directory != NULL) {
+		dir = strdup(a.directory);
+	} else {
+		char* home = getHomePath(0);
+		dir = malloc(strlen(home) + 4);
+		sprintf(dir, "%srss", home);
+		free(home);
+	}
+	
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s%s", dir, CTL_NAME);
+	
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+		fprintf(stderr, "Error! No rssm daemon is running for %s\n", dir);
+		if (fd >= 0)
+			close(fd);
+		free(dir);
+		return 2;
+	}
+	free(dir);
+	
+	//The command goes as one line of its words
+	char* line = NULL;
+	size_t len = 0;
+	FILE* cmd  = open_memstream(&line, &len);
+	int i;
+	for (i = 0; i < a.nwords; i++)
+		fprintf(cmd, "%s%s", i > 0 ? " " : "", a.words[i]);
+	fputc('\n', cmd);
+	fclose(cmd);
+	
+	int ok = write(fd, line, len) == (ssize_t)len;
+	free(line);
+	
+	FILE* in = ok ? fdopen(fd, "r") : NULL;
+	if (in == NULL) {
+		fprintf(stderr, "Error! Can not send the command to rssm\n");
+		close(fd);
+		return 2;
+	}
+	
+	char* reply = NULL;
+	size_t cap  = 0;
+	if (getline(&reply, &cap, in) <= 0) {
+		fprintf(stderr, "Error! rssm didn't answer\n");
+		free(reply);
+		fclose(in);
+		return 2;
+	}
+	
+	int ret = 0;
+	if (strncmp(reply, "error ", 6) == 0) {
+		fprintf(stderr, "Error! %s", reply + 6);
+		ret = 1;
+	} else {
+		while (getline(&reply, &cap, in) > 0)
+			fputs(reply, stdout);
+	}
+	free(reply);
+	fclose(in);
+	return ret;
+}
@@ -0,0 +1,589 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <sys/stat.h>
+
+#include <curl/curl.h>
+
+#include "enclosure.h"
+#include "hmac.h"
+#include "rssmio.h"
+
+//One download in progress
+struct __transfer {
+	rssm_enclosures* e;
+	CURL* curl;
+	int fd;
+	rssm_sha sha;
+	//bytes in the .part file, and whether the response was checked to be the range asked for
+	size_t size;
+	int checked;
+	//of the last response's headers, a strong ETag or else Last-Modified, and its Content-Range or -1s
+	char validator[256];
+	long long rangeStart, rangeTotal;
+	//where the validator of the .part file is kept
+	const char* validatorPath;
+};
+
+static double monoNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t hostHash(const char* url) {
+	const char* host = strstr(url, "://");
+	host = host != NULL ? host + 3 : url;
+	return keyHash(host, strcspn(host, "/?#"));
+}
+
+//Make room for one more download in the queue, with the lock held
+static int queueRoom(rssm_enclosures* e) {
+	if (e->count < e->cap)
+		return 0;
+	
+	size_t cap = e->cap > 0 ? e->cap * 2 : 64;
+	struct __download* queue = realloc(e->queue, sizeof(struct __download) * cap);
+	if (queue == NULL)
+		return -1;
+	e->queue = queue;
+	e->cap   = cap;
+	return 0;
+}
+
+//Add a download to the queue, with the lock held
+static int queuePush(rssm_enclosures* e, const char* tag, const char* id, const char* url) {
+	if (queueRoom(e) < 0)
+		return -1;
+	
+	struct __download* d = &e->queue[e->count];
+	memset(d, 0, sizeof(struct __download));
+	d->tag = strdup(tag);
+	d->url = strdup(url);
+	if (d->tag == NULL || d->url == NULL) {
+		free(d->tag);
+		free(d->url);
+		return -1;
+	}
+	snprintf(d->id, sizeof(d->id), "%s", id);
+	d->host = hostHash(url);
+	
+	e->count++;
+	return keysetPut(&e->known, keyHash(url, strlen(url)), 1);
+}
+
+//Split a "a\tb\t...\n" line in place into at most n fields, returns how many it had
+static int splitLine(char* line, char** fields, int n) {
+	line[strcspn(line, "\n")] = '\0';
+	
+	int i;
+	for (i = 0; i < n && line != NULL; i++) {
+		fields[i] = line;
+		line = strchr(line, '\t');
+		if (line != NULL && i < n - 1)
+			*line++ = '\0';
+		else
+			line = NULL;
+	}
+	return i;
+}
+
+int enclosureOpen(rssm_enclosures* e, const char* dir, size_t rate, FILE* log, int v) {
+	memset(e, 0, sizeof(rssm_enclosures));
+	pthread_mutex_init(&e->lock, NULL);
+	pthread_cond_init(&e->work, NULL);
+	pthread_cond_init(&e->idle, NULL);
+	e->rate   = rate;
+	e->tokens = rate;
+	e->last   = monoNow();
+	e->log    = log;
+	e->v      = v;
+	
+	e->dir = malloc(strlen(dir) + 13);
+	if (e->dir == NULL)
+		return -1;
+	sprintf(e->dir, "%s/.rssm media", dir);
+	if (mkdir(e->dir, 0755) != 0 && errno != EEXIST)
+		return -1;
+	
+	char path[strlen(e->dir) + 12];
+	char tmp[strlen(e->dir) + 12];
+	char* line = NULL;
+	size_t cap = 0;
+	char* fields[6];
+	
+	//Everything in the index is done, downloaded or given up on
+	sprintf(path, "%s/index", e->dir);
+	FILE* f = fopen(path, "r");
+	if (f != NULL) {
+		while (getline(&line, &cap, f) > 0)
+			if (splitLine(line, fields, 6) == 6)
+				keysetPut(&e->known, keyHash(fields[5], strlen(fields[5])), 1);
+		fclose(f);
+	}
+	e->index = fopen(path, "a");
+	
+	//The queue is rewritten with only what is left of it
+	sprintf(path, "%s/queue", e->dir);
+	f = fopen(path, "r");
+	if (f != NULL) {
+		while (getline(&line, &cap, f) > 0) {
+			if (splitLine(line, fields, 3) != 3 || keysetGet(&e->known, keyHash(fields[2], strlen(fields[2])), NULL))
+				continue;
+			queuePush(e, fields[0], fields[1], fields[2]);
+		}
+		fclose(f);
+	}
+	free(line);
+	
+	sprintf(tmp, "%s/queue.tmp", e->dir);
+	f = fopen(tmp, "w");
+	if (f != NULL) {
+		size_t i;
+		for (i = 0; i < e->count; i++)
+			fprintf(f, "%s\t%s\t%s\n", e->queue[i].tag, e->queue[i].id, e->queue[i].url);
+		if (fclose(f) != 0 || rename(tmp, path) != 0)
+			remove(tmp);
+	}
+	e->queueFile = fopen(path, "a");
+	
+	if (e->index == NULL || e->queueFile == NULL)
+		return -1;
+	
+	if (v && e->count > 0) {
+		printtime(log);
+		fprintf(log, "%zu enclosures are still to be downloaded.\n", e->count);
+	}
+	
+	return 0;
+}
+
+void enclosureQueue(rssm_enclosures* e, const char* tag, const char* id, const char* url) {
+	//The url goes in tab separated files, so one with whitespace in it is left alone
+	while (*url == ' ')
+		url++;
+	size_t len = strlen(url);
+	while (len > 0 && url[len-1] == ' ')
+		len--;
+	if (len == 0 || len > 4096)
+		return;
+	char clean[len + 1];
+	memcpy(clean, url, len);
+	clean[len] = '\0';
+	if (strpbrk(clean, " \t\r\n") != NULL)
+		return;
+	
+	pthread_mutex_lock(&e->lock);
+	if (!keysetGet(&e->known, keyHash(clean, len), NULL) && queuePush(e, tag, id, clean) == 0) {
+		fprintf(e->queueFile, "%s\t%s\t%s\n", tag, id, clean);
+		fflush(e->queueFile);
+		pthread_cond_signal(&e->work);
+	}
+	pthread_mutex_unlock(&e->lock);
+}
+
+//Wait until n more bytes fit under the bandwidth cap
+static void shape(rssm_enclosures* e, size_t n) {
+	if (e->rate == 0)
+		return;
+	
+	pthread_mutex_lock(&e->lock);
+	double now = monoNow();
+	e->tokens += (now - e->last) * e->rate;
+	//At most a second's worth builds up while nothing is downloading
+	if (e->tokens > e->rate)
+		e->tokens = e->rate;
+	e->last = now;
+	e->tokens -= n;
+	double wait = e->tokens < 0 ? -e->tokens / e->rate : 0;
+	pthread_mutex_unlock(&e->lock);
+	
+	if (wait > 0) {
+		struct timespec ts = {(time_t)wait, (long)((wait - (time_t)wait) * 1e9)};
+		nanosleep(&ts, NULL);
+	}
+}
+
+//Start the .part file over
+static int transferRestart(struct __transfer* t) {
+	if (ftruncate(t->fd, 0) != 0 || lseek(t->fd, 0, SEEK_SET) != 0)
+		return -1;
+	shaInit(&t->sha, 1);
+	t->size = 0;
+	return 0;
+}
+
+//Keep what the .part file is a part of, so the next try only resumes it if it didn't change
+static void transferValidator(struct __transfer* t) {
+	if (t->validator[0] == '\0') {
+		remove(t->validatorPath);
+		return;
+	}
+	FILE* f = fopen(t->validatorPath, "w");
+	if (f == NULL)
+		return;
+	fprintf(f, "%s\n", t->validator);
+	fclose(f);
+}
+
+static size_t transferHeader(char* ptr, size_t size, size_t nmemb, void* data) {
+	struct __transfer* t = data;
+	size_t n = size * nmemb;
+	
+	//Redirects and 100s come with their own headers, only the last response's count
+	if (n >= 5 && strncmp(ptr, "HTTP/", 5) == 0) {
+		t->validator[0] = '\0';
+		t->rangeStart   = -1;
+		t->rangeTotal   = -1;
+		return n;
+	}
+	
+	char line[n + 1];
+	memcpy(line, ptr, n);
+	line[n] = '\0';
+	line[strcspn(line, "\r\n")] = '\0';
+	char* value = strchr(line, ':');
+	if (value == NULL)
+		return n;
+	*value++ = '\0';
+	value += strspn(value, " \t");
+	
+	//A weak ETag can't be used in If-Range, and Last-Modified only when there's no ETag
+	if (strcasecmp(line, "ETag") == 0 && strncmp(value, "W/", 2) != 0 && strlen(value) < sizeof(t->validator))
+		strcpy(t->validator, value);
+	else if (strcasecmp(line, "Last-Modified") == 0 && t->validator[0] != '"' && strlen(value) < sizeof(t->validator))
+		strcpy(t->validator, value);
+	else if (strcasecmp(line, "Content-Range") == 0 && strncasecmp(value, "bytes ", 6) == 0) {
+		//"bytes <first>-<last>/<total or *>", a 416 has "bytes */<total>"
+		char* slash = strchr(value, '/');
+		if (value[6] != '*')
+			t->rangeStart = strtoll(value + 6, NULL, 10);
+		if (slash != NULL && slash[1] != '*')
+			t->rangeTotal = strtoll(slash + 1, NULL, 10);
+	}
+	return n;
+}
+
+static size_t transferWrite(void* ptr, size_t size, size_t nmemb, void* data) {
+	struct __transfer* t = data;
+	size_t n = size * nmemb;
+	
+	//A 200 is the whole enclosure, either the range was ignored or it changed since the .part was started
+	if (!t->checked) {
+		t->checked = 1;
+		long code = 0;
+		curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &code);
+		if (code == 206 && t->rangeStart != (long long)t->size) {
+			transferRestart(t);
+			return 0;
+		}
+		if (code != 206 && t->size > 0 && transferRestart(t) < 0)
+			return 0;
+		transferValidator(t);
+	}
+	
+	shape(t->e, n);
+	if (t->e->stop || write(t->fd, ptr, n) != (ssize_t)n)
+		return 0;
+	shaUpdate(&t->sha, ptr, n);
+	t->size += n;
+	
+	return n;
+}
+
+//Lets a stalled download notice rssm stopping
+static int transferProgress(void* data, curl_off_t dltotal, curl_off_t dlnow, curl_off_t ultotal, curl_off_t ulnow) {
+	struct __transfer* t = data;
+	return t->e->stop;
+}
+
+//Where url is downloaded to until it's done
+static void partPath(const rssm_enclosures* e, const char* url, char* out) {
+	sprintf(out, "%s/%016" PRIx64 ".part", e->dir, keyHash(url, strlen(url)));
+}
+
+//Where the validator of url's .part file is kept
+static void validatorPath(const rssm_enclosures* e, const char* url, char* out) {
+	sprintf(out, "%s/%016" PRIx64 ".validator", e->dir, keyHash(url, strlen(url)));
+}
+
+//Download d into its .part file, resuming what an earlier try got, and move it to its content hash
+//returns 0 on success with hex and size set
+static int download(rssm_enclosures* e, const struct __download* d, char* hex, size_t* size) {
+	char part[strlen(e->dir) + 24];
+	char valid[strlen(e->dir) + 29];
+	partPath(e, d->url, part);
+	validatorPath(e, d->url, valid);
+	
+	struct __transfer t;
+	memset(&t, 0, sizeof(t));
+	t.e  = e;
+	t.validatorPath = valid;
+	t.rangeStart    = -1;
+	t.rangeTotal    = -1;
+	t.fd = open(part, O_RDWR | O_CREAT, 0644);
+	if (t.fd < 0)
+		return -1;
+	shaInit(&t.sha, 1);
+	
+	//An earlier try's part can only be resumed if the server can tell us it's still the same enclosure
+	char saved[sizeof(t.validator)] = "";
+	FILE* f = fopen(valid, "r");
+	if (f != NULL) {
+		if (fgets(saved, sizeof(saved), f) == NULL)
+			saved[0] = '\0';
+		saved[strcspn(saved, "\r\n")] = '\0';
+		fclose(f);
+	}
+	
+	//What an earlier try got is hashed before the rest is asked for
+	char buf[65536];
+	ssize_t got = 0;
+	if (saved[0] == '\0') {
+		if (ftruncate(t.fd, 0) != 0)
+			got = -1;
+	} else {
+		while ((got = read(t.fd, buf, sizeof(buf))) > 0) {
+			shaUpdate(&t.sha, buf, got);
+			t.size += got;
+		}
+	}
+	
+	t.curl = curl_easy_init();
+	if (t.curl == NULL || got < 0) {
+		curl_easy_cleanup(t.curl);
+		close(t.fd);
+		return -1;
+	}
+	curl_easy_setopt(t.curl, CURLOPT_URL, d->url);
+	curl_easy_setopt(t.curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(t.curl, CURLOPT_FOLLOWLOCATION, 1L);
+	curl_easy_setopt(t.curl, CURLOPT_FAILONERROR, 1L);
+	curl_easy_setopt(t.curl, CURLOPT_CONNECTTIMEOUT, 30L);
+	curl_easy_setopt(t.curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+	curl_easy_setopt(t.curl, CURLOPT_LOW_SPEED_TIME, 60L);
+	curl_easy_setopt(t.curl, CURLOPT_WRITEFUNCTION, transferWrite);
+	curl_easy_setopt(t.curl, CURLOPT_WRITEDATA, (void *)&t);
+	curl_easy_setopt(t.curl, CURLOPT_HEADERFUNCTION, transferHeader);
+	curl_easy_setopt(t.curl, CURLOPT_HEADERDATA, (void *)&t);
+	curl_easy_setopt(t.curl, CURLOPT_XFERINFOFUNCTION, transferProgress);
+	curl_easy_setopt(t.curl, CURLOPT_XFERINFODATA, (void *)&t);
+	curl_easy_setopt(t.curl, CURLOPT_NOPROGRESS, 0L);
+	//CURLOPT_RESUME_FROM would fail on a 200 instead of letting the enclosure start over
+	char range[32];
+	char ifRange[sizeof(saved) + 16];
+	struct curl_slist* headers = NULL;
+	if (t.size > 0) {
+		sprintf(range, "%zu-", t.size);
+		sprintf(ifRange, "If-Range: %s", saved);
+		headers = curl_slist_append(headers, ifRange);
+		curl_easy_setopt(t.curl, CURLOPT_RANGE, range);
+		curl_easy_setopt(t.curl, CURLOPT_HTTPHEADER, headers);
+	}
+	
+	CURLcode res = curl_easy_perform(t.curl);
+	long code = 0;
+	curl_easy_getinfo(t.curl, CURLINFO_RESPONSE_CODE, &code);
+	curl_easy_cleanup(t.curl);
+	curl_slist_free_all(headers);
+	
+	//An empty 200 to a resume still means the enclosure is now empty
+	if (res == CURLE_OK && !t.checked && code != 206 && t.size > 0)
+		res = transferRestart(&t) == 0 ? CURLE_OK : CURLE_WRITE_ERROR;
+	//Asking for a range past the end means an earlier try already got all of it, if it's as long as the server says
+	int whole = code == 416 && t.size > 0 && t.rangeTotal == (long long)t.size;
+	if (code == 416 && !whole)
+		transferRestart(&t);
+	close(t.fd);
+	
+	if (res != CURLE_OK && !whole) {
+		if (!e->stop) {
+			printtime(e->log);
+			fprintf(e->log, "Error downloading enclosure %s of %s : %s\n", d->url, d->tag, curl_easy_strerror(res));
+		}
+		return -1;
+	}
+	remove(valid);
+	
+	uint8_t sum[SHA256_LEN];
+	shaFinal(&t.sha, sum);
+	int i;
+	for (i = 0; i < SHA256_LEN; i++)
+		sprintf(hex + i * 2, "%02x", sum[i]);
+	*size = t.size;
+	
+	//The same content under another url is only kept once
+	char path[strlen(e->dir) + SHA256_LEN * 2 + 2];
+	sprintf(path, "%s/%s", e->dir, hex);
+	if (access(path, F_OK) == 0) {
+		remove(part);
+		pthread_mutex_lock(&e->lock);
+		e->deduped++;
+		pthread_mutex_unlock(&e->lock);
+		return 0;
+	}
+	return rename(part, path);
+}
+
+//Take the first download that is due and whose host isn't busy, with the lock held
+static int take(rssm_enclosures* e, struct __download* out) {
+	time_t now = time(NULL);
+	
+	size_t i;
+	for (i = 0; i < e->count; i++) {
+		uint64_t busy = 0;
+		keysetGet(&e->hosts, e->queue[i].host, &busy);
+		if (e->queue[i].after > now || busy >= ENCLOSURE_PER_HOST)
+			continue;
+		
+		*out = e->queue[i];
+		memmove(&e->queue[i], &e->queue[i+1], sizeof(struct __download) * (e->count - i - 1));
+		e->count--;
+		keysetPut(&e->hosts, out->host, busy + 1);
+		return 0;
+	}
+	return -1;
+}
+
+static void* downloadThread(void* arg) {
+	rssm_enclosures* e = arg;
+	
+	pthread_mutex_lock(&e->lock);
+	while (!e->stop) {
+		struct __download d;
+		if (take(e, &d) < 0) {
+			//Downloads waiting to be retried come due without a signal
+			pthread_cond_broadcast(&e->idle);
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec++;
+			pthread_cond_timedwait(&e->work, &e->lock, &ts);
+			continue;
+		}
+		e->active++;
+		pthread_mutex_unlock(&e->lock);
+		
+		char hex[SHA256_LEN * 2 + 1];
+		size_t size = 0;
+		int ret = download(e, &d, hex, &size);
+		
+		pthread_mutex_lock(&e->lock);
+		uint64_t busy = 1;
+		keysetGet(&e->hosts, d.host, &busy);
+		keysetPut(&e->hosts, d.host, busy - 1);
+		e->active--;
+		
+		if (ret == 0 || (!e->stop && ++d.tries >= ENCLOSURE_TRIES)) {
+			if (ret == 0) {
+				e->done++;
+				e->bytes += size;
+			} else {
+				char part[strlen(e->dir) + 29];
+				partPath(e, d.url, part);
+				remove(part);
+				validatorPath(e, d.url, part);
+				remove(part);
+				e->failed++;
+				printtime(e->log);
+				fprintf(e->log, "Gave up on enclosure %s of %s after %d tries.\n", d.url, d.tag, d.tries);
+			}
+			fprintf(e->index, "%ld\t%s\t%s\t%s\t%zu\t%s\n", (long)time(NULL), d.tag, d.id, ret == 0 ? hex : "-", size, d.url);
+			fflush(e->index);
+			if (e->v && ret == 0) {
+				printtime(e->log);
+				fprintf(e->log, "Downloaded enclosure %s of %s (%zu bytes).\n", d.url, d.tag, size);
+			}
+			free(d.tag);
+			free(d.url);
+		} else if (e->stop) {
+			//Still in the queue file, it's resumed next time
+			free(d.tag);
+			free(d.url);
+		} else {
+			d.after = time(NULL) + ((time_t)ENCLOSURE_RETRY << (d.tries - 1));
+			if (queueRoom(e) == 0) {
+				e->queue[e->count++] = d;
+			} else {
+				free(d.tag);
+				free(d.url);
+			}
+		}
+		pthread_cond_broadcast(&e->idle);
+	}
+	pthread_mutex_unlock(&e->lock);
+	
+	return NULL;
+}
+
+int enclosureStart(rssm_enclosures* e) {
+	int i;
+	for (i = 0; i < ENCLOSURE_JOBS; i++)
+		if (pthread_create(&e->workers[i], NULL, downloadThread, e) != 0)
+			break;
+	e->started = i;
+	return i > 0 ? 0 : -1;
+}
+
+void enclosureReport(rssm_enclosures* e, FILE* log) {
+	pthread_mutex_lock(&e->lock);
+	printtime(log);
+	fprintf(log, "Enclosures: %zu downloaded (%.1fMB), %zu already on disk, %zu given up on, %zu queued.\n",
+	        e->done, e->bytes / (1024.0 * 1024.0), e->deduped, e->failed, e->count);
+	e->done = e->bytes = e->deduped = e->failed = 0;
+	pthread_mutex_unlock(&e->lock);
+}
+
+//returns 1 if a queued download is due, with the lock held
+static int runnable(rssm_enclosures* e) {
+	time_t now = time(NULL);
+	size_t i;
+	for (i = 0; i < e->count; i++)
+		if (e->queue[i].after <= now)
+			return 1;
+	return 0;
+}
+
+void enclosureDrain(rssm_enclosures* e) {
+	pthread_mutex_lock(&e->lock);
+	while (e->started > 0 && (e->active > 0 || runnable(e))) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		pthread_cond_timedwait(&e->idle, &e->lock, &ts);
+	}
+	pthread_mutex_unlock(&e->lock);
+}
+
+void enclosureClose(rssm_enclosures* e) {
+	pthread_mutex_lock(&e->lock);
+	e->stop = 1;
+	pthread_cond_broadcast(&e->work);
+	pthread_mutex_unlock(&e->lock);
+	
+	int i;
+	for (i = 0; i < e->started; i++)
+		pthread_join(e->workers[i], NULL);
+	
+	size_t j;
+	for (j = 0; j < e->count; j++) {
+		free(e->queue[j].tag);
+		free(e->queue[j].url);
+	}
+	free(e->queue);
+	keysetFree(&e->known);
+	keysetFree(&e->hosts);
+	if (e->index != NULL)
+		fclose(e->index);
+	if (e->queueFile != NULL)
+		fclose(e->queueFile);
+	free(e->dir);
+	pthread_mutex_destroy(&e->lock);
+	pthread_cond_destroy(&e->work);
+	pthread_cond_destroy(&e->idle);
+	memset(e, 0, sizeof(rssm_enclosures));
+}
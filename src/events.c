@@ -0,0 +1,61 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#include "events.h"
+
+int eventsOpen(rssm_events* e, const char* dir) {
+	e->path = malloc(strlen(dir) + 15);
+	sprintf(e->path, "%s/.rssm events", dir);
+	
+	e->fd = open(e->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	return e->fd < 0 ? -1 : 0;
+}
+
+//Every event is a single write on an O_APPEND fd, so readers never see half a line
+static int writeEvent(rssm_events* e, const char* kind, const char* tag, long offset, long length, const char* id) {
+	char line[strlen(tag) + 128];
+	int len = snprintf(line, sizeof(line), "%ld\t%s\t%s\t%ld\t%ld\t%s\n", (long)time(NULL), kind, tag, offset, length, id);
+	
+	return write(e->fd, line, len) == len ? 0 : -1;
+}
+
+int eventItem(rssm_events* e, const char* tag, long offset, long length, const char* id) {
+	return writeEvent(e, "item", tag, offset, length, id);
+}
+
+int eventCompact(rssm_events* e, const char* tag, long size) {
+	return writeEvent(e, "compact", tag, 0, size, "-");
+}
+
+int eventsRotate(rssm_events* e) {
+	struct stat st;
+	if (fstat(e->fd, &st) != 0 || st.st_size < EVENTS_MAX)
+		return 0;
+	
+	char old[strlen(e->path) + 5];
+	sprintf(old, "%s.old", e->path);
+	if (rename(e->path, old) != 0)
+		return -1;
+	
+	//Compaction writes events without the flush lock, dup2 swaps the file under e->fd so it never points at a closed or reused fd
+	int fd = open(e->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0)
+		return -1;
+	
+	int ret = dup2(fd, e->fd) < 0 ? -1 : 0;
+	close(fd);
+	return ret;
+}
+
+void eventsClose(rssm_events* e) {
+	if (e->fd >= 0)
+		close(e->fd);
+	free(e->path);
+	e->fd   = -1;
+	e->path = NULL;
+}
@@ -0,0 +1,176 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "format.h"
+
+//How a format renders an item and what its stream is called
+struct __format {
+	const char* name;
+	//appended to the item file path, NULL for formats without a stream
+	const char* suffix;
+	//written when the stream is created
+	const char* magic;
+	void (*render)(FILE* out, const rssm_field* fields, size_t n);
+};
+
+//A JSON string, escaping what JSON doesn't allow raw
+static void jsonString(FILE* out, const char* s, size_t len) {
+	fputc('"', out);
+	
+	size_t i;
+	for (i = 0; i < len; i++) {
+		unsigned char c = s[i];
+		switch (c) {
+			case '"':  fputs("\\\"", out); break;
+			case '\\': fputs("\\\\", out); break;
+			case '\n': fputs("\\n", out); break;
+			case '\r': fputs("\\r", out); break;
+			case '\t': fputs("\\t", out); break;
+			default:
+				if (c < 0x20)
+					fprintf(out, "\\u%04x", c);
+				else
+					fputc(c, out);
+		}
+	}
+	
+	fputc('"', out);
+}
+
+//One object per line, fields in the order the item has them
+static void jsonRender(FILE* out, const rssm_field* fields, size_t n) {
+	fputc('{', out);
+	
+	size_t i;
+	for (i = 0; i < n; i++) {
+		if (i > 0)
+			fputc(',', out);
+		jsonString(out, fields[i].name, strlen(fields[i].name));
+		fputc(':', out);
+		jsonString(out, fields[i].value, fields[i].len);
+	}
+	
+	fputs("}\n", out);
+}
+
+static void putLe(FILE* out, uint64_t val, int bytes) {
+	int i;
+	for (i = 0; i < bytes; i++)
+		fputc((val >> (i * 8)) & 0xff, out);
+}
+
+//Length, field table, then the names and values, see FORMAT_MAGIC
+static void binaryRender(FILE* out, const rssm_field* fields, size_t n) {
+	if (n > UINT16_MAX)
+		n = UINT16_MAX;
+	
+	size_t i, len = 2;
+	for (i = 0; i < n; i++)
+		len += 6 + strlen(fields[i].name) + fields[i].len;
+	
+	putLe(out, len, 4);
+	putLe(out, n, 2);
+	for (i = 0; i < n; i++) {
+		putLe(out, strlen(fields[i].name), 2);
+		putLe(out, fields[i].len, 4);
+	}
+	for (i = 0; i < n; i++) {
+		fwrite(fields[i].name, 1, strlen(fields[i].name), out);
+		fwrite(fields[i].value, 1, fields[i].len, out);
+	}
+}
+
+static const struct __format formats[] = {
+	[FORMAT_TEXT]   = {"text",   NULL,     NULL,         NULL},
+	[FORMAT_JSON]   = {"json",   " jsonl", NULL,         jsonRender},
+	[FORMAT_BINARY] = {"binary", " rec",   FORMAT_MAGIC, binaryRender},
+};
+
+int formatParse(const char* name) {
+	size_t i;
+	for (i = 0; i < sizeof(formats) / sizeof(formats[0]); i++)
+		if (strcmp(formats[i].name, name) == 0)
+			return i;
+	return -1;
+}
+
+//Open s->path for appending, starting a new stream with its format's magic
+static int streamReopen(rssm_stream* s) {
+	const struct __format* f = &formats[s->format];
+	
+	s->fd = open(s->path, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	struct stat st;
+	if (s->fd < 0 || fstat(s->fd, &st) != 0)
+		return -1;
+	s->size = st.st_size;
+	
+	if (s->size == 0 && f->magic != NULL) {
+		if (write(s->fd, f->magic, strlen(f->magic)) != (ssize_t)strlen(f->magic))
+			return -1;
+		s->size = strlen(f->magic);
+	}
+	
+	return 0;
+}
+
+int streamOpen(rssm_stream* s, const char* path) {
+	s->fd   = -1;
+	s->path = NULL;
+	if (s->format <= FORMAT_TEXT)
+		return 0;
+	
+	const struct __format* f = &formats[s->format];
+	s->path = malloc(strlen(path) + strlen(f->suffix) + 1);
+	if (s->path == NULL)
+		return -1;
+	sprintf(s->path, "%s%s", path, f->suffix);
+	
+	return streamReopen(s);
+}
+
+//Move a stream past FORMAT_MAX to <stream>.old and start a new one
+static int streamRotate(rssm_stream* s) {
+	char old[strlen(s->path) + 5];
+	sprintf(old, "%s.old", s->path);
+	if (rename(s->path, old) != 0)
+		return -1;
+	
+	close(s->fd);
+	return streamReopen(s);
+}
+
+int streamWrite(rssm_stream* s, const rssm_field* fields, size_t n) {
+	if (s->fd < 0)
+		return s->format <= FORMAT_TEXT ? 0 : -1;
+	
+	char* rec  = NULL;
+	size_t len = 0;
+	FILE* buf  = open_memstream(&rec, &len);
+	if (buf == NULL)
+		return -1;
+	formats[s->format].render(buf, fields, n);
+	fclose(buf);
+	
+	ssize_t wrote = write(s->fd, rec, len);
+	free(rec);
+	if (wrote != (ssize_t)len)
+		return -1;
+	
+	s->size += len;
+	if (s->size > FORMAT_MAX)
+		return streamRotate(s);
+	return 0;
+}
+
+void streamClose(rssm_stream* s) {
+	if (s->fd >= 0)
+		close(s->fd);
+	free(s->path);
+	s->fd   = -1;
+	s->path = NULL;
+}
@@ -0,0 +1,185 @@
+#include <string.h>
+
+#include "hmac.h"
+
+#define BLOCK SHA_BLOCK
+
+static uint32_t rol(uint32_t x, int n) {
+	return (x << n) | (x >> (32 - n));
+}
+
+static uint32_t ror(uint32_t x, int n) {
+	return (x >> n) | (x << (32 - n));
+}
+
+static uint32_t be32(const uint8_t* p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static void sha1Compress(uint32_t* h, const uint8_t* block) {
+	uint32_t w[80];
+	int i;
+	for (i = 0; i < 16; i++)
+		w[i] = be32(block + i * 4);
+	for (; i < 80; i++)
+		w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+	
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+	for (i = 0; i < 80; i++) {
+		uint32_t f, k;
+		if (i < 20) {
+			f = (b & c) | (~b & d);
+			k = 0x5a827999;
+		} else if (i < 40) {
+			f = b ^ c ^ d;
+			k = 0x6ed9eba1;
+		} else if (i < 60) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8f1bbcdc;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xca62c1d6;
+		}
+		uint32_t t = rol(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = rol(b, 30);
+		b = a;
+		a = t;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+}
+
+static const uint32_t sha256K[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static void sha256Compress(uint32_t* h, const uint8_t* block) {
+	uint32_t w[64];
+	int i;
+	for (i = 0; i < 16; i++)
+		w[i] = be32(block + i * 4);
+	for (; i < 64; i++) {
+		uint32_t s0 = ror(w[i-15], 7) ^ ror(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = ror(w[i-2], 17) ^ ror(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+	
+	uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], k = h[7];
+	for (i = 0; i < 64; i++) {
+		uint32_t t1 = k + (ror(e, 6) ^ ror(e, 11) ^ ror(e, 25)) + ((e & f) ^ (~e & g)) + sha256K[i] + w[i];
+		uint32_t t2 = (ror(a, 2) ^ ror(a, 13) ^ ror(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		k = g;
+		g = f;
+		f = e;
+		e = d + t1;
+		d = c;
+		c = b;
+		b = a;
+		a = t1 + t2;
+	}
+	h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e; h[5] += f; h[6] += g; h[7] += k;
+}
+
+void shaInit(rssm_sha* s, int sha256) {
+	static const uint32_t init1[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+	static const uint32_t init256[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+	
+	memset(s, 0, sizeof(rssm_sha));
+	if (sha256) {
+		memcpy(s->h, init256, sizeof(init256));
+		s->compress = sha256Compress;
+		s->words = 8;
+	} else {
+		memcpy(s->h, init1, sizeof(init1));
+		s->compress = sha1Compress;
+		s->words = 5;
+	}
+}
+
+void shaUpdate(rssm_sha* s, const void* data, size_t len) {
+	const uint8_t* in = data;
+	s->total += len;
+	while (len > 0) {
+		size_t n = BLOCK - s->fill < len ? BLOCK - s->fill : len;
+		memcpy(s->buf + s->fill, in, n);
+		s->fill += n;
+		in += n;
+		len -= n;
+		if (s->fill == BLOCK) {
+			s->compress(s->h, s->buf);
+			s->fill = 0;
+		}
+	}
+}
+
+void shaFinal(rssm_sha* s, uint8_t* out) {
+	uint64_t bits = s->total * 8;
+	uint8_t pad = 0x80;
+	shaUpdate(s, &pad, 1);
+	pad = 0;
+	while (s->fill != BLOCK - 8)
+		shaUpdate(s, &pad, 1);
+	
+	uint8_t len[8];
+	int i;
+	for (i = 0; i < 8; i++)
+		len[i] = bits >> (56 - i * 8);
+	shaUpdate(s, len, 8);
+	
+	for (i = 0; i < s->words; i++) {
+		out[i*4]   = s->h[i] >> 24;
+		out[i*4+1] = s->h[i] >> 16;
+		out[i*4+2] = s->h[i] >> 8;
+		out[i*4+3] = s->h[i];
+	}
+}
+
+static void hmac(int sha256, const void* key, size_t keyLen, const void* data, size_t len, uint8_t* out) {
+	size_t outLen = sha256 ? SHA256_LEN : SHA1_LEN;
+	uint8_t k[BLOCK] = {0};
+	rssm_sha s;
+	
+	//Keys longer than a block are hashed first
+	if (keyLen > BLOCK) {
+		shaInit(&s, sha256);
+		shaUpdate(&s, key, keyLen);
+		shaFinal(&s, k);
+	} else {
+		memcpy(k, key, keyLen);
+	}
+	
+	uint8_t pad[BLOCK];
+	int i;
+	for (i = 0; i < BLOCK; i++)
+		pad[i] = k[i] ^ 0x36;
+	shaInit(&s, sha256);
+	shaUpdate(&s, pad, BLOCK);
+	shaUpdate(&s, data, len);
+	uint8_t inner[SHA256_LEN];
+	shaFinal(&s, inner);
+	
+	for (i = 0; i < BLOCK; i++)
+		pad[i] = k[i] ^ 0x5c;
+	shaInit(&s, sha256);
+	shaUpdate(&s, pad, BLOCK);
+	shaUpdate(&s, inner, outLen);
+	shaFinal(&s, out);
+}
+
+void hmacSha1(const void* key, size_t keyLen, const void* data, size_t len, uint8_t* out) {
+	hmac(0, key, keyLen, data, len, out);
+}
+
+void hmacSha256(const void* key, size_t keyLen, const void* data, size_t len, uint8_t* out) {
+	hmac(1, key, keyLen, data, len, out);
+}
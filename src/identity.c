@@ -0,0 +1,228 @@
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <inttypes.h>
+
+#include "identity.h"
+#include "names.h"
+
+//Query parameters that only track where a click came from
+static const char* trackingParams[] = {
+	"utm_", "fbclid", "gclid", "dclid", "msclkid", "yclid", "igshid", "mc_cid", "mc_eid", "_hsenc", "_hsmi", "ref_src", NULL
+};
+
+size_t cleanValue(const char* str, char* out) {
+	size_t j = 0;
+	
+	for (; *str != '\0'; str++) {
+		char c = *str == '\n' || *str == '\t' || *str == '\r' ? ' ' : *str;
+		if (c == ' ' && (j == 0 || out[j-1] == ' '))
+			continue;
+		out[j++] = c;
+	}
+	if (j > 0 && out[j-1] == ' ')
+		j--;
+	out[j] = '\0';
+	
+	return j;
+}
+
+static int isTracking(const char* param, size_t len) {
+	size_t i;
+	for (i = 0; trackingParams[i] != NULL; i++) {
+		size_t n = strlen(trackingParams[i]);
+		//Prefixes end in _, the rest have to match the whole name
+		if (trackingParams[i][n-1] == '_') {
+			if (len >= n && strncasecmp(param, trackingParams[i], n) == 0)
+				return 1;
+		} else if ((len == n || (len > n && param[n] == '=')) && strncasecmp(param, trackingParams[i], n) == 0) {
+			return 1;
+		}
+	}
+	
+	return 0;
+}
+
+void normalizeLink(const char* link, char* out) {
+	cleanValue(link, out);
+	
+	//Drop the fragment
+	char* hash = strchr(out, '#');
+	if (hash != NULL)
+		*hash = '\0';
+	
+	//Lowercase everything up to the end of the host
+	char* host = strstr(out, "://");
+	char* p = out;
+	if (host != NULL) {
+		for (; p < host; p++)
+			*p = tolower((unsigned char)*p);
+		for (p = host + 3; *p != '\0' && *p != '/' && *p != '?'; p++)
+			*p = tolower((unsigned char)*p);
+		
+		//Default ports say nothing, p is just past the host so a port is right before it
+		size_t n = 0;
+		if (p - (host + 3) > 3 && strncmp(p - 3, ":80", 3) == 0 && strncmp(out, "http:", 5) == 0)
+			n = 3;
+		else if (p - (host + 3) > 4 && strncmp(p - 4, ":443", 4) == 0 && strncmp(out, "https:", 6) == 0)
+			n = 4;
+		if (n > 0) {
+			memmove(p - n, p, strlen(p) + 1);
+			p -= n;
+		}
+	}
+	
+	//Rebuild the query without tracking parameters
+	char* query = strchr(p, '?');
+	if (query == NULL)
+		return;
+	
+	char* src = query + 1;
+	char* dst = query + 1;
+	while (*src != '\0') {
+		size_t n = strcspn(src, "&");
+		if (n > 0 && !isTracking(src, n)) {
+			if (dst != query + 1)
+				*dst++ = '&';
+			memmove(dst, src, n);
+			dst += n;
+		}
+		src += n;
+		if (*src == '&')
+			src++;
+	}
+	
+	//Nothing left in the query, drop the ?
+	if (dst == query + 1)
+		dst = query;
+	*dst = '\0';
+}
+
+//cleanValue after dropping new lines the way the item file does, so an identity recomputed from a stored
+//item written before identity lines matches the one of the item as fetched
+static size_t identityValue(const char* str, char* out) {
+	size_t j = 0;
+	for (; *str != '\0'; str++)
+		if (*str != '\n')
+			out[j++] = *str;
+	out[j] = '\0';
+	
+	return cleanValue(out, out);
+}
+
+//Final avalanche so every input bit reaches every output bit
+static uint64_t mix(uint64_t h) {
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	h *= 0xc4ceb9fe1a85ec53ULL;
+	h ^= h >> 33;
+	return h;
+}
+
+//Two independently seeded FNV-1a lanes over kind and str
+static void hashInto(rssm_itemid* id, char kind, const char* str) {
+	const unsigned char* p = (const unsigned char *)str;
+	
+	id->lo ^= (unsigned char)kind;
+	id->lo *= 0x100000001b3ULL;
+	id->hi ^= (unsigned char)kind;
+	id->hi *= 0x100000001b3ULL;
+	for (; *p != '\0'; p++) {
+		id->lo = (id->lo ^ *p) * 0x100000001b3ULL;
+		id->hi = (id->hi ^ *p) * 0x100000001b3ULL;
+	}
+}
+
+rssm_itemid makeIdentity(const char* guid, const char* link, const char* title, const char* text) {
+	rssm_itemid id = {0x84222325cbf29ce4ULL, 0xcbf29ce484222325ULL};
+	
+	if (guid != NULL && *guid != '\0') {
+		char clean[strlen(guid) + 1];
+		identityValue(guid, clean);
+		hashInto(&id, 'g', clean);
+	} else if (link != NULL && *link != '\0') {
+		char clean[strlen(link) + 1];
+		char norm[strlen(link) + 1];
+		identityValue(link, clean);
+		normalizeLink(clean, norm);
+		hashInto(&id, 'l', norm);
+	} else {
+		//Nothing identifies the item, so the content does
+		const char* t = title != NULL ? title : "";
+		const char* d = text  != NULL ? text  : "";
+		char clean[strlen(t) + strlen(d) + 2];
+		size_t n = identityValue(t, clean);
+		clean[n] = '\n';
+		identityValue(d, clean + n + 1);
+		hashInto(&id, 'c', clean);
+	}
+	
+	id.hi = mix(id.hi);
+	id.lo = mix(id.lo ^ id.hi);
+	
+	return id;
+}
+
+//The text under the first child element named name, NULL if there isn't one
+//name is one of the interned names, the item must come from namesParse
+//Returned with xmlMalloc, so it belongs to whatever libxml2 is allocating from
+static char* childText(const xmlNode* item, const xmlChar* name) {
+	const xmlNode* n;
+	for (n = item->children; n != NULL; n = n->next)
+		if (n->type == XML_ELEMENT_NODE && n->name == name)
+			return (char *)xmlNodeGetContent(n);
+	return NULL;
+}
+
+rssm_itemid itemIdentity(const xmlNode* item, const char* link) {
+	//<guid> for rss, <id> for atom
+	char* guid = childText(item, names[NAME_GUID]);
+	if (guid == NULL)
+		guid = childText(item, names[NAME_ID]);
+	
+	char* title = NULL;
+	char* text  = NULL;
+	if ((guid == NULL || *guid == '\0') && (link == NULL || *link == '\0')) {
+		title = childText(item, names[NAME_TITLE]);
+		text  = childText(item, names[NAME_DESCRIPTION]);
+		if (text == NULL)
+			text = childText(item, names[NAME_SUMMARY]);
+		if (text == NULL)
+			text = childText(item, names[NAME_CONTENT]);
+	}
+	
+	rssm_itemid id = makeIdentity(guid, link, title, text);
+	
+	xmlFree(guid);
+	xmlFree(title);
+	xmlFree(text);
+	
+	return id;
+}
+
+void identityFormat(rssm_itemid id, char* out) {
+	sprintf(out, "%016" PRIx64 "%016" PRIx64, id.hi, id.lo);
+}
+
+int identityParse(const char* hex, rssm_itemid* id) {
+	size_t i;
+	for (i = 0; i < IDENTITY_HEX; i++)
+		if (!isxdigit((unsigned char)hex[i]))
+			return -1;
+	
+	if (sscanf(hex, "%16" SCNx64 "%16" SCNx64, &id->hi, &id->lo) != 2)
+		return -1;
+	
+	return 0;
+}
+
+int identityHas(const rssm_keyset* s, rssm_itemid id) {
+	uint64_t hi;
+	return keysetGet(s, id.lo, &hi) && hi == id.hi;
+}
+
+int identityAdd(rssm_keyset* s, rssm_itemid id) {
+	return keysetPut(s, id.lo, id.hi);
+}
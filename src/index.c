@@ -0,0 +1,135 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+
+#include "index.h"
+#include "itemfile.h"
+#include "identity.h"
+#include "keyset.h"
+
+//Records built by a scan
+struct __records {
+	rssm_indexrec* recs;
+	size_t count, cap;
+	size_t base;
+};
+
+uint64_t linkKey(const char* link, size_t len) {
+	char* copy = malloc(len + 1);
+	memcpy(copy, link, len);
+	copy[len] = '\0';
+	
+	//Links are stored as they came, trimmed and normalized like cross-feed dedup does
+	cleanValue(copy, copy);
+	char* norm = malloc(strlen(copy) + 1);
+	normalizeLink(copy, norm);
+	uint64_t key = keyHash(norm, strlen(norm));
+	
+	free(norm);
+	free(copy);
+	return key;
+}
+
+static int addRecord(const rssm_itemspan* item, void* data) {
+	struct __records* r = data;
+	if (r->count == r->cap) {
+		size_t cap = r->cap > 0 ? r->cap * 2 : 64;
+		rssm_indexrec* tmp = realloc(r->recs, cap * sizeof(rssm_indexrec));
+		if (tmp == NULL)
+			return 1;
+		r->recs = tmp;
+		r->cap  = cap;
+	}
+	
+	rssm_indexrec* rec = &r->recs[r->count++];
+	rec->fetched = item->fetched;
+	rec->hi      = item->id.hi;
+	rec->lo      = item->id.lo;
+	rec->link    = item->link != NULL ? linkKey(item->link, item->linkLen) : 0;
+	rec->off     = r->base + item->off;
+	rec->len     = item->len;
+	return 0;
+}
+
+//Write records to the index file of path, truncating it first if trunc is set
+static int writeRecords(const char* path, const struct __records* r, int trunc) {
+	char idxPath[strlen(path) + 7];
+	sprintf(idxPath, "%s index", path);
+	
+	int fd = open(idxPath, O_WRONLY | O_CREAT | (trunc ? O_TRUNC : O_APPEND), 0644);
+	if (fd < 0)
+		return -1;
+	
+	size_t bytes = r->count * sizeof(rssm_indexrec);
+	ssize_t wrote = bytes > 0 ? write(fd, r->recs, bytes) : 0;
+	close(fd);
+	
+	return wrote == (ssize_t)bytes ? 0 : -1;
+}
+
+int indexAppend(const char* path, const char* buf, size_t len, size_t base) {
+	struct __records r = {NULL, 0, 0, base};
+	itemScan(buf, len, addRecord, &r);
+	
+	int ret = writeRecords(path, &r, 0);
+	free(r.recs);
+	return ret < 0 ? -1 : (int)r.count;
+}
+
+int indexRebuild(const char* path) {
+	size_t len;
+	char* buf = mapFile(path, &len);
+	if (buf == NULL)
+		return -1;
+	
+	struct __records r = {NULL, 0, 0, 0};
+	itemScan(buf, len, addRecord, &r);
+	unmapFile(buf, len);
+	
+	int ret = writeRecords(path, &r, 1);
+	free(r.recs);
+	return ret;
+}
+
+int indexCheck(const char* path) {
+	struct stat st;
+	if (stat(path, &st) != 0)
+		return -1;
+	
+	size_t count;
+	rssm_indexrec* recs = indexMap(path, &count);
+	int fine = 0;
+	if (recs != NULL) {
+		if (count == 0)
+			fine = st.st_size == 0;
+		else
+			fine = recs[count - 1].off + recs[count - 1].len == (uint64_t)st.st_size;
+		unmapFile((char *)recs, count * sizeof(rssm_indexrec));
+	}
+	
+	if (fine)
+		return 0;
+	return indexRebuild(path) < 0 ? -1 : 1;
+}
+
+rssm_indexrec* indexMap(const char* path, size_t* count) {
+	char idxPath[strlen(path) + 7];
+	sprintf(idxPath, "%s index", path);
+	
+	size_t len;
+	char* buf = mapFile(idxPath, &len);
+	if (buf == NULL)
+		return NULL;
+	
+	//A record cut short by a crash makes the whole index suspect
+	if (len % sizeof(rssm_indexrec) != 0) {
+		unmapFile(buf, len);
+		return NULL;
+	}
+	
+	*count = len / sizeof(rssm_indexrec);
+	return (rssm_indexrec *)buf;
+}
@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "itemfile.h"
+
+//Lines of a stored item that go into its identity, and which field they fill
+static const struct {
+	const char* prefix;
+	int field;
+} identityLines[] = {
+	{"identity: ", 0}, {"guid: ", 1}, {"id: ", 1}, {"link: ", 2}, {"title: ", 3}, {"description: ", 4}, {"summary: ", 4}, {NULL, 0}
+};
+
+//Identity of a stored item from its identity line, or recomputed the way it was for items written before those existed
+static rssm_itemid storedIdentity(const char** fields, const size_t* lens) {
+	rssm_itemid id;
+	if (fields[0] != NULL && lens[0] >= IDENTITY_HEX && identityParse(fields[0], &id) == 0)
+		return id;
+	
+	char* copies[5] = {NULL};
+	int i;
+	for (i = 1; i < 5; i++) {
+		if (fields[i] == NULL)
+			continue;
+		copies[i] = malloc(lens[i] + 1);
+		memcpy(copies[i], fields[i], lens[i]);
+		copies[i][lens[i]] = '\0';
+		cleanValue(copies[i], copies[i]);
+	}
+	
+	id = makeIdentity(copies[1], copies[2], copies[3], copies[4]);
+	for (i = 1; i < 5; i++)
+		free(copies[i]);
+	
+	return id;
+}
+
+size_t itemScan(const char* buf, size_t len, rssm_itemfn fn, void* data) {
+	//identity, guid or atom id, link, title, description
+	const char* fields[5] = {NULL};
+	size_t lens[5] = {0};
+	size_t start = 0, pos = 0, i;
+	time_t fetched = 0;
+	
+	while (pos < len) {
+		const char* line = buf + pos;
+		const char* nl = memchr(line, '\n', len - pos);
+		if (nl == NULL)
+			break;
+		size_t n = nl - line;
+		pos += n + 1;
+		
+		if (n == 5 && memcmp(line, "ITEMS", 5) == 0) {
+			rssm_itemspan item = {start, pos - start, fetched, storedIdentity(fields, lens), fields[2], lens[2]};
+			if (fn != NULL && fn(&item, data) != 0)
+				return pos;
+			
+			start   = pos;
+			fetched = 0;
+			memset(fields, 0, sizeof(fields));
+			continue;
+		}
+		
+		if (n > 9 && memcmp(line, "fetched: ", 9) == 0) {
+			fetched = strtol(line + 9, NULL, 10);
+			continue;
+		}
+		
+		for (i = 0; identityLines[i].prefix != NULL; i++) {
+			size_t plen = strlen(identityLines[i].prefix);
+			int field = identityLines[i].field;
+			if (n < plen || memcmp(line, identityLines[i].prefix, plen) != 0)
+				continue;
+			
+			//Items are stored last element first, the first line seen is the last element
+			if (fields[field] == NULL) {
+				fields[field] = line + plen;
+				lens[field]   = n - plen;
+			}
+			break;
+		}
+	}
+	
+	return start;
+}
+
+char* mapFile(const char* path, size_t* len) {
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return NULL;
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		close(fd);
+		return NULL;
+	}
+	
+	*len = st.st_size;
+	if (*len == 0) {
+		close(fd);
+		return "";
+	}
+	
+	char* buf = mmap(NULL, *len, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	
+	return buf == MAP_FAILED ? NULL : buf;
+}
+
+void unmapFile(char* buf, size_t len) {
+	if (buf != NULL && len > 0)
+		munmap(buf, len);
+}
@@ -0,0 +1,104 @@
+#include <stdlib.h>
+
+#include "keyset.h"
+
+//0 marks an empty slot, so a real key of 0 is stored as 1
+#define KEYSET_KEY(k) ((k) == 0 ? 1 : (k))
+
+uint64_t keyHash(const void* data, size_t len) {
+	const unsigned char* p = data;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= p[i];
+		h *= 0x100000001b3ULL;
+	}
+	
+	return h;
+}
+
+//Spread the key's bits over the table index
+static size_t slotOf(uint64_t key, size_t cap) {
+	key ^= key >> 33;
+	key *= 0xff51afd7ed558ccdULL;
+	key ^= key >> 33;
+	return (size_t)key & (cap - 1);
+}
+
+//Double the table, keeping it at most half full
+static int grow(rssm_keyset* s) {
+	size_t cap = s->cap == 0 ? 64 : s->cap * 2;
+	uint64_t* keys = calloc(cap, sizeof(uint64_t));
+	uint64_t* vals = calloc(cap, sizeof(uint64_t));
+	if (keys == NULL || vals == NULL) {
+		free(keys);
+		free(vals);
+		return -1;
+	}
+	
+	size_t i;
+	for (i = 0; i < s->cap; i++) {
+		if (s->keys[i] == 0)
+			continue;
+		size_t j = slotOf(s->keys[i], cap);
+		while (keys[j] != 0)
+			j = (j + 1) & (cap - 1);
+		keys[j] = s->keys[i];
+		vals[j] = s->vals[i];
+	}
+	
+	free(s->keys);
+	free(s->vals);
+	s->keys = keys;
+	s->vals = vals;
+	s->cap  = cap;
+	
+	return 0;
+}
+
+int keysetPut(rssm_keyset* s, uint64_t key, uint64_t val) {
+	key = KEYSET_KEY(key);
+	
+	if ((s->count + 1) * 2 > s->cap && grow(s) < 0)
+		return -1;
+	
+	size_t i = slotOf(key, s->cap);
+	while (s->keys[i] != 0 && s->keys[i] != key)
+		i = (i + 1) & (s->cap - 1);
+	
+	if (s->keys[i] == 0) {
+		s->keys[i] = key;
+		s->count++;
+	}
+	s->vals[i] = val;
+	
+	return 0;
+}
+
+int keysetGet(const rssm_keyset* s, uint64_t key, uint64_t* val) {
+	if (s->cap == 0)
+		return 0;
+	key = KEYSET_KEY(key);
+	
+	size_t i = slotOf(key, s->cap);
+	while (s->keys[i] != 0) {
+		if (s->keys[i] == key) {
+			if (val != NULL)
+				*val = s->vals[i];
+			return 1;
+		}
+		i = (i + 1) & (s->cap - 1);
+	}
+	
+	return 0;
+}
+
+void keysetFree(rssm_keyset* s) {
+	free(s->keys);
+	free(s->vals);
+	s->keys  = NULL;
+	s->vals  = NULL;
+	s->cap   = 0;
+	s->count = 0;
+}
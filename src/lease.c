@@ -0,0 +1,343 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "lease.h"
+#include "keyset.h"
+#include "rssmio.h"
+
+//Read the "<node> <unix time>" of path, a lease or a heartbeat, node is LEASE_NODE long
+//returns -1 if there is no such file, one that can't be read counts as run out
+static int readLease(const char* path, char* node, time_t* until) {
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return -1;
+	
+	long long t;
+	if (fscanf(f, "%127s %lld", node, &t) == 2) {
+		*until = t;
+	} else {
+		node[0] = '\0';
+		*until  = 0;
+	}
+	fclose(f);
+	return 0;
+}
+
+//Write this node's "<node> <until>" line to path, whole or not at all
+static int writeLease(const rssm_leases* l, const char* path, time_t until) {
+	FILE* f = fopen(path, "w");
+	if (f == NULL)
+		return -1;
+	fprintf(f, "%s %lld\n", l->node, (long long)until);
+	if (fclose(f) != 0) {
+		unlink(path);
+		return -1;
+	}
+	return 0;
+}
+
+static void shardPath(const rssm_leases* l, int shard, char* path) {
+	sprintf(path, "%s/shards/%02d", l->dir, shard);
+}
+
+//Take shard if nobody holds it or its lease ran out, returns 0 if this node holds it now
+static int acquire(rssm_leases* l, int shard, time_t now) {
+	char path[strlen(l->dir) + 12];
+	char tmp[strlen(l->dir) + LEASE_NODE + 24];
+	shardPath(l, shard, path);
+	
+	char owner[LEASE_NODE];
+	time_t until;
+	if (readLease(path, owner, &until) == 0) {
+		if (until > now)
+			return -1;
+		
+		//Only one node gets to move a run out lease out of the way
+		sprintf(tmp, "%s/shards/.%02d.%s.old", l->dir, shard, l->node);
+		if (rename(path, tmp) != 0)
+			return -1;
+		//Another node may have taken it between reading and moving it, then it's put back
+		if (readLease(tmp, owner, &until) == 0 && until > now) {
+			if (link(tmp, path) != 0 && l->v) {
+				printtime(l->log);
+				fprintf(l->log, "Two nodes may hold shard %d until %s renews it.\n", shard, owner);
+			}
+			unlink(tmp);
+			return -1;
+		}
+		unlink(tmp);
+	}
+	
+	//Linking fails if another node made the lease first, so only one node ever makes it
+	sprintf(tmp, "%s/shards/.%02d.%s", l->dir, shard, l->node);
+	if (writeLease(l, tmp, now + LEASE_TTL) < 0)
+		return -1;
+	int ret = link(tmp, path);
+	unlink(tmp);
+	if (ret != 0)
+		return -1;
+	
+	l->renewed[shard] = now;
+	return 0;
+}
+
+//Extend this node's lease on shard, returns -1 if it was lost
+static int renew(rssm_leases* l, int shard, time_t now) {
+	char path[strlen(l->dir) + 12];
+	char tmp[strlen(l->dir) + LEASE_NODE + 24];
+	shardPath(l, shard, path);
+	
+	//Past its end another node may have taken it already
+	if (now >= l->renewed[shard] + LEASE_TTL)
+		return -1;
+	char owner[LEASE_NODE];
+	time_t until;
+	if (readLease(path, owner, &until) < 0 || strcmp(owner, l->node) != 0)
+		return -1;
+	
+	sprintf(tmp, "%s/shards/.%02d.%s", l->dir, shard, l->node);
+	if (writeLease(l, tmp, now + LEASE_TTL) < 0 || rename(tmp, path) != 0) {
+		unlink(tmp);
+		//It's still held until the lease written last runs out
+		return 0;
+	}
+	l->renewed[shard] = now;
+	return 0;
+}
+
+//Remove this node's lease on shard so another node can take it
+static void release(rssm_leases* l, int shard) {
+	char path[strlen(l->dir) + 12];
+	shardPath(l, shard, path);
+	
+	char owner[LEASE_NODE];
+	time_t until;
+	if (readLease(path, owner, &until) == 0 && strcmp(owner, l->node) == 0)
+		unlink(path);
+}
+
+//Say this node is alive and count the nodes that are, forgetting ones dead for a long time
+static int heartbeat(rssm_leases* l, time_t now) {
+	char path[strlen(l->dir) + LEASE_NODE + 16];
+	char tmp[strlen(l->dir) + LEASE_NODE + 16];
+	sprintf(path, "%s/nodes/%s", l->dir, l->node);
+	sprintf(tmp, "%s/nodes/.%s", l->dir, l->node);
+	if (writeLease(l, tmp, now + LEASE_TTL) == 0 && rename(tmp, path) != 0)
+		unlink(tmp);
+	
+	char dirPath[strlen(l->dir) + 7];
+	sprintf(dirPath, "%s/nodes", l->dir);
+	DIR* d = opendir(dirPath);
+	if (d == NULL)
+		return 1;
+	
+	int alive = 0;
+	struct dirent* e;
+	while ((e = readdir(d)) != NULL) {
+		if (e->d_name[0] == '.' || strlen(e->d_name) >= LEASE_NODE)
+			continue;
+		sprintf(path, "%s/nodes/%s", l->dir, e->d_name);
+		char node[LEASE_NODE];
+		time_t until;
+		if (readLease(path, node, &until) < 0)
+			continue;
+		if (until > now)
+			alive++;
+		else if (until < now - LEASE_TTL * 10)
+			unlink(path);
+	}
+	closedir(d);
+	
+	return alive > 0 ? alive : 1;
+}
+
+//Renew the leases held and take or give up shards until this node holds its share
+static void leaseRound(rssm_leases* l) {
+	time_t now = time(NULL);
+	int nodes = heartbeat(l, now);
+	int share = (LEASE_SHARDS + nodes - 1) / nodes;
+	
+	int shard, held = 0;
+	for (shard = 0; shard < LEASE_SHARDS; shard++) {
+		if (!l->held[shard])
+			continue;
+		if (renew(l, shard, now) < 0) {
+			pthread_mutex_lock(&l->lock);
+			l->held[shard] = 0;
+			pthread_mutex_unlock(&l->lock);
+			printtime(l->log);
+			fprintf(l->log, "Lost the lease on shard %d, another node fetches its feeds now.\n", shard);
+			continue;
+		}
+		held++;
+	}
+	
+	//Shards over the share go, so a node that joined gets some
+	uint64_t going = 0;
+	for (shard = LEASE_SHARDS - 1; shard >= 0 && held > share; shard--) {
+		if (!l->held[shard])
+			continue;
+		going |= 1ULL << shard;
+		held--;
+	}
+	
+	//Their items are written while the leases still say this node writes them
+	if (going != 0) {
+		pthread_mutex_lock(&l->drainLock);
+		if (l->drain != NULL)
+			l->drain(l->drainData, going);
+		pthread_mutex_unlock(&l->drainLock);
+	}
+	for (shard = 0; shard < LEASE_SHARDS; shard++) {
+		if (!(going >> shard & 1))
+			continue;
+		pthread_mutex_lock(&l->lock);
+		l->held[shard] = 0;
+		pthread_mutex_unlock(&l->lock);
+		release(l, shard);
+		l->released++;
+	}
+	
+	//Nodes start looking at different shards, so they don't all race for the same ones
+	int start = keyHash(l->node, strlen(l->node)) % LEASE_SHARDS;
+	int i;
+	for (i = 0; i < LEASE_SHARDS && held < share; i++) {
+		shard = (start + i) % LEASE_SHARDS;
+		if (l->held[shard] || acquire(l, shard, now) < 0)
+			continue;
+		pthread_mutex_lock(&l->lock);
+		l->held[shard] = 1;
+		pthread_mutex_unlock(&l->lock);
+		held++;
+		l->taken++;
+	}
+	
+	pthread_mutex_lock(&l->lock);
+	l->nodes = nodes;
+	pthread_mutex_unlock(&l->lock);
+}
+
+static void* leaseThread(void* arg) {
+	rssm_leases* l = arg;
+	
+	time_t next = time(NULL) + LEASE_RENEW;
+	while (!l->stop) {
+		sleep(1);
+		if (time(NULL) < next)
+			continue;
+		leaseRound(l);
+		next = time(NULL) + LEASE_RENEW;
+	}
+	
+	return NULL;
+}
+
+int leaseOpen(rssm_leases* l, const char* dir, FILE* log, int v) {
+	memset(l, 0, sizeof(rssm_leases));
+	l->log = log;
+	l->v   = v;
+	pthread_mutex_init(&l->lock, NULL);
+	pthread_mutex_init(&l->drainLock, NULL);
+	
+	l->dir = malloc(strlen(dir) + 1);
+	if (l->dir == NULL)
+		return -1;
+	strcpy(l->dir, dir);
+	
+	char host[LEASE_NODE - 16];
+	if (gethostname(host, sizeof(host)) != 0)
+		strcpy(host, "localhost");
+	host[sizeof(host) - 1] = '\0';
+	snprintf(l->node, LEASE_NODE, "%s.%d", host, (int)getpid());
+	
+	char sub[strlen(dir) + 8];
+	sprintf(sub, "%s/nodes", dir);
+	if (makeDir(dir, log, v) < 0 || makeDir(sub, log, v) < 0)
+		return -1;
+	sprintf(sub, "%s/shards", dir);
+	if (makeDir(sub, log, v) < 0)
+		return -1;
+	
+	return 0;
+}
+
+int leaseStart(rssm_leases* l) {
+	//The first round runs right away so this node starts fetching its share
+	leaseRound(l);
+	if (pthread_create(&l->thread, NULL, leaseThread, l) != 0)
+		return -1;
+	l->started = 1;
+	return 0;
+}
+
+int leaseShard(uint64_t hash) {
+	return hash % LEASE_SHARDS;
+}
+
+uint64_t leaseMask(rssm_leases* l) {
+	pthread_mutex_lock(&l->lock);
+	uint64_t mask = 0;
+	int shard;
+	for (shard = 0; shard < LEASE_SHARDS; shard++)
+		if (l->held[shard])
+			mask |= 1ULL << shard;
+	pthread_mutex_unlock(&l->lock);
+	return mask;
+}
+
+int leaseOwns(uint64_t shards, const char* tag) {
+	return shards >> leaseShard(keyHash(tag, strlen(tag))) & 1;
+}
+
+void leaseDrain(rssm_leases* l, void (*drain)(void* data, uint64_t shards), void* data) {
+	pthread_mutex_lock(&l->drainLock);
+	l->drain     = drain;
+	l->drainData = data;
+	pthread_mutex_unlock(&l->drainLock);
+}
+
+void leaseReport(rssm_leases* l, FILE* log) {
+	pthread_mutex_lock(&l->lock);
+	int shard, held = 0;
+	for (shard = 0; shard < LEASE_SHARDS; shard++)
+		held += l->held[shard];
+	
+	printtime(log);
+	fprintf(log, "Holding %d of %d shards as %s , %d nodes alive, %d shards taken and %d given up since the last report.\n",
+	        held, LEASE_SHARDS, l->node, l->nodes, l->taken, l->released);
+	l->taken    = 0;
+	l->released = 0;
+	pthread_mutex_unlock(&l->lock);
+}
+
+void leaseStop(rssm_leases* l) {
+	l->stop = 1;
+	if (l->started)
+		pthread_join(l->thread, NULL);
+	l->started = 0;
+}
+
+void leaseClose(rssm_leases* l) {
+	leaseStop(l);
+	
+	if (l->dir != NULL) {
+		int shard;
+		for (shard = 0; shard < LEASE_SHARDS; shard++)
+			if (l->held[shard])
+				release(l, shard);
+		memset(l->held, 0, sizeof(l->held));
+		
+		char path[strlen(l->dir) + LEASE_NODE + 8];
+		sprintf(path, "%s/nodes/%s", l->dir, l->node);
+		unlink(path);
+	}
+	
+	free(l->dir);
+	l->dir = NULL;
+	pthread_mutex_destroy(&l->drainLock);
+	pthread_mutex_destroy(&l->lock);
+}
@@ -3,13 +3,26 @@
 #include <unistd.h>
 #include <signal.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
 
 #include <curl/curl.h>
+#include <libxml/parser.h>
 
 #define MAIN_FILE
 #include "setting.h"
 #include "control.h"
 #include "rssmio.h"
+#include "arena.h"
+#include "compact.h"
+#include "cold.h"
+#include "pool.h"
+#include "index.h"
+#include "query.h"
+#include "names.h"
+#include "scheduler.h"
+#include "ctl.h"
+#include "archive.h"
 
 #ifndef VERBOSE
 #define VERBOSE 0
@@ -19,6 +32,8 @@ int loop = 1;
 
 //Free up the memory and close the log
 static void freeMem(rssm_options *opts, rssm_feeditem** feeds, FILE* log) {
+	if (opts->items != NULL && opts->items != opts->directory)
+		free(opts->items);
 	if (opts->directory != NULL)
 		free(opts->directory);
 	if (opts->list != NULL)
@@ -29,15 +44,7 @@ static void freeMem(rssm_options *opts, rssm_feeditem** feeds, FILE* log) {
 	if (feeds != NULL) {
 		size_t i = 0;
 		while (feeds[i] != NULL) {
-			if (feeds[i]->tag != NULL)
-				free(feeds[i]->tag);
-			if (feeds[i]->url != NULL)
-				free(feeds[i]->url);
-			if (feeds[i]->desc != NULL)
-				fclose(feeds[i]->desc);
-			if (feeds[i]->out != NULL)
-				fclose(feeds[i]->out);
-			free(feeds[i]);
+			freeFeed(feeds[i]);
 			i++;
 		}
 		free(feeds);
@@ -46,25 +53,115 @@ static void freeMem(rssm_options *opts, rssm_feeditem** feeds, FILE* log) {
 	if (log != NULL)
 		fclose(log);
 	
+	namesFree();
+	xmlCleanupParser();
 	curl_global_cleanup();
 }
 
-static void smartSleep(int secs) {
-	if (secs == 0)
-		secs = 300;
-	;
-	size_t i = 0;
-	while (loop && i < secs) {
-		sleep(1);
-		i++;
+void handleTerm(int signo, siginfo_t *sinfo, void *context);
+
+//Write back what the write-ahead log kept from the item files, only for the shards in leases if it isn't NULL
+static void walRecover(rssm_wal* wal, rssm_feeditem** feeds, rssm_leases* leases, FILE* log, int v) {
+	int redone = walReplay(wal, feeds, leases, log, v);
+	if (redone < 0) {
+		printtime(log);
+		fprintf(log, "Error reading the write-ahead log %s .\n", wal->path);
+	} else if (redone > 0) {
+		printtime(log);
+		fprintf(log, "Recovered %d items from the write-ahead log.\n", redone);
+	}
+	if (walCheckpoint(wal, feeds, log) < 0) {
+		printtime(log);
+		fprintf(log, "Error checkpointing the write-ahead log %s .\n", wal->path);
 	}
 }
 
-void handleTerm(int signo, siginfo_t *sinfo, void *context);
+//Fetch every feed once in parallel, or read the archive of opts->reprocess again, then compact and save what the daemon would between checks
+//returns the exit status: 0 if every feed was fetched, 1 if some failed and 2 if all of them did
+static int fetchOnce(const rssm_options* opts, rssm_feeditem** feeds, rssm_writer* writer, FILE* log) {
+	int jobs = opts->jobs > 0 ? opts->jobs : poolJobs();
+	rssm_summary sum = {0, 0, 0, 0};
+	
+	//Reading archived responses is all parsing and writing, so it gets a thread per cpu rather than per connection
+	if (opts->reprocess != NULL) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = opts->jobs > 0 ? opts->jobs : cpus > 0 ? cpus : 1;
+		if (opts->verbose) {
+			printtime(log);
+			fprintf(log, "Reading the archive of %s again on up to %d threads...\n", opts->reprocess, jobs);
+		}
+		if (archiveReplay(opts->reprocess, feeds, jobs, writer, log, opts->verbose, &sum) < 0) {
+			printtime(log);
+			fprintf(log, "Error reading the archive of %s .\n", opts->reprocess);
+			return 2;
+		}
+	} else {
+		if (opts->verbose) {
+			printtime(log);
+			fprintf(log, "Fetching every feed on up to %d threads...\n", jobs);
+		}
+		if (poolRun(feeds, jobs, writer, log, opts->verbose, &sum) < 0) {
+			printtime(log);
+			fprintf(log, "Error starting any fetch threads.\n");
+		}
+	}
+	if (writerFlush(writer, feeds, log) < 0) {
+		printtime(log);
+		fprintf(log, "Error writing some of the new items.\n");
+	}
+	if (feeds[0] != NULL && feeds[0]->search != NULL && searchFlush(feeds[0]->search) < 0) {
+		printtime(log);
+		fprintf(log, "Error writing the search index.\n");
+	}
+	
+	size_t i;
+	for (i = 0; feeds[i] != NULL; i++) {
+		const rssm_retention* r = &feeds[i]->retention;
+		if (r->items <= 0 && r->age <= 0 && r->bytes <= 0 && r->hot <= 0)
+			continue;
+		compactFeed(feeds[i], log, opts->verbose);
+	}
+	
+	if (feeds[0] != NULL && feeds[0]->seen != NULL && seenSave(feeds[0]->seen) < 0) {
+		printtime(log);
+		fprintf(log, "Error saving the seen set to %s .\n", feeds[0]->seen->path);
+	}
+	
+	printtime(log);
+	if (opts->reprocess != NULL)
+		fprintf(log, "Read %zu archived responses ok, %zu failed, %zu new items in %.2fs.\n", sum.ok, sum.failed, sum.items, sum.secs);
+	else
+		fprintf(log, "Fetched %zu feeds ok, %zu failed, %zu new items in %.2fs.\n", sum.ok, sum.failed, sum.items, sum.secs);
+	if (feeds[0] != NULL && (opts->memory > 0 || opts->verbose))
+		budgetReport(feeds[0]->budget, log);
+	fflush(log);
+	
+	if (sum.failed == 0)
+		return 0;
+	return sum.ok > 0 ? 1 : 2;
+}
 
 int main(int argc, char** argv) {
+	//Queries only read the directory, they don't need anything set up
+	if (argc > 1 && strcmp(argv[1], "query") == 0)
+		return queryMain(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "search") == 0)
+		return searchMain(argc - 1, argv + 1);
+	if (argc > 1 && strcmp(argv[1], "ctl") == 0)
+		return ctlMain(argc - 1, argv + 1);
+	
 	curl_global_init(CURL_GLOBAL_DEFAULT);
 	
+	//libxml2 has to use our allocator from its very first allocation so per-fetch arenas can back its trees
+	arenaXmlSetup();
+	LIBXML_TEST_VERSION
+	xmlInitParser();
+	//Names every fetch dispatches on are interned once, before any fetch thread starts
+	if (namesInit() < 0) {
+		fprintf(stderr, "Error! Can not set up the xml parser\n");
+		return 1;
+	}
+	
 	//default configuration
 	rssm_options opts;
 	//default is set at compile time
@@ -72,6 +169,23 @@ int main(int argc, char** argv) {
 	opts.daemon  = 1;
 	opts.mins    = 5;
 	opts.force   = 0;
+	opts.crossdedup = 0;
+	opts.cat     = NULL;
+	opts.events  = 0;
+	opts.layout  = LAYOUT_FLAT;
+	opts.once    = 0;
+	opts.jobs    = 0;
+	opts.uring   = 0;
+	opts.search  = 0;
+	opts.memory  = 0;
+	opts.websub  = NULL;
+	opts.format  = FORMAT_TEXT;
+	opts.enclosures = 0;
+	opts.rate    = 0;
+	opts.partition = NULL;
+	opts.items   = NULL;
+	opts.archive = 0;
+	opts.reprocess = NULL;
 	
 	//Get the config path of $HOME/.config/ through all means avaliable
 	char* configPath = getConfigPath(opts.verbose);
@@ -99,9 +213,28 @@ int main(int argc, char** argv) {
 	
 	//Parse arguements
 	argp_parse(&argp, argc, argv, 0, 0, &opts);
+	//Reading an archive again never goes to the network, and doesn't add to an archive
+	if (opts.reprocess != NULL) {
+		opts.enclosures = 0;
+		opts.archive    = 0;
+	}
 	
-	//Check the lockfile
-	int pid = checkLock("/tmp/rssm.lock");
+	//Printing an item file doesn't touch the daemon
+	if (opts.cat != NULL) {
+		int ret = coldCat(opts.cat, stdout);
+		if (ret < 0)
+			fprintf(stderr, "Error! Can not read %s\n", opts.cat);
+		freeMem(&opts, NULL, NULL);
+		return ret;
+	}
+	
+	//Nodes sharing feeds can run on one host, so their lock is per rss directory
+	char lockPath[64] = "/tmp/rssm.lock";
+	if (opts.partition != NULL)
+		sprintf(lockPath, "/tmp/rssm.%016llx.lock", (unsigned long long)keyHash(opts.directory, strlen(opts.directory)));
+	
+	//A one-shot run can go alongside a daemon, so it doesn't take the lock
+	int pid = opts.once ? 0 : checkLock(lockPath);
 	if (pid > 0 && !opts.force) {
 		printf("Error! There is another instance running with pid %d . Only one rssm can be run at a time.\n", pid);
 		return -1;
@@ -109,8 +242,8 @@ int main(int argc, char** argv) {
 		if (opts.verbose)
 			printf("Killing current daemon...\n");
 		kill(pid, SIGTERM);
-		remove("/tmp/rssm.lock");
-		checkLock("/tmp/rssm.lock");
+		remove(lockPath);
+		checkLock(lockPath);
 	} else if (pid == -1) {
 		printf("Error! Lock file can not be created. Exiting.\n");
 		return -1;
@@ -131,10 +264,15 @@ int main(int argc, char** argv) {
 	if (opts.verbose)
 		printf("Parsed command-line arguments, going to open the log file...\n");
 	
+	//One-shot runs log straight to stdout
+	FILE* log = stdout;
+	if (opts.once)
+		goto setup;
+	
 	//Set up the log before we become a daemon so verbose messages can still be sent on the parent
 	char* logPath = getLogPath(&opts, opts.verbose);
 	//This log file will be used for fprintf the rest of the program - the log char* in rssm_options is no longer needed, which is why we don't set it to the new correct one
-	FILE* log     = fopen(logPath, "w");
+	log = fopen(logPath, "w");
 	
 	if (opts.verbose)
 		printf("Log file opened at %s, daemonizing now...\n", logPath);
@@ -166,6 +304,7 @@ int main(int argc, char** argv) {
 	dup2(fileno(log), fileno(stdout));
 	dup2(fileno(log), fileno(stderr));
 	
+setup:
 	//Now we are in daemon mode. 
 	//Change to "/", the only directory that a distro WILL have
 	if (opts.verbose) {
@@ -203,6 +342,21 @@ int main(int argc, char** argv) {
 	//this list will always end with a NULL pointer
 	rssm_feeditem** feeds = getFeeds(opts.list, log, opts.verbose);
 	
+	//Feeds added over the control socket take spare places at the end, so everything walking the list keeps seeing one list
+	size_t count = 0;
+	while (feeds[count] != NULL)
+		count++;
+	rssm_feeditem** spare = realloc(feeds, sizeof(rssm_feeditem *) * (count + SCHED_ADDS + 1));
+	if (spare == NULL) {
+		printtime(log);
+		fprintf(log, "Error allocating the feed list. Exiting.\n");
+		
+		freeMem(&opts, feeds, log);
+		return 0;
+	}
+	feeds = spare;
+	memset(feeds + count, 0, sizeof(rssm_feeditem *) * (SCHED_ADDS + 1));
+	
 	if (opts.verbose) {
 		printtime(log);
 		fprintf(log, "Feedlists read in, setting up directory tree...\n");
@@ -222,6 +376,21 @@ int main(int argc, char** argv) {
 		fprintf(log, "Directory %s is now useable for us!\n", opts.directory);
 	}
 	
+	//Nodes sharing the feeds share their item files too, each feed's are written by the node holding its shard
+	opts.items = opts.directory;
+	if (opts.partition != NULL && !opts.once) {
+		opts.items = malloc(sizeof(char) * (strlen(opts.partition) + 7));
+		if (opts.items != NULL)
+			sprintf(opts.items, "%s/feeds", opts.partition);
+		if (opts.items == NULL || makeDir(opts.partition, log, opts.verbose) < 0 || makeDir(opts.items, log, opts.verbose) < 0) {
+			printtime(log);
+			fprintf(log, "Error creating directory %s/feeds. Exiting.\n", opts.partition);
+			
+			freeMem(&opts, feeds, log);
+			return 0;
+		}
+	}
+	
 	if (opts.verbose) {
 		printtime(log);
 		fprintf(log, "Making the tag fifo's...\n");
@@ -230,90 +399,372 @@ int main(int argc, char** argv) {
 	//Now we make a fifo for each tag we have
 	size_t i = 0;
 	while (feeds[i] != NULL) {
-		char* tagPath = malloc(sizeof(char) * (strlen(opts.directory) + strlen(feeds[i]->tag) + 2));
-		strcpy(tagPath, opts.directory);
-		strcat(tagPath, "/");
-		strcat(tagPath, feeds[i]->tag);
-		if (opts.verbose) {
+		if (openFeed(feeds[i], opts.items, opts.layout, opts.format, log, opts.verbose) < 0) {
 			printtime(log);
-			fprintf(log, "Making %s file\n", tagPath);
-		}
-		stat = makeFile(tagPath, log, opts.verbose);
-		if (stat < 0) {
-			free(tagPath);
+			fprintf(log, "Error setting up the files of %s . Exiting.\n", feeds[i]->tag);
 			
 			freeMem(&opts, feeds, log);
 			return 0;
 		}
+		i++;
+	}
+	
+	//Consumers find each tag's files through the manifest
+	writeManifest(opts.directory, feeds, log);
+	
+	//Cross-feed dedup shares one seen set, persisted in the rss directory
+	rssm_seen seen;
+	memset(&seen, 0, sizeof(rssm_seen));
+	if (opts.crossdedup) {
+		char* seenPath = malloc(sizeof(char) * (strlen(opts.directory) + 12));
+		strcpy(seenPath, opts.directory);
+		strcat(seenPath, "/.rssm seen");
 		
-		feeds[i]->out = fopen(tagPath, "a+");
-		if (feeds[i]->out == NULL) {
+		if (seenLoad(&seen, seenPath, opts.crossdedup) < 0) {
 			printtime(log);
-			fprintf(log, "Error opening fifod for %s . Exiting.\n", feeds[i]->tag);
-			free(tagPath);
-			
-			freeMem(&opts, feeds, log);
-			return 0;
+			fprintf(log, "Seen set %s is corrupt, starting from an empty one.\n", seenPath);
+		} else if (opts.verbose) {
+			printtime(log);
+			fprintf(log, "Loaded %zu seen items from %s\n", seen.keys.count, seenPath);
 		}
+		free(seenPath);
 		
-		char* descPath  = malloc(sizeof(char) * (strlen(tagPath) + 6));
-		strcpy(descPath, tagPath);
-		strcat(descPath, " desc");
-		
-		stat = makeFile(descPath, log, opts.verbose);
-		if (stat < 0) {
-			free(tagPath);
-			free(descPath);
-			
-			freeMem(&opts, feeds, log);
-			return 0;
+		for (i = 0; feeds[i] != NULL; i++)
+			feeds[i]->seen = &seen;
+	}
+	
+	//New items are announced in one journal for the whole directory
+	rssm_events events = {-1, NULL};
+	if (opts.events) {
+		if (eventsOpen(&events, opts.directory) < 0) {
+			printtime(log);
+			fprintf(log, "Error opening the event journal %s , no events will be written.\n", events.path);
+		} else {
+			for (i = 0; feeds[i] != NULL; i++)
+				feeds[i]->events = &events;
+		}
+	}
+	
+	//The full-text index is set up before the log is replayed so recovered items get indexed too
+	rssm_search search;
+	memset(&search, 0, sizeof(rssm_search));
+	if (opts.search) {
+		if (searchOpen(&search, opts.directory) < 0) {
+			printtime(log);
+			fprintf(log, "Error opening the search index %s , items won't be indexed.\n", search.dir);
+		} else {
+			for (i = 0; feeds[i] != NULL; i++)
+				feeds[i]->search = &search;
 		}
+	}
+	
+	//Every fetch is charged to one budget, without -m it only counts
+	rssm_budget budget;
+	budgetInit(&budget, opts.memory);
+	for (i = 0; feeds[i] != NULL; i++)
+		feeds[i]->budget = &budget;
+	
+	//Items go through the write-ahead log, anything a crash kept from an item file is written back first
+	//Shared item files are only written back once the leases say which ones are this node's
+	rssm_wal wal = {-1, NULL};
+	if (walOpen(&wal, opts.directory) < 0) {
+		printtime(log);
+		fprintf(log, "Error opening the write-ahead log %s , items won't be crash safe.\n", wal.path);
+	} else {
+		if (opts.items == opts.directory)
+			walRecover(&wal, feeds, NULL, log, opts.verbose);
 		
-		feeds[i]->desc = fopen(descPath, "a+");
-		if (feeds[i]->desc == NULL) {
+		for (i = 0; feeds[i] != NULL; i++)
+			feeds[i]->wal = &wal;
+	}
+	
+	//Each check's items are written in one batch at its end
+	rssm_writer writer;
+	if (writerOpen(&writer, opts.uring)) {
+		if (opts.verbose) {
 			printtime(log);
-			fprintf(log, "Error opening fifo for tag desc %s . Exiting.\n", feeds[i]->tag);
-			free(tagPath);
-			free(descPath);
-			
-			freeMem(&opts, feeds, log);
-			return 0;
+			fprintf(log, "Writing items with io_uring.\n");
 		}
+	} else if (opts.uring) {
+		printtime(log);
+		fprintf(log, "io_uring is not available, writing items with pwrite.\n");
+	}
+	
+	//Enclosures download on their own threads, under the bandwidth cap, so feeds never wait for them
+	rssm_enclosures enclosures;
+	memset(&enclosures, 0, sizeof(rssm_enclosures));
+	if (opts.enclosures) {
+		if (enclosureOpen(&enclosures, opts.directory, opts.rate, log, opts.verbose) < 0 || enclosureStart(&enclosures) < 0) {
+			printtime(log);
+			fprintf(log, "Error setting up enclosure downloads in %s , enclosures won't be downloaded.\n", enclosures.dir != NULL ? enclosures.dir : opts.directory);
+			enclosureClose(&enclosures);
+			opts.enclosures = 0;
+		} else {
+			for (i = 0; feeds[i] != NULL; i++)
+				feeds[i]->enclosures = &enclosures;
+		}
+	}
+	
+	//Responses are kept as they're read, so item files can be rebuilt from them later
+	rssm_archive archive;
+	memset(&archive, 0, sizeof(rssm_archive));
+	if (opts.archive) {
+		if (archiveOpen(&archive, opts.directory) < 0) {
+			printtime(log);
+			fprintf(log, "Error opening the response archive in %s , responses won't be archived.\n", opts.directory);
+			archiveClose(&archive);
+			opts.archive = 0;
+		} else {
+			for (i = 0; feeds[i] != NULL; i++)
+				feeds[i]->archive = &archive;
+		}
+	}
+	
+	if (opts.once) {
+		int ret = fetchOnce(&opts, feeds, &writer, log);
+		//A one-shot run waits for the enclosures it found
+		if (opts.enclosures) {
+			enclosureDrain(&enclosures);
+			enclosureReport(&enclosures, stdout);
+			enclosureClose(&enclosures);
+		}
+		if (opts.archive)
+			archiveClose(&archive);
+		writerClose(&writer);
+		searchClose(&search);
 		
-		free(descPath);
-		free(tagPath);
-		i++;
+		if (wal.fd >= 0 && walCheckpoint(&wal, feeds, log) < 0) {
+			printtime(log);
+			fprintf(log, "Error checkpointing the write-ahead log %s .\n", wal.path);
+		}
+		walClose(&wal);
+		if (opts.crossdedup)
+			seenFree(&seen);
+		eventsClose(&events);
+		budgetFree(&budget);
+		freeMem(&opts, feeds, NULL);
+		return ret;
+	}
+	
+	//Hubs feeds name push new content instead of being polled for it
+	rssm_websub websub;
+	memset(&websub, 0, sizeof(rssm_websub));
+	websub.fd = -1;
+	if (opts.websub != NULL) {
+		if (websubOpen(&websub, opts.websub, feeds, log, opts.verbose) < 0) {
+			printtime(log);
+			fprintf(log, "Error listening for WebSub hubs at %s , feeds will only be polled.\n", opts.websub);
+		} else {
+			for (i = 0; feeds[i] != NULL; i++)
+				feeds[i]->websub = &websub;
+		}
+	}
+	
+	//Nodes sharing the feeds each take a share of the shards before fetching any
+	rssm_leases leases;
+	memset(&leases, 0, sizeof(rssm_leases));
+	if (opts.partition != NULL && (leaseOpen(&leases, opts.partition, log, opts.verbose) < 0 || leaseStart(&leases) < 0)) {
+		printtime(log);
+		fprintf(log, "Error joining the nodes sharing %s . Exiting.\n", opts.partition);
+		leaseClose(&leases);
+		//The log is kept for the next start, which may get the leases to write it back
+		walClose(&wal);
+		loop = 0;
+	} else if (opts.partition != NULL) {
+		leaseReport(&leases, log);
+		if (wal.fd >= 0)
+			walRecover(&wal, feeds, &leases, log, opts.verbose);
+		websub.leases = websub.fd >= 0 ? &leases : NULL;
+		writer.leases = &leases;
+	}
+	
+	//Feeds with a retention policy get compacted in the background, shared ones only by the node holding their shard
+	rssm_compactargs compactArgs = {feeds, log, opts.verbose, opts.mins, &loop, leases.dir != NULL ? &leases : NULL};
+	pthread_t compactor;
+	int compacting = 0;
+	for (i = 0; feeds[i] != NULL && !compacting; i++) {
+		const rssm_retention* r = &feeds[i]->retention;
+		compacting = r->items > 0 || r->age > 0 || r->bytes > 0 || r->hot > 0;
+	}
+	if (compacting && pthread_create(&compactor, NULL, compactThread, &compactArgs) != 0) {
+		printtime(log);
+		fprintf(log, "Error starting the compaction thread, item files won't be compacted.\n");
+		compacting = 0;
+	}
+	
+	//Feeds are fetched on worker threads as they come due, most urgent tier first
+	rssm_sched sched;
+	int jobs = opts.jobs > 0 ? opts.jobs : poolJobs();
+	int scheduling = loop && schedStart(&sched, feeds, jobs, opts.mins, &writer, log, opts.verbose) == 0;
+	if (opts.partition != NULL) {
+		sched.leases = &leases;
+		sched.shards = leaseMask(&leases);
+		//Shards over this node's share are only given up once what was fetched for them is written
+		if (scheduling)
+			leaseDrain(&leases, schedDrain, &sched);
+	}
+	if (!scheduling && loop) {
+		printtime(log);
+		fprintf(log, "Error starting the fetch threads. Exiting.\n");
+		loop = 0;
+	} else if (opts.verbose) {
+		printtime(log);
+		fprintf(log, "Fetching feeds on %d threads as they come due...\n", sched.started);
+	}
+	if (scheduling && websub.fd >= 0 && websubStart(&websub) < 0) {
+		printtime(log);
+		fprintf(log, "Error starting the WebSub threads, feeds will only be polled.\n");
 	}
 	
+	//rssm ctl asks for fetches and changes feeds through a socket in the rss directory
+	rssm_ctl ctl;
+	if (scheduling && (ctlOpen(&ctl, &opts, &sched, log, opts.verbose) < 0 || ctlStart(&ctl) < 0)) {
+		printtime(log);
+		fprintf(log, "Error listening for rssm ctl at %s , the daemon can't be controlled while it runs.\n", ctl.path != NULL ? ctl.path : opts.directory);
+		ctlClose(&ctl);
+	}
+	
+	//Search segments, the seen set and the reports are written once every check interval
+	int secs = opts.mins > 0 ? opts.mins * 60 : 300;
+	time_t housekeeping = time(NULL) + secs;
+	
 	//Loop for continously checking the rss feeds
 	while (loop) {
-		//getNewRss each feed
-		size_t i = 0;
-		while (feeds[i] != NULL) {
-			if (opts.verbose) {
+		schedQueue(&sched, time(NULL));
+		sleep(1);
+		
+		//Whatever finished or was pushed is written every second, so critical feeds show up right away
+		size_t done = schedTake(&sched);
+		if (websub.started)
+			done += websubTake(&websub);
+		if (done > 0) {
+			pthread_mutex_lock(&sched.flushLock);
+			if (writerFlush(&writer, feeds, log) < 0) {
 				printtime(log);
-				fprintf(log, "Checking rss feed %s for new items...\n", feeds[i]->tag);
+				fprintf(log, "Error writing some of the new items.\n");
+			}
+			pthread_mutex_unlock(&sched.flushLock);
+			
+			//One sync of the log makes everything written durable, item files are synced when it's checkpointed
+			if (wal.fd >= 0 && walCommit(&wal) < 0) {
+				printtime(log);
+				fprintf(log, "Error syncing the write-ahead log %s .\n", wal.path);
 			}
-			getNewRss(feeds[i], log, opts.verbose);
-			i++;
 		}
 		
-		if (opts.verbose) {
+		//Emptying the log mustn't drop items fetches are still adding, so nothing runs meanwhile
+		if (wal.fd >= 0 && walFull(&wal)) {
+			schedPause(&sched);
+			if (websub.fd >= 0)
+				pthread_mutex_lock(&websub.ingest);
+			//Items that couldn't be written stay in the log until they are
+			int flushed = writerFlush(&writer, feeds, log) >= 0;
+			if (!flushed) {
+				printtime(log);
+				fprintf(log, "Error writing some of the new items.\n");
+			}
+			if (walCommit(&wal) < 0 || (flushed && walCheckpoint(&wal, feeds, log) < 0)) {
+				printtime(log);
+				fprintf(log, "Error checkpointing the write-ahead log %s .\n", wal.path);
+			}
+			if (websub.fd >= 0)
+				pthread_mutex_unlock(&websub.ingest);
+			schedResume(&sched);
+		}
+		
+		if (time(NULL) < housekeeping)
+			continue;
+		housekeeping = time(NULL) + secs;
+		
+		if (opts.search && searchFlush(&search) < 0) {
 			printtime(log);
-			fprintf(log, "Going to sleep for %d mins...\n", opts.mins);
+			fprintf(log, "Error writing the search index %s .\n", search.dir);
 		}
+		
+		pthread_mutex_lock(&sched.flushLock);
+		if (events.fd >= 0 && eventsRotate(&events) < 0) {
+			printtime(log);
+			fprintf(log, "Error rotating the event journal %s .\n", events.path);
+		}
+		pthread_mutex_unlock(&sched.flushLock);
+		
+		if (opts.crossdedup) {
+			pthread_mutex_lock(&seen.lock);
+			if (seenSave(&seen) < 0) {
+				printtime(log);
+				fprintf(log, "Error saving the seen set to %s .\n", seen.path);
+			}
+			pthread_mutex_unlock(&seen.lock);
+		}
+		
+		if (opts.memory > 0 || opts.verbose)
+			budgetReport(&budget, log);
+		schedReport(&sched, log);
+		if (leases.dir != NULL)
+			leaseReport(&leases, log);
+		if (opts.enclosures)
+			enclosureReport(&enclosures, log);
+		if (opts.archive)
+			archiveReport(&archive, log);
 		fflush(log);
-		//A smart sleep function that will exit within 1 sec of loop being set to 0
-		smartSleep(opts.mins * 60);
 	}
 	
+	//Fetches still running finish, then everything is written out like at the end of a check
+	//Fetches look up and discover hubs, so the WebSub state goes only once no fetch is running
+	//The shards stay held meanwhile, so what is written out is still this node's to write
+	if (leases.dir != NULL)
+		leaseStop(&leases);
+	if (scheduling) {
+		ctlClose(&ctl);
+		schedStop(&sched);
+	}
+	if (opts.websub != NULL)
+		websubClose(&websub);
+	int flushed = 1;
+	if (scheduling) {
+		if (writerFlush(&writer, feeds, log) < 0) {
+			printtime(log);
+			fprintf(log, "Error writing some of the new items, they stay in the write-ahead log for the next start.\n");
+			flushed = 0;
+		}
+		if (opts.search && searchFlush(&search) < 0) {
+			printtime(log);
+			fprintf(log, "Error writing the search index %s .\n", search.dir);
+		}
+		if (opts.crossdedup && seenSave(&seen) < 0) {
+			printtime(log);
+			fprintf(log, "Error saving the seen set to %s .\n", seen.path);
+		}
+	}
+	
+	//Nothing of ours is being fetched anymore, so the other nodes can take our shards right away
+	if (leases.dir != NULL)
+		leaseClose(&leases);
+	
 	//Clean up
 	printtime(log);
 	fprintf(log, "Cleaning up everything to close...\n");
 	
+	if (compacting)
+		pthread_join(compactor, NULL);
+	if (opts.enclosures)
+		enclosureClose(&enclosures);
+	if (opts.archive)
+		archiveClose(&archive);
+	writerClose(&writer);
+	searchClose(&search);
+	if (wal.fd >= 0 && flushed && walCheckpoint(&wal, feeds, log) < 0) {
+		printtime(log);
+		fprintf(log, "Error checkpointing the write-ahead log %s .\n", wal.path);
+	}
+	walClose(&wal);
+	if (opts.crossdedup)
+		seenFree(&seen);
+	eventsClose(&events);
+	budgetFree(&budget);
 	freeMem(&opts, feeds, log);
 	//remove lock file
-	remove("/tmp/rssm.lock");
+	remove(lockPath);
 	return 0;
 }
 
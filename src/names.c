@@ -0,0 +1,62 @@
+#include <stdio.h>
+
+#include <libxml/parser.h>
+#include <libxml/dict.h>
+
+#include "names.h"
+
+const xmlChar* names[NAME_COUNT];
+
+static const char* spellings[NAME_COUNT] = {
+	"rss", "feed", "channel", "item", "entry",
+	"link", "href", "rel",
+	"guid", "id", "title", "description", "summary", "content",
+	"enclosure", "url", "group"
+};
+
+//Never written after namesInit, so every fetch thread can read it at once
+static xmlDictPtr shared = NULL;
+
+int namesInit(void) {
+	shared = xmlDictCreate();
+	if (shared == NULL)
+		return -1;
+	
+	int i;
+	for (i = 0; i < NAME_COUNT; i++) {
+		names[i] = xmlDictLookup(shared, (const xmlChar *)spellings[i], -1);
+		if (names[i] == NULL)
+			return -1;
+	}
+	
+	return 0;
+}
+
+xmlDocPtr namesParse(const char* buf, int len) {
+	xmlParserCtxtPtr ctxt = xmlNewParserCtxt();
+	if (ctxt == NULL)
+		return NULL;
+	
+	//Names found in the shared dictionary come back as its strings, only the feed's own go in the new one
+	xmlDictPtr dict = xmlDictCreateSub(shared);
+	if (dict == NULL) {
+		xmlFreeParserCtxt(ctxt);
+		return NULL;
+	}
+	xmlDictFree(ctxt->dict);
+	ctxt->dict = dict;
+	//The parser compares these by pointer against names from its dictionary
+	ctxt->str_xml    = xmlDictLookup(dict, (const xmlChar *)"xml", 3);
+	ctxt->str_xmlns  = xmlDictLookup(dict, (const xmlChar *)"xmlns", 5);
+	ctxt->str_xml_ns = xmlDictLookup(dict, XML_XML_NAMESPACE, 36);
+	
+	xmlDocPtr doc = xmlCtxtReadMemory(ctxt, buf, len, NULL, "utf-8", 0);
+	xmlFreeParserCtxt(ctxt);
+	
+	return doc;
+}
+
+void namesFree(void) {
+	xmlDictFree(shared);
+	shared = NULL;
+}
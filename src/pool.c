@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "pool.h"
+#include "rssmio.h"
+
+//Shared between the fetch threads of one poolRun
+struct __pool {
+	rssm_feeditem** feeds;
+	size_t next;
+	//flushes queued items early when they fill the memory budget
+	rssm_writer* writer;
+	pthread_mutex_t flushLock;
+	FILE* log;
+	int v;
+	rssm_summary* sum;
+	pthread_mutex_t lock;
+};
+
+int poolJobs(void) {
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus < 1)
+		cpus = 1;
+	return cpus * 4 > POOL_MAX ? POOL_MAX : cpus * 4;
+}
+
+//Take feeds off the list until there are none left
+static void* poolWorker(void* arg) {
+	struct __pool* p = arg;
+	
+	while (1) {
+		pthread_mutex_lock(&p->lock);
+		rssm_feeditem* feed = p->feeds[p->next];
+		if (feed != NULL)
+			p->next++;
+		pthread_mutex_unlock(&p->lock);
+		
+		if (feed == NULL)
+			break;
+		
+		int items = getNewRss(feed, p->log, p->v);
+		
+		pthread_mutex_lock(&p->lock);
+		if (items < 0) {
+			p->sum->failed++;
+		} else {
+			p->sum->ok++;
+			p->sum->items += items;
+		}
+		pthread_mutex_unlock(&p->lock);
+		
+		//One thread flushes while the others keep fetching
+		if (feed->budget != NULL && budgetWriteFull(feed->budget) && pthread_mutex_trylock(&p->flushLock) == 0) {
+			if (writerFlush(p->writer, p->feeds, p->log) < 0) {
+				printtime(p->log);
+				fprintf(p->log, "Error writing some of the new items.\n");
+			}
+			pthread_mutex_unlock(&p->flushLock);
+		}
+	}
+	
+	rssmioThreadDone();
+	return NULL;
+}
+
+int poolRun(rssm_feeditem** feeds, int jobs, rssm_writer* writer, FILE* log, int v, rssm_summary* sum) {
+	struct __pool p = {feeds, 0, writer};
+	p.log = log;
+	p.v   = v;
+	p.sum = sum;
+	pthread_mutex_init(&p.lock, NULL);
+	pthread_mutex_init(&p.flushLock, NULL);
+	
+	struct timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	
+	//No point in more threads than feeds
+	size_t nfeeds = 0;
+	while (feeds[nfeeds] != NULL)
+		nfeeds++;
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > POOL_MAX)
+		jobs = POOL_MAX;
+	if ((size_t)jobs > nfeeds)
+		jobs = nfeeds;
+	
+	pthread_t threads[POOL_MAX];
+	int started = 0;
+	for (; started < jobs; started++) {
+		if (pthread_create(&threads[started], NULL, poolWorker, &p) != 0) {
+			printtime(log);
+			fprintf(log, "Could only start %d of %d fetch threads.\n", started, jobs);
+			break;
+		}
+	}
+	
+	//Without any threads fetch on this one
+	if (started == 0 && nfeeds > 0)
+		poolWorker(&p);
+	
+	int i;
+	for (i = 0; i < started; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&p.lock);
+	pthread_mutex_destroy(&p.flushLock);
+	
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	sum->secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	
+	return started == 0 && nfeeds > 0 ? -1 : 0;
+}
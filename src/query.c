@@ -0,0 +1,447 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <argp.h>
+#include <stdint.h>
+
+#include "query.h"
+#include "index.h"
+#include "identity.h"
+#include "itemfile.h"
+#include "setting.h"
+#include "search.h"
+
+//What to look for, every set field has to match
+struct __query {
+	char* directory;
+	char* tag;
+	time_t since, until;
+	int byId, byLink, print;
+	rssm_itemid id;
+	uint64_t link;
+};
+
+static char queryDoc[] = "rssm query - list the stored items matching every given condition, one \"<tag> <fetched> <identity> <offset> <length>\" line per item.\v"
+	"TIME is a unix time, or an age like 90m, 36h or 2d. Items sealed into cold storage are not indexed.";
+
+static struct argp_option queryOptions[] = {
+	{"directory", 'd', "DIR",      0, "rss directory to query (default is $HOME/rss)"},
+	{"tag",       't', "TAG",      0, "Only look at the items of TAG"},
+	{"since",     's', "TIME",     0, "Items fetched at or after TIME"},
+	{"until",     'u', "TIME",     0, "Items fetched at or before TIME"},
+	{"id",        'i', "IDENTITY", 0, "The item with this identity"},
+	{"link",      'k', "URL",      0, "Items linking to URL, compared like cross-feed dedup compares links"},
+	{"print",     'p', 0,          0, "Print the items instead of listing them"},
+	{ 0 }
+};
+
+//A unix time, or an age back from now with an s, m, h or d suffix
+static int parseTime(const char* arg, time_t* out) {
+	char* end;
+	long val = strtol(arg, &end, 10);
+	if (end == arg || val < 0)
+		return -1;
+	
+	switch (*end) {
+		case '\0':
+			*out = val;
+			return 0;
+		case 's': break;
+		case 'm': val *= 60; break;
+		case 'h': val *= 60 * 60; break;
+		case 'd': val *= 24 * 60 * 60; break;
+		default:
+			return -1;
+	}
+	if (end[1] != '\0')
+		return -1;
+	
+	*out = time(NULL) - val;
+	return 0;
+}
+
+static error_t parseQuery(int key, char* arg, struct argp_state *state) {
+	struct __query* q = state->input;
+	
+	switch (key) {
+		case 'd':
+			q->directory = arg;
+			break;
+		case 't':
+			q->tag = arg;
+			break;
+		case 's':
+			if (parseTime(arg, &q->since) < 0)
+				argp_error(state, "%s is not a unix time or an age", arg);
+			break;
+		case 'u':
+			if (parseTime(arg, &q->until) < 0)
+				argp_error(state, "%s is not a unix time or an age", arg);
+			break;
+		case 'i':
+			if (identityParse(arg, &q->id) < 0)
+				argp_error(state, "%s is not an identity", arg);
+			q->byId = 1;
+			break;
+		case 'k':
+			q->link   = linkKey(arg, strlen(arg));
+			q->byLink = 1;
+			break;
+		case 'p':
+			q->print = 1;
+			break;
+		case ARGP_KEY_ARG:
+			argp_usage(state);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp queryArgp = {queryOptions, parseQuery, "", queryDoc};
+
+//returns 1 if the records are in fetched order
+static int ordered(const rssm_indexrec* recs, size_t count) {
+	size_t i;
+	for (i = 1; i < count; i++)
+		if (recs[i].fetched < recs[i-1].fetched)
+			return 0;
+	return 1;
+}
+
+//First record fetched at or after since, records are in fetched order
+static size_t lowerBound(const rssm_indexrec* recs, size_t count, time_t since) {
+	size_t lo = 0, hi = count;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (recs[mid].fetched < since)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+//Print the matches among one tag's items, returns how many matched or -1 if it has no index
+static long queryTag(const struct __query* q, const char* tag, const char* path) {
+	size_t count;
+	rssm_indexrec* recs = indexMap(path, &count);
+	if (recs == NULL)
+		return -1;
+	
+	//Replays can put older items after newer ones, then every record has to be looked at
+	int sorted = ordered(recs, count);
+	FILE* items = q->print ? fopen(path, "r") : NULL;
+	long matched = 0;
+	size_t i;
+	for (i = sorted ? lowerBound(recs, count, q->since) : 0; i < count; i++) {
+		const rssm_indexrec* r = &recs[i];
+		if (r->fetched > q->until) {
+			if (sorted)
+				break;
+			continue;
+		}
+		if (r->fetched < q->since)
+			continue;
+		if (q->byId && (r->hi != q->id.hi || r->lo != q->id.lo))
+			continue;
+		if (q->byLink && r->link != q->link)
+			continue;
+		matched++;
+		
+		if (items == NULL) {
+			char hex[IDENTITY_HEX + 1];
+			identityFormat((rssm_itemid){r->hi, r->lo}, hex);
+			printf("%s\t%lld\t%s\t%llu\t%llu\n", tag, (long long)r->fetched, hex, (unsigned long long)r->off, (unsigned long long)r->len);
+			continue;
+		}
+		
+		//Only the matching items are read
+		char* buf = malloc(r->len);
+		if (buf != NULL && fseek(items, r->off, SEEK_SET) == 0 && fread(buf, 1, r->len, items) == r->len)
+			fwrite(buf, 1, r->len, stdout);
+		free(buf);
+	}
+	
+	if (items != NULL)
+		fclose(items);
+	unmapFile((char *)recs, count * sizeof(rssm_indexrec));
+	return matched;
+}
+
+//Tags of a rss directory and the paths of their item files
+struct __manifest {
+	char** tags;
+	char** paths;
+	size_t count;
+};
+
+//The rss directory to use, the given one or $HOME/rss
+static char* queryDir(const char* given) {
+	if (given != NULL)
+		return strdup(given);
+	
+	char* home = getHomePath(0);
+	char* dir = malloc(strlen(home) + 4);
+	sprintf(dir, "%srss", home);
+	free(home);
+	return dir;
+}
+
+//Read the manifest of dir, which says where every tag's item file is
+static int readManifest(const char* dir, struct __manifest* m) {
+	memset(m, 0, sizeof(struct __manifest));
+	
+	char manifestPath[strlen(dir) + 16];
+	sprintf(manifestPath, "%s/.rssm manifest", dir);
+	FILE* manifest = fopen(manifestPath, "r");
+	if (manifest == NULL) {
+		fprintf(stderr, "Error! Can not read %s\n", manifestPath);
+		return -1;
+	}
+	
+	char* line = NULL;
+	size_t cap = 0;
+	ssize_t n;
+	while ((n = getline(&line, &cap, manifest)) > 0) {
+		if (line[n - 1] == '\n')
+			line[--n] = '\0';
+		char* rel = strchr(line, '\t');
+		if (rel == NULL)
+			continue;
+		*rel++ = '\0';
+		
+		char** tags  = realloc(m->tags, (m->count + 1) * sizeof(char *));
+		char** paths = tags != NULL ? realloc(m->paths, (m->count + 1) * sizeof(char *)) : NULL;
+		if (tags != NULL)
+			m->tags = tags;
+		if (paths == NULL)
+			break;
+		m->paths = paths;
+		
+		m->tags[m->count]  = strdup(line);
+		//Item files shared with other nodes are listed by their full path
+		m->paths[m->count] = malloc(strlen(dir) + strlen(rel) + 2);
+		if (rel[0] == '/')
+			strcpy(m->paths[m->count], rel);
+		else
+			sprintf(m->paths[m->count], "%s/%s", dir, rel);
+		m->count++;
+	}
+	
+	free(line);
+	fclose(manifest);
+	return 0;
+}
+
+static void freeManifest(struct __manifest* m) {
+	size_t i;
+	for (i = 0; i < m->count; i++) {
+		free(m->tags[i]);
+		free(m->paths[i]);
+	}
+	free(m->tags);
+	free(m->paths);
+}
+
+int queryMain(int argc, char** argv) {
+	struct __query q;
+	memset(&q, 0, sizeof(q));
+	q.until = INT64_MAX;
+	
+	//Usage messages name the subcommand
+	argv[0] = "rssm query";
+	argp_parse(&queryArgp, argc, argv, 0, 0, &q);
+	
+	char* dir = queryDir(q.directory);
+	struct __manifest m;
+	if (readManifest(dir, &m) < 0) {
+		free(dir);
+		return 2;
+	}
+	
+	long matched = 0;
+	int found = q.tag == NULL;
+	size_t i;
+	for (i = 0; i < m.count; i++) {
+		if (q.tag != NULL && strcmp(q.tag, m.tags[i]) != 0)
+			continue;
+		found = 1;
+		
+		long ret = queryTag(&q, m.tags[i], m.paths[i]);
+		if (ret < 0)
+			fprintf(stderr, "Error! %s has no index, run rssm to build it\n", m.tags[i]);
+		else
+			matched += ret;
+	}
+	
+	freeManifest(&m);
+	free(dir);
+	
+	if (!found) {
+		fprintf(stderr, "Error! There is no tag %s\n", q.tag);
+		return 2;
+	}
+	return matched > 0 ? 0 : 1;
+}
+
+//What rssm search looks for
+struct __searchQuery {
+	char* directory;
+	char* tag;
+	long limit;
+	int print;
+	char** terms;
+	size_t nterms;
+};
+
+static char searchDoc[] = "rssm search - list the items whose title, description or categories have every one of WORDS, newest first, "
+	"one \"<tag> <identity>\" line per item.\v"
+	"Needs rssm to have been run with -S to keep the search index.";
+
+static struct argp_option searchOptions[] = {
+	{"directory", 'd', "DIR", 0, "rss directory to search (default is $HOME/rss)"},
+	{"tag",       't', "TAG", 0, "Only list items of TAG"},
+	{"limit",     'n', "N",   0, "List at most N items (default is 20, 0 for all)"},
+	{"print",     'p', 0,     0, "Print the items instead of listing them"},
+	{ 0 }
+};
+
+static void addTerm(const char* word, size_t len, void* data) {
+	struct __searchQuery* q = data;
+	char** terms = realloc(q->terms, (q->nterms + 1) * sizeof(char *));
+	if (terms == NULL)
+		return;
+	q->terms = terms;
+	q->terms[q->nterms] = strndup(word, len);
+	q->nterms++;
+}
+
+static error_t parseSearch(int key, char* arg, struct argp_state *state) {
+	struct __searchQuery* q = state->input;
+	
+	switch (key) {
+		case 'd':
+			q->directory = arg;
+			break;
+		case 't':
+			q->tag = arg;
+			break;
+		case 'n':
+			q->limit = atol(arg);
+			break;
+		case 'p':
+			q->print = 1;
+			break;
+		case ARGP_KEY_ARG:
+			//Words are split and lowercased the way items are
+			searchWords(arg, strlen(arg), addTerm, q);
+			break;
+		case ARGP_KEY_END:
+			if (q->nterms == 0)
+				argp_error(state, "no words to search for");
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+static struct argp searchArgp = {searchOptions, parseSearch, "WORDS...", searchDoc};
+
+//Print the item id of the tag with item file path
+static void printItem(const char* path, rssm_itemid id) {
+	size_t count;
+	rssm_indexrec* recs = indexMap(path, &count);
+	if (recs == NULL)
+		return;
+	
+	size_t i;
+	for (i = count; i > 0; i--) {
+		const rssm_indexrec* r = &recs[i - 1];
+		if (r->hi != id.hi || r->lo != id.lo)
+			continue;
+		
+		FILE* items = fopen(path, "r");
+		char* buf = malloc(r->len);
+		if (items != NULL && buf != NULL && fseek(items, r->off, SEEK_SET) == 0 && fread(buf, 1, r->len, items) == r->len)
+			fwrite(buf, 1, r->len, stdout);
+		free(buf);
+		if (items != NULL)
+			fclose(items);
+		break;
+	}
+	
+	unmapFile((char *)recs, count * sizeof(rssm_indexrec));
+}
+
+int searchMain(int argc, char** argv) {
+	struct __searchQuery q;
+	memset(&q, 0, sizeof(q));
+	q.limit = 20;
+	
+	argv[0] = "rssm search";
+	argp_parse(&searchArgp, argc, argv, 0, 0, &q);
+	
+	char* dir = queryDir(q.directory);
+	int ret = 2;
+	size_t i;
+	struct __manifest m;
+	if (readManifest(dir, &m) < 0)
+		goto done;
+	
+	//Documents only know the hash of their tag
+	rssm_keyset tags;
+	memset(&tags, 0, sizeof(rssm_keyset));
+	for (i = 0; i < m.count; i++)
+		keysetPut(&tags, keyHash(m.tags[i], strlen(m.tags[i])), i);
+	uint64_t only = q.tag != NULL ? keyHash(q.tag, strlen(q.tag)) : 0;
+	
+	uint32_t* docs = NULL;
+	size_t ndocs = 0;
+	long found = searchFind(dir, q.terms, q.nterms, &docs);
+	rssm_searchdoc* table = searchDocs(dir, &ndocs);
+	if (found < 0 || table == NULL) {
+		fprintf(stderr, "Error! %s has no search index, run rssm with -S to build it\n", dir);
+		free(docs);
+		keysetFree(&tags);
+		freeManifest(&m);
+		goto done;
+	}
+	
+	long listed = 0;
+	long k;
+	for (k = found - 1; k >= 0 && (q.limit == 0 || listed < q.limit); k--) {
+		if (docs[k] >= ndocs)
+			continue;
+		const rssm_searchdoc* d = &table[docs[k]];
+		uint64_t idx;
+		if ((only != 0 && d->tag != only) || !keysetGet(&tags, d->tag, &idx))
+			continue;
+		listed++;
+		
+		rssm_itemid id = {d->hi, d->lo};
+		if (q.print) {
+			printItem(m.paths[idx], id);
+		} else {
+			char hex[IDENTITY_HEX + 1];
+			identityFormat(id, hex);
+			printf("%s\t%s\n", m.tags[idx], hex);
+		}
+	}
+	ret = listed > 0 ? 0 : 1;
+	
+	unmapFile((char *)table, ndocs * sizeof(rssm_searchdoc));
+	free(docs);
+	keysetFree(&tags);
+	freeManifest(&m);
+	
+done:
+	for (i = 0; i < q.nterms; i++)
+		free(q.terms[i]);
+	free(q.terms);
+	free(dir);
+	return ret;
+}
@@ -4,13 +4,26 @@
 #include <signal.h>
 #include <fcntl.h>
 #include <string.h>
+#include <strings.h>
 #include <sys/stat.h>
+#include <pthread.h>
 
 #include <curl/curl.h>
 #include <libxml/parser.h>
 #include <libxml/tree.h>
+#include <libxml/parserInternals.h>
 
 #include "rssmio.h"
+#include "arena.h"
+#include "identity.h"
+#include "itemfile.h"
+#include "cold.h"
+#include "budget.h"
+#include "names.h"
+#include "index.h"
+
+//Everything allocated while handling one fetch, reset once the feed is written
+static __thread rssm_arena fetchArena;
 
 //Prints the current time to p, no newline
 int printtime(FILE* p) {
@@ -18,15 +31,12 @@ int printtime(FILE* p) {
 	time_t rawtime;
 	time(&rawtime);
 	
-	//Get string from time
-	char* time = asctime(localtime(&rawtime));
-	
-	//Now we need to remove all \n's from the time
-	int i, j=strlen(time);
-	//Because strlen ignores \0, we can be sure time[i] won't reach a \0
-	for (i=0; i<j; i++)
-		if (time[i] == '\n')
-			time[i] = ' ';
+	//Every thread logs, so the time is formatted into our own buffer rather than asctime's static one
+	//The format is asctime's with the newline as a space
+	struct tm tm;
+	char time[64];
+	if (localtime_r(&rawtime, &tm) == NULL || strftime(time, sizeof(time), "%a %b %e %H:%M:%S %Y ", &tm) == 0)
+		time[0] = '\0';
 	
 	return fprintf(p, "[%s] ", time);
 }
@@ -58,6 +68,70 @@ int makeDir(const char* path, FILE* log, int v) {
 	return mkdir(path, S_IRWXU);
 }
 
+//Path of a tag's item file, creating the shard directories it sits in for the sharded layout
+char* makeFeedPath(const char* dir, const char* tag, int layout, FILE* log, int v) {
+	char* path = malloc(sizeof(char) * (strlen(dir) + strlen(tag) + 8));
+	
+	if (layout != LAYOUT_SHARDED) {
+		sprintf(path, "%s/%s", dir, tag);
+		return path;
+	}
+	
+	//Two levels of 256 directories picked by the tag's hash, mixed so short tags spread out too
+	uint64_t h = keyHash(tag, strlen(tag));
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	sprintf(path, "%s/%02x", dir, (unsigned)(h >> 56));
+	if (makeDir(path, log, v) < 0) {
+		free(path);
+		return NULL;
+	}
+	
+	sprintf(path + strlen(path), "/%02x", (unsigned)((h >> 48) & 0xff));
+	if (makeDir(path, log, v) < 0) {
+		free(path);
+		return NULL;
+	}
+	
+	strcat(path, "/");
+	strcat(path, tag);
+	return path;
+}
+
+//Write the manifest of which file holds each tag, relative to dir
+int writeManifest(const char* dir, rssm_feeditem** feeds, FILE* log) {
+	char path[strlen(dir) + 20];
+	char tmp[strlen(dir) + 24];
+	sprintf(path, "%s/.rssm manifest", dir);
+	sprintf(tmp, "%s.tmp", path);
+	
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL) {
+		printtime(log);
+		fprintf(log, "Error writing the manifest %s .\n", path);
+		return -1;
+	}
+	
+	//Item files shared with other nodes live outside dir and are listed by their full path
+	size_t i, len = strlen(dir);
+	for (i = 0; feeds[i] != NULL; i++) {
+		const char* path = feeds[i]->path;
+		if (strncmp(path, dir, len) == 0 && path[len] == '/')
+			path += len + 1;
+		fprintf(f, "%s\t%s\n", feeds[i]->tag, path);
+	}
+	
+	if (fclose(f) != 0 || rename(tmp, path) != 0) {
+		printtime(log);
+		fprintf(log, "Error writing the manifest %s .\n", path);
+		remove(tmp);
+		return -1;
+	}
+	
+	return 0;
+}
+
 //Ensures a file exists and is not a fifo
 int makeFile(const char* path, FILE* log, int v) {
 	if (v) {
@@ -124,32 +198,173 @@ int makeFile(const char* path, FILE* log, int v) {
 	return 0;
 }
 
-//check if fifo on fd contains the search given
-static int contains(FILE *f, const char* search) {
-	//Make sure we start reading from the start of the file every time
-	fseek(f, SEEK_SET, 0);
-	
-	char line[256];
-	//read through fifo line by line looking for search
-	while (fgets(line, 255, f) != NULL) {
-		size_t i = 0;
-		//Since search can start anywhere, we need to check every char
-		while (line[i] != '\0') {
-			//If the char at i is the same as the first char of search, then we strncmp search with line starting at i
-			//The right side only evaluates when the left side is true
-			if (line[i] == search[0] && strncmp(line+i, search, sizeof(char) * strlen(search)) == 0)
-				return 1;
-			i++;
+int openFeed(rssm_feeditem* feed, const char* dir, int layout, int format, FILE* log, int v) {
+	char* tagPath = makeFeedPath(dir, feed->tag, layout, log, v);
+	if (tagPath == NULL) {
+		printtime(log);
+		fprintf(log, "Error making the directories for %s .\n", feed->tag);
+		return -1;
+	}
+	//The feed keeps its item file path for compaction
+	feed->path = tagPath;
+	
+	if (v) {
+		printtime(log);
+		fprintf(log, "Making %s file\n", tagPath);
+	}
+	if (makeFile(tagPath, log, v) < 0)
+		return -1;
+	
+	feed->out = fopen(tagPath, "a+");
+	if (feed->out == NULL) {
+		printtime(log);
+		fprintf(log, "Error opening fifod for %s .\n", feed->tag);
+		return -1;
+	}
+	
+	char descPath[strlen(tagPath) + 6];
+	strcpy(descPath, tagPath);
+	strcat(descPath, " desc");
+	if (makeFile(descPath, log, v) < 0)
+		return -1;
+	
+	feed->desc = fopen(descPath, "a+");
+	if (feed->desc == NULL) {
+		printtime(log);
+		fprintf(log, "Error opening fifo for tag desc %s .\n", feed->tag);
+		return -1;
+	}
+	
+	if (feed->stream.format < 0)
+		feed->stream.format = format;
+	if (streamOpen(&feed->stream, tagPath) < 0) {
+		printtime(log);
+		fprintf(log, "Error opening the %s stream of %s , its items will only be written as text.\n", feed->stream.format == FORMAT_JSON ? "json" : "binary", feed->tag);
+		streamClose(&feed->stream);
+		feed->stream.format = FORMAT_TEXT;
+	}
+	
+	loadIdentities(feed, log, v);
+	loadDesc(feed, log, v);
+	
+	//An index that doesn't end where the item file does missed writes, rssm query relies on it
+	int stat = indexCheck(feed->path);
+	if (stat < 0) {
+		printtime(log);
+		fprintf(log, "Error indexing %s .\n", feed->path);
+	} else if (stat > 0 && v) {
+		printtime(log);
+		fprintf(log, "Rebuilt the index of %s .\n", feed->path);
+	}
+	
+	return 0;
+}
+
+int reloadFeed(rssm_feeditem* feed, FILE* log, int v) {
+	char descPath[strlen(feed->path) + 6];
+	sprintf(descPath, "%s desc", feed->path);
+	
+	//Compaction on another node may have swapped the files, so they're opened by path again
+	FILE* out  = fopen(feed->path, "a+");
+	FILE* desc = fopen(descPath, "a+");
+	if (out == NULL || desc == NULL) {
+		if (out != NULL)
+			fclose(out);
+		if (desc != NULL)
+			fclose(desc);
+		printtime(log);
+		fprintf(log, "Error opening the files of %s again.\n", feed->tag);
+		return -1;
+	}
+	
+	pthread_mutex_lock(&feed->lock);
+	fclose(feed->out);
+	fclose(feed->desc);
+	feed->out  = out;
+	feed->desc = desc;
+	keysetFree(&feed->ids);
+	keysetFree(&feed->fields);
+	loadIdentities(feed, log, v);
+	loadDesc(feed, log, v);
+	int stat = indexCheck(feed->path);
+	pthread_mutex_unlock(&feed->lock);
+	
+	if (stat < 0) {
+		printtime(log);
+		fprintf(log, "Error indexing %s .\n", feed->path);
+	}
+	return 0;
+}
+
+//Add an item's identity to the feed's identity set
+static int addSpan(const rssm_itemspan* item, void* data) {
+	rssm_feeditem* feed = data;
+	identityAdd(&feed->ids, item->id);
+	return 0;
+}
+
+//Read the identities of every item already in the feed's item file, and those compaction expired
+int loadIdentities(rssm_feeditem* feed, FILE* log, int v) {
+	size_t len;
+	char* buf = mapFile(feed->path, &len);
+	if (buf == NULL) {
+		printtime(log);
+		fprintf(log, "Error reading %s to find its items.\n", feed->path);
+		return -1;
+	}
+	
+	size_t end = itemScan(buf, len, addSpan, feed);
+	unmapFile(buf, len);
+	
+	//A crash in the middle of a write leaves part of an item at the end, the write-ahead log has all of it
+	if (end < len) {
+		printtime(log);
+		fprintf(log, "Dropping %zu bytes of a partly written item from %s .\n", len - end, feed->path);
+		if (truncate(feed->path, end) != 0) {
+			printtime(log);
+			fprintf(log, "Error truncating %s .\n", feed->path);
 		}
 	}
 	
+	//Sealed items are still this feed's
+	if (coldScan(feed->path, addSpan, feed) < 0) {
+		printtime(log);
+		fprintf(log, "Error reading the cold storage of %s .\n", feed->tag);
+	}
+	size_t count = feed->ids.count;
+	
+	char* expiredPath = malloc(strlen(feed->path) + 9);
+	sprintf(expiredPath, "%s expired", feed->path);
+	FILE* expired = fopen(expiredPath, "r");
+	free(expiredPath);
+	
+	if (expired != NULL) {
+		char line[IDENTITY_HEX + 2];
+		rssm_itemid id;
+		while (fgets(line, sizeof(line), expired) != NULL)
+			if (identityParse(line, &id) == 0)
+				identityAdd(&feed->ids, id);
+		fclose(expired);
+	}
+	
+	if (v) {
+		printtime(log);
+		fprintf(log, "%zu items already stored for %s , %zu more expired.\n", count, feed->tag, feed->ids.count - count);
+	}
+	
 	return 0;
 }
 
 //Local struct variable for curlWrite
 struct __curlResp {
 	char* mem;
-	size_t size;
+	size_t size, cap;
+	//what the buffer is charged to, NULL if nothing is counted
+	rssm_budget* budget;
+	rssm_budgetuse* use;
+	int tooBig;
+	//ETag of the response, in fetchArena, NULL without one
+	char* etag;
 };
 
 //Writes data from curl into a string
@@ -157,9 +372,31 @@ size_t curlWrite(void* ptr, size_t size, size_t nmemb, void* userdata) {
 	size_t nbytes = size * nmemb;
 	struct __curlResp *memr = (struct __curlResp *)userdata;
 	
-	memr->mem = realloc(memr->mem, sizeof(char) * memr->size + nbytes + 1);
-	if (memr->mem == NULL) {
-		raise(SIGTERM);
+	//Grow geometrically, the buffer usually stays the last allocation in the arena and grows in place
+	if (memr->size + nbytes + 1 > memr->cap) {
+		size_t cap = memr->cap * 2;
+		if (cap < memr->size + nbytes + 1)
+			cap = memr->size + nbytes + 1;
+		
+		//A response that could never fit the budget is cut off rather than waited for, and one that
+		//does fit doesn't get a buffer bigger than the budget from doubling
+		if (memr->budget != NULL && memr->budget->limit > 0) {
+			if (memr->size + nbytes + 1 > memr->budget->limit) {
+				memr->tooBig = 1;
+				return 0;
+			}
+			if (cap > memr->budget->limit)
+				cap = memr->budget->limit;
+		}
+		
+		memr->mem = arenaRealloc(&fetchArena, memr->mem, sizeof(char) * cap);
+		if (memr->mem == NULL) {
+			raise(SIGTERM);
+			return 0;
+		}
+		if (memr->budget != NULL)
+			budgetCharge(memr->budget, memr->use, BUDGET_FETCH, cap - memr->cap);
+		memr->cap = cap;
 	}
 	
 	memcpy(&(memr->mem[memr->size]), ptr, nbytes);
@@ -169,8 +406,35 @@ size_t curlWrite(void* ptr, size_t size, size_t nmemb, void* userdata) {
 	return nbytes;
 }
 
-//Uses curl to get xml from the url
-static char* getXmlFromCurl(const char* url, FILE* log, int v) {
+//Picks the ETag out of the response headers
+static size_t curlHeader(char* buf, size_t size, size_t nitems, void* userdata) {
+	size_t nbytes = size * nitems;
+	struct __curlResp *memr = (struct __curlResp *)userdata;
+	
+	//Each response of a redirect starts over
+	if (nbytes > 5 && strncmp(buf, "HTTP/", 5) == 0) {
+		memr->etag = NULL;
+	} else if (nbytes > 5 && strncasecmp(buf, "ETag:", 5) == 0) {
+		size_t start = 5, end = nbytes;
+		while (start < end && (buf[start] == ' ' || buf[start] == '\t'))
+			start++;
+		while (end > start && (buf[end-1] == '\r' || buf[end-1] == '\n' || buf[end-1] == ' '))
+			end--;
+		memr->etag = arenaAlloc(&fetchArena, end - start + 1);
+		if (memr->etag != NULL) {
+			memcpy(memr->etag, buf + start, end - start);
+			memr->etag[end - start] = '\0';
+		}
+	}
+	
+	return nbytes;
+}
+
+//Uses curl to get xml from the url, charging the response to b if it isn't NULL
+//With an *etag only the items new since it are asked for (RFC 3229, A-IM: feed)
+//*code is set to the HTTP status, a 304 gives an empty string and a 226 a feed of just the new items
+//*etag is set to the response's ETag in fetchArena, NULL without one
+static char* getXmlFromCurl(const char* url, char** etag, long* code, rssm_budget* b, rssm_budgetuse* u, size_t* size, FILE* log, int v) {
 	if (v) {
 		printtime(log);
 		fprintf(log, "Starting to get xml from %s with curl...\n", url);
@@ -181,83 +445,210 @@ static char* getXmlFromCurl(const char* url, FILE* log, int v) {
 	
 	//Initialize curl
 	
-	struct __curlResp resp = {malloc(sizeof(char)), 0};
+	struct __curlResp resp = {arenaAlloc(&fetchArena, REPLY_SIZE), 0, REPLY_SIZE, b, u, 0, NULL};
+	if (b != NULL)
+		budgetCharge(b, u, BUDGET_FETCH, REPLY_SIZE);
+	
+	//Servers that don't do delta encoding ignore A-IM and answer with the whole feed
+	struct curl_slist* headers = curl_slist_append(NULL, "A-IM: feed");
+	if (headers != NULL && *etag != NULL) {
+		char match[strlen(*etag) + 16];
+		sprintf(match, "If-None-Match: %s", *etag);
+		struct curl_slist* more = curl_slist_append(headers, match);
+		if (more != NULL)
+			headers = more;
+	}
+	
 	curl = curl_easy_init();
 	if (curl) {
 		//set options
 		curl_easy_setopt(curl, CURLOPT_URL, url);
+		//Fetches run on several threads, curl mustn't use signals for its timeouts
+		curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
 		curl_easy_setopt(curl, CURLOPT_BUFFERSIZE, 4096*2);
 		curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, curlWrite);
 		curl_easy_setopt(curl, CURLOPT_WRITEDATA, (void *)&resp);
+		curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, curlHeader);
+		curl_easy_setopt(curl, CURLOPT_HEADERDATA, (void *)&resp);
+		if (headers != NULL)
+			curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
 		
 		//get the data
 		res = curl_easy_perform(curl);
-		if (res != CURLE_OK) {
+		if (res != CURLE_OK && resp.tooBig) {
+			printtime(log);
+			fprintf(log, "Response from %s is bigger than the memory budget, skipping it.\n", url);
+			curl_easy_cleanup(curl);
+			curl_slist_free_all(headers);
+			return NULL;
+		} else if (res != CURLE_OK) {
 			printtime(log);
 			fprintf(log, "Curl error on url %s : %s\n", url, curl_easy_strerror(res));
 			curl_easy_cleanup(curl);
+			curl_slist_free_all(headers);
 			return NULL;
 		}
 	} else {
 		printtime(log);
 		fprintf(log, "Error initializing curl for url %s !\n", url);
+		curl_slist_free_all(headers);
 		return NULL;
 	}
+	*code = 0;
+	curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, code);
 	curl_easy_cleanup(curl);
+	curl_slist_free_all(headers);
 	
+	*etag = resp.etag;
+	*size = resp.size;
 	return resp.mem;
 }
 
 //helper functions to get atom or rss
-static int getAtom(const xmlNode *xmlRoot, const rssm_feeditem* feed, FILE* log, int v);
-static int getRss(const xmlNode *xmlRoot, const rssm_feeditem* feed, FILE* log, int v);
+//delta is set for a document holding only the items new since the last fetch, which may have none
+//fetched is the unix time the document was read at, written as the fetched: line of its new items
+static int getAtom(const xmlNode *xmlRoot, rssm_feeditem* feed, int delta, long fetched, FILE* log, int v);
+static int getRss(const xmlNode *xmlRoot, rssm_feeditem* feed, int delta, long fetched, FILE* log, int v);
 
-//This does the work of getting all the new rss stuff
-void  getNewRss(const rssm_feeditem* feed, FILE* log, int v) {
-	//Use libcurl to get the string
-	char* xmlStr = getXmlFromCurl(feed->url, log, v);
-	if (xmlStr == NULL) {
-		return;
-	}
+//Parse a feed document in buf and write its new items, with fetchArena bound
+//fetched 0 is the time the feed is held for writing, so a feed's items go to its file in fetched order
+//returns the number of new items, -1 if it isn't rss or atom
+static int readFeed(rssm_feeditem* feed, const char* buf, size_t size, int delta, long fetched, rssm_budget* b, rssm_budgetuse* use, FILE* log, int v) {
+	int ret = -1;
+	
+	//Parses wait until their tree fits next to everything else
+	if (b != NULL)
+		budgetParse(b, use, size * PARSE_FACTOR);
 	
 	//It's time to (finally) parse the xml!
 	xmlDoc *xmlDoc   = NULL;
 	xmlNode *xmlRoot = NULL;
-	LIBXML_TEST_VERSION
+	size_t before    = fetchArena.used;
 	
-	if ((xmlDoc = xmlReadMemory(xmlStr, sizeof(char) * (strlen(xmlStr) + 1), NULL, "utf-8", 0)) == NULL) {
+	if ((xmlDoc = namesParse(buf, sizeof(char) * (strlen(buf) + 1))) == NULL) {
 		printtime(log);
 		fprintf(log, "Error parsing xml recieved from %s .\n", feed->url);
-		free(xmlStr);
-		return;
+	} else {
+		xmlRoot = xmlDocGetRootElement(xmlDoc);
+		
+		//Everything the parse added to the arena is the tree
+		if (b != NULL && fetchArena.used > before)
+			budgetCharge(b, use, BUDGET_PARSE, fetchArena.used - before);
+		
+		if (xmlRoot == NULL || (xmlRoot->name != names[NAME_RSS] && xmlRoot->name != names[NAME_FEED])) {
+			printtime(log);
+			fprintf(log, "No rss or atom found at %s .\n", feed->url);
+		} else {
+			//Compaction swaps the item file out from under us, hold the feed while writing
+			pthread_mutex_lock(&feed->lock);
+			if (fetched == 0)
+				fetched = time(NULL);
+			if (xmlRoot->name == names[NAME_RSS])
+				ret = getRss(xmlRoot, feed, delta, fetched, log, v);
+			else
+				ret = getAtom(xmlRoot, feed, delta, fetched, log, v);
+			pthread_mutex_unlock(&feed->lock);
+		}
+		
+		xmlFreeDoc(xmlDoc);
 	}
 	
-	xmlRoot = xmlDocGetRootElement(xmlDoc);
+	fflush(log);
 	
-	if (strcmp((char *)xmlRoot->name, "rss") != 0 && strcmp((char *)xmlRoot->name, "feed") != 0) {
-		printtime(log);
-		fprintf(log, "No rss or atom found at %s .\n", feed->url);
-		free(xmlStr);
-		xmlFreeDoc(xmlDoc);
-		return;
-	}
+	//libxml2 keeps the last error message around, drop it before its memory goes away
+	xmlResetLastError();
+	
+	return ret;
+}
+
+//This does the work of getting all the new rss stuff
+int getNewRss(rssm_feeditem* feed, FILE* log, int v) {
+	int ret = -1;
+	
+	//New transfers wait until a response the size of the last one fits
+	rssm_budget* b = feed->budget;
+	rssm_budgetuse use;
+	if (b != NULL)
+		budgetEnter(b, &use, feed->lastSize > 0 ? feed->lastSize : REPLY_SIZE);
 	
-	if (strcmp((char *)xmlRoot->name, "rss") == 0) {
-		getRss(xmlRoot, feed, log, v);
-	} else if (strcmp((char *)xmlRoot->name, "feed") == 0) {
-		getAtom(xmlRoot, feed, log, v);
+	//The response, libxml2's tree and all the formatting temporaries live in fetchArena
+	arenaXmlBind(&fetchArena);
+	
+	//Use libcurl to get the string
+	size_t size = 0;
+	long code   = 0;
+	char* etag  = feed->etag;
+	char* xmlStr = getXmlFromCurl(feed->url, &etag, &code, b, &use, &size, log, v);
+	if (xmlStr != NULL && code == 304) {
+		if (v) {
+			printtime(log);
+			fprintf(log, "%s hasn't changed since it was last fetched.\n", feed->tag);
+		}
+		ret = 0;
+	} else if (xmlStr != NULL) {
+		//A 226 IM Used response is a feed document with only the new items, read like any other
+		if (v && code == 226) {
+			printtime(log);
+			fprintf(log, "Got only the new items of %s (%zu bytes).\n", feed->tag, size);
+		}
+		feed->lastSize = size;
+		//The body is kept before it's read, so one that fails to parse can be read again once that's fixed
+		if (feed->archive != NULL && code >= 200 && code < 300 && archiveStore(feed->archive, feed->tag, code, xmlStr, size) < 0) {
+			printtime(log);
+			fprintf(log, "Error archiving the response from %s .\n", feed->url);
+		}
+		ret = readFeed(feed, xmlStr, size, code == 226, 0, b, &use, log, v);
+		
+		//The validator only moves on once its items are written, or the next delta would skip some
+		if (ret >= 0) {
+			free(feed->etag);
+			feed->etag = etag != NULL ? strdup(etag) : NULL;
+		}
 	}
 	
+	arenaXmlBind(NULL);
+	arenaReset(&fetchArena);
+	if (b != NULL)
+		budgetLeave(b, &use);
 	
-	fflush(log);
+	return ret;
+}
+
+int pushRss(rssm_feeditem* feed, const char* buf, size_t len, FILE* log, int v) {
+	if (feed->archive != NULL && archiveStore(feed->archive, feed->tag, ARCHIVE_PUSH, buf, len) < 0) {
+		printtime(log);
+		fprintf(log, "Error archiving the document pushed to %s .\n", feed->tag);
+	}
+	return replayRss(feed, buf, len, 1, 0, log, v);
+}
+
+int replayRss(rssm_feeditem* feed, const char* buf, size_t len, int delta, long fetched, FILE* log, int v) {
+	rssm_budget* b = feed->budget;
+	rssm_budgetuse use;
+	if (b != NULL) {
+		budgetEnter(b, &use, len);
+		budgetCharge(b, &use, BUDGET_FETCH, len);
+	}
 	
-	free(xmlStr);
-	xmlFreeDoc(xmlDoc);
+	arenaXmlBind(&fetchArena);
+	int ret = readFeed(feed, buf, len, delta, fetched, b, &use, log, v);
+	arenaXmlBind(NULL);
+	arenaReset(&fetchArena);
+	if (b != NULL)
+		budgetLeave(b, &use);
+	
+	return ret;
+}
+
+//Give back the calling thread's fetch arena
+void rssmioThreadDone(void) {
+	arenaFree(&fetchArena);
 }
 
 //Return the char without new line characters
+//The string is allocated in fetchArena
 static char* noNewLines (const char* str) {
-	char* ret = malloc(strlen(str) + 1);
+	char* ret = arenaAlloc(&fetchArena, strlen(str) + 1);
 	memset(ret, 0, strlen(str)+1);
 	
 	size_t i;
@@ -268,7 +659,6 @@ static char* noNewLines (const char* str) {
 				ret[j++] = str[i];
 	}
 	
-	printf("::%s:\n", ret);
 	return ret;
 }
 
@@ -282,14 +672,11 @@ static void printChildren(const xmlNode* root, FILE* f) {
 			case XML_TEXT_NODE:
 				if (strcmp((char *)n->content, "") != 0 && strcmp((char *)n->content, "\n") != 0) {
 					char* tmp = noNewLines((char *)n->content);
-					if (strcmp(tmp, " ") == 0) {
-						free(tmp);
+					if (strcmp(tmp, " ") == 0)
 						break;
-					}
 					
 					fprintf(f, "%s\n", tmp);
 					fflush(f);
-					free(tmp);
 				}
 				break;
 			case XML_ELEMENT_NODE:
@@ -302,23 +689,20 @@ static void printChildren(const xmlNode* root, FILE* f) {
 				} else {
 					fprintf(f, "%s: ", (char *)n->name);
 					
-					if (strcmp((char *)n->name, "link") == 0) {
+					if (n->name == names[NAME_LINK]) {
 						xmlAttr* attr;
 						char* tmp = NULL;
 						
 						for (attr = n->properties; attr != NULL; attr = attr->next) {
 							if (attr->children == NULL || strcmp((char *)attr->children->content, "") == 0 || strcmp((char *)attr->children->content, "\n") == 0)
 								continue;
-							if (strcmp((char *)attr->name, "href") == 0) {
+							if (attr->name == names[NAME_HREF]) {
 								tmp = noNewLines((char *)attr->children->content);
-								if (strcmp(tmp, " ") == 0) {
-									free(tmp);
+								if (strcmp(tmp, " ") == 0)
 									continue;
-								}
 								
 								fprintf(f, " %s\n", tmp);
 								fflush(f);
-								free(tmp);
 								break;
 							}
 						}
@@ -331,16 +715,13 @@ static void printChildren(const xmlNode* root, FILE* f) {
 								continue;
 							
 							tmp = noNewLines((char *)attr->children->content);
-							if (strcmp(tmp, " ") == 0) {
-								free(tmp);
+							if (strcmp(tmp, " ") == 0)
 								continue;
-							}
 							
 							fprintf(f, "%s=%s ", (char *)attr->name, tmp);
 						}
 						fprintf(f, "\n");
 						fflush(f);
-						free(tmp);
 					}
 				}
 				break;
@@ -350,7 +731,379 @@ static void printChildren(const xmlNode* root, FILE* f) {
 	}
 }
 
-static int getAtom(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log, int v) {
+//Fields of an item for its stream, in fetchArena
+struct __fieldList {
+	rssm_field* fields;
+	size_t count, cap;
+};
+
+static void addField(struct __fieldList* l, const char* name, const char* value, size_t len) {
+	if (l->count == l->cap) {
+		size_t cap = l->cap > 0 ? l->cap * 2 : 16;
+		rssm_field* fields = arenaRealloc(&fetchArena, l->fields, sizeof(rssm_field) * cap);
+		if (fields == NULL)
+			return;
+		l->fields = fields;
+		l->cap    = cap;
+	}
+	
+	l->fields[l->count].name  = name;
+	l->fields[l->count].value = value;
+	l->fields[l->count].len   = len;
+	l->count++;
+}
+
+//Add the fields of an item element, unlike printChildren nothing is flattened into one line:
+//nested elements are parent.child, repeated ones numbered like desc fields (category.2),
+//attributes are name@attr and values keep their inner new lines
+static void streamFields(struct __fieldList* l, const xmlNode* elem, const char* prefix) {
+	if (elem->ns != NULL && elem->ns->prefix != NULL && strcmp((char *)elem->ns->prefix, "media") == 0)
+		return;
+	
+	const xmlNode* n;
+	int nth = 1;
+	for (n = elem->prev; n != NULL; n = n->prev)
+		if (n->type == XML_ELEMENT_NODE && n->name == elem->name)
+			nth++;
+	
+	char* name = arenaAlloc(&fetchArena, (prefix != NULL ? strlen(prefix) + 1 : 0) + strlen((char *)elem->name) + 12);
+	sprintf(name, "%s%s%s", prefix != NULL ? prefix : "", prefix != NULL ? "." : "", (char *)elem->name);
+	if (nth > 1)
+		sprintf(name + strlen(name), ".%d", nth);
+	
+	xmlAttr* attr;
+	for (attr = elem->properties; attr != NULL; attr = attr->next) {
+		if (attr->children == NULL || attr->children->content == NULL)
+			continue;
+		char* attrName = arenaAlloc(&fetchArena, strlen(name) + strlen((char *)attr->name) + 2);
+		sprintf(attrName, "%s@%s", name, (char *)attr->name);
+		char* value = (char *)attr->children->content;
+		addField(l, attrName, value, strlen(value));
+	}
+	
+	for (n = elem->children; n != NULL; n = n->next)
+		if (n->type == XML_ELEMENT_NODE)
+			break;
+	if (n != NULL) {
+		for (; n != NULL; n = n->next)
+			if (n->type == XML_ELEMENT_NODE)
+				streamFields(l, n, name);
+		return;
+	}
+	
+	//Only the whitespace around the value goes
+	char* content = (char *)xmlNodeGetContent(elem);
+	if (content == NULL)
+		return;
+	char* start = content;
+	while (*start == ' ' || *start == '\n' || *start == '\t' || *start == '\r')
+		start++;
+	size_t len = strlen(start);
+	while (len > 0 && (start[len-1] == ' ' || start[len-1] == '\n' || start[len-1] == '\t' || start[len-1] == '\r'))
+		len--;
+	if (len > 0) {
+		char* value = arenaAlloc(&fetchArena, len);
+		memcpy(value, start, len);
+		addField(l, name, value, len);
+	}
+	xmlFree(content);
+}
+
+//Write item to the feed's stream, if it has one
+static void streamItem(rssm_feeditem* feed, const xmlNode* item, long fetched, const char* hex, FILE* log) {
+	if (feed->stream.fd < 0)
+		return;
+	
+	struct __fieldList l = {NULL, 0, 0};
+	char* when = arenaAlloc(&fetchArena, 24);
+	sprintf(when, "%ld", fetched);
+	addField(&l, "fetched", when, strlen(when));
+	addField(&l, "identity", hex, strlen(hex));
+	
+	const xmlNode* n;
+	for (n = item->children; n != NULL; n = n->next)
+		if (n->type == XML_ELEMENT_NODE)
+			streamFields(&l, n, NULL);
+	
+	if (streamWrite(&feed->stream, l.fields, l.count) < 0) {
+		printtime(log);
+		fprintf(log, "Error writing an item of %s to %s .\n", feed->tag, feed->stream.path);
+	}
+}
+
+//Queue the enclosures of a new item: <enclosure url>, <link rel="enclosure" href> and media:content,
+//which printChildren leaves out, also inside a media:group
+static void queueEnclosures(rssm_feeditem* feed, const xmlNode* item, const char* hex) {
+	const xmlNode* n;
+	for (n = item->children; n != NULL; n = n->next) {
+		if (n->type != XML_ELEMENT_NODE)
+			continue;
+		
+		int media = n->ns != NULL && n->ns->prefix != NULL && strcmp((char *)n->ns->prefix, "media") == 0;
+		if (media && n->name == names[NAME_GROUP]) {
+			queueEnclosures(feed, n, hex);
+			continue;
+		}
+		
+		xmlChar* url = NULL;
+		if (n->name == names[NAME_ENCLOSURE] || (media && n->name == names[NAME_CONTENT])) {
+			url = xmlGetProp(n, names[NAME_URL]);
+		} else if (n->name == names[NAME_LINK]) {
+			xmlChar* rel = xmlGetProp(n, names[NAME_REL]);
+			if (rel != NULL && strcmp((char *)rel, "enclosure") == 0)
+				url = xmlGetProp(n, names[NAME_HREF]);
+			xmlFree(rel);
+		}
+		
+		if (url != NULL && *url != '\0')
+			enclosureQueue(feed->enclosures, feed->tag, hex, noNewLines((char *)url));
+		xmlFree(url);
+	}
+}
+
+//Check a new item against the items other feeds wrote
+//returns 1 if the item was handled as a cross-feed duplicate and shouldn't be written, 0 otherwise
+static int crossSeen(rssm_feeditem* feed, FILE* out, const char* link, const char* id, long fetched, FILE* log, int v) {
+	if (feed->seen == NULL || link == NULL)
+		return 0;
+	
+	//Aggregators decorate links with their own tracking, so the normalized link is compared
+	char* norm = arenaAlloc(&fetchArena, strlen(link) + 1);
+	normalizeLink(link, norm);
+	uint64_t key = keyHash(norm, strlen(norm));
+	const char* origin = NULL;
+	
+	//Feeds are fetched in parallel, the check and the add have to happen together
+	pthread_mutex_lock(&feed->seen->lock);
+	if (!seenCheck(feed->seen, key, &origin) || strcmp(origin, feed->tag) == 0) {
+		if (seenAdd(feed->seen, key, feed->tag) < 0) {
+			printtime(log);
+			fprintf(log, "Error adding %s to the seen set.\n", link);
+		}
+		pthread_mutex_unlock(&feed->seen->lock);
+		return 0;
+	}
+	pthread_mutex_unlock(&feed->seen->lock);
+	
+	if (v) {
+		printtime(log);
+		fprintf(log, "%s was already written by %s .\n", link, origin);
+	}
+	
+	//A reference record keeps the link line so this feed's own dedup still sees it
+	if (feed->seen->mode == SEEN_REF)
+		fprintf(out, "link: %s\nduplicate: %s\nfetched: %ld\nidentity: %s\n" ITEM_SEP, link, origin, fetched, id);
+	
+	return 1;
+}
+
+//Write item unless this feed or, with cross-feed dedup, another feed already has it
+//returns 1 if the item was new
+static int writeItem(rssm_feeditem* feed, const xmlNode* item, const char* link, long fetched, FILE* log, int v) {
+	rssm_itemid id = itemIdentity(item, link);
+	if (identityHas(&feed->ids, id))
+		return 0;
+	
+	if (identityAdd(&feed->ids, id) < 0) {
+		printtime(log);
+		fprintf(log, "Error remembering an item of %s .\n", feed->tag);
+	}
+	
+	char hex[IDENTITY_HEX + 1];
+	identityFormat(id, hex);
+	
+	//The item is rendered whole first so it can go through the write-ahead log
+	char* rec  = NULL;
+	size_t len = 0;
+	FILE* buf  = open_memstream(&rec, &len);
+	if (buf == NULL) {
+		printtime(log);
+		fprintf(log, "Error making room for an item of %s .\n", feed->tag);
+		return 0;
+	}
+	int dup = crossSeen(feed, buf, link, hex, fetched, log, v);
+	if (!dup) {
+		printChildren(item, buf);
+		fprintf(buf, "fetched: %ld\nidentity: %s\n" ITEM_SEP, fetched, hex);
+	}
+	fclose(buf);
+	
+	//Items skipped as another feed's don't count as new
+	if (len == 0) {
+		free(rec);
+		return 0;
+	}
+	
+	if (feed->wal != NULL && walAppend(feed->wal, feed->tag, id, rec, len) < 0) {
+		printtime(log);
+		fprintf(log, "Error logging an item of %s to %s .\n", feed->tag, feed->wal->path);
+	}
+	
+	//The item file is written once for the whole check by writerFlush
+	if (writerQueue(&feed->pending, id, rec, len) < 0) {
+		printtime(log);
+		fprintf(log, "Error queueing an item of %s .\n", feed->tag);
+		free(rec);
+		return 0;
+	}
+	
+	if (feed->budget != NULL)
+		budgetCharge(feed->budget, NULL, BUDGET_WRITE, len);
+	
+	//Indexed along with the write so searches are current as soon as the check is
+	if (feed->search != NULL && searchAdd(feed->search, feed->tag, id, rec, len) < 0) {
+		printtime(log);
+		fprintf(log, "Error adding an item of %s to the search index.\n", feed->tag);
+	}
+	free(rec);
+	
+	//References to another feed's item only go to the item file
+	if (!dup)
+		streamItem(feed, item, fetched, hex, log);
+	if (!dup && feed->enclosures != NULL)
+		queueEnclosures(feed, item, hex);
+	
+	return 1;
+}
+
+//Append "name: value" to the desc file unless it is already the latest value of name
+static void descField(rssm_feeditem* feed, const char* name, const char* value) {
+	uint64_t key = keyHash(name, strlen(name));
+	uint64_t val = keyHash(value, strlen(value));
+	uint64_t old;
+	
+	if (keysetGet(&feed->fields, key, &old) && old == val)
+		return;
+	keysetPut(&feed->fields, key, val);
+	
+	fprintf(feed->desc, "%s: %s\n", name, value);
+}
+
+//The desc name of n: its name, plus its rel for links and the like
+static char* descName(const xmlNode* n, const char* prefix) {
+	xmlChar* rel = xmlGetProp(n, (xmlChar *)"rel");
+	size_t len = strlen((char *)n->name) + (prefix != NULL ? strlen(prefix) + 1 : 0) + (rel != NULL ? xmlStrlen(rel) + 1 : 0) + 1;
+	char* ret = arenaAlloc(&fetchArena, len);
+	
+	sprintf(ret, "%s%s%s%s%s", prefix != NULL ? prefix : "", prefix != NULL ? "." : "", (char *)n->name,
+	        rel != NULL ? "." : "", rel != NULL ? (char *)rel : "");
+	xmlFree(rel);
+	
+	return ret;
+}
+
+//Write a channel element to the desc file, nested elements become prefix.name fields
+static void descElement(rssm_feeditem* feed, const xmlNode* elem, const char* prefix) {
+	if (elem->ns != NULL && elem->ns->prefix != NULL && strcmp((char *)elem->ns->prefix, "media") == 0)
+		return;
+	
+	char* name = descName(elem, prefix);
+	
+	//Repeated siblings get numbered so each keeps its own latest value
+	const xmlNode* n;
+	int nth = 1;
+	for (n = elem->prev; n != NULL; n = n->prev)
+		if (n->type == XML_ELEMENT_NODE && n->name == elem->name && strcmp(descName(n, prefix), name) == 0)
+			nth++;
+	if (nth > 1) {
+		char* numbered = arenaAlloc(&fetchArena, strlen(name) + 12);
+		sprintf(numbered, "%s.%d", name, nth);
+		name = numbered;
+	}
+	
+	for (n = elem->children; n != NULL; n = n->next)
+		if (n->type == XML_ELEMENT_NODE)
+			break;
+	
+	if (n != NULL) {
+		for (; n != NULL; n = n->next)
+			if (n->type == XML_ELEMENT_NODE)
+				descElement(feed, n, name);
+		return;
+	}
+	
+	char* content = (char *)xmlNodeGetContent(elem);
+	char* value = arenaAlloc(&fetchArena, (content != NULL ? strlen(content) : 0) + 1);
+	cleanValue(content != NULL ? content : "", value);
+	xmlFree(content);
+	
+	//Empty elements are described by their attributes
+	if (*value == '\0') {
+		xmlAttr* attr;
+		for (attr = elem->properties; attr != NULL; attr = attr->next) {
+			if (attr->children == NULL || attr->children->content == NULL || attr->name == names[NAME_REL])
+				continue;
+			
+			char* attrVal = arenaAlloc(&fetchArena, strlen((char *)attr->children->content) + 1);
+			cleanValue((char *)attr->children->content, attrVal);
+			if (*attrVal == '\0')
+				continue;
+			
+			char* joined = arenaAlloc(&fetchArena, strlen(value) + strlen((char *)attr->name) + strlen(attrVal) + 3);
+			sprintf(joined, "%s%s%s=%s", value, *value != '\0' ? " " : "", (char *)attr->name, attrVal);
+			value = joined;
+		}
+	}
+	
+	if (*value != '\0')
+		descField(feed, name, value);
+}
+
+//Remember the latest value of every field in the feed's desc file
+int loadDesc(rssm_feeditem* feed, FILE* log, int v) {
+	char* line = NULL;
+	size_t cap = 0, count = 0;
+	ssize_t len;
+	
+	rewind(feed->desc);
+	while ((len = getline(&line, &cap, feed->desc)) > 0) {
+		if (line[len-1] == '\n')
+			line[--len] = '\0';
+		
+		char* sep = strstr(line, ": ");
+		if (sep == NULL)
+			continue;
+		
+		//Later lines overwrite earlier ones, so the bottom most value wins
+		*sep = '\0';
+		if (keysetPut(&feed->fields, keyHash(line, sep - line), keyHash(sep + 2, strlen(sep + 2))) < 0) {
+			printtime(log);
+			fprintf(log, "Error remembering desc fields of %s .\n", feed->tag);
+			break;
+		}
+		count++;
+	}
+	free(line);
+	
+	if (v) {
+		printtime(log);
+		fprintf(log, "%zu desc lines already stored for %s .\n", count, feed->tag);
+	}
+	
+	return 0;
+}
+
+//Remember the href of a <link rel="hub"> or rel="self" among the channel's elements, in fetchArena
+static void hubLink(const xmlNode* elem, char** hub, char** self) {
+	if (elem->name != names[NAME_LINK])
+		return;
+	
+	char* rel  = (char *)xmlGetProp(elem, names[NAME_REL]);
+	char* href = (char *)xmlGetProp(elem, names[NAME_HREF]);
+	if (rel != NULL && href != NULL && *href != '\0') {
+		if (strcmp(rel, "hub") == 0 && *hub == NULL)
+			*hub = noNewLines(href);
+		else if (strcmp(rel, "self") == 0 && *self == NULL)
+			*self = noNewLines(href);
+	}
+	xmlFree(rel);
+	xmlFree(href);
+}
+
+//Returns the number of new entries, -1 if the feed is empty
+static int getAtom(const xmlNode* xmlRoot, rssm_feeditem* feed, int delta, long fetched, FILE* log, int v) {
+	int count = 0;
+	
 	if (v) {
 		printtime(log);
 		fprintf(log, "atom found in xml on %s !\n", feed->url);
@@ -359,6 +1112,8 @@ static int getAtom(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 	xmlNode* entry;
 	for (entry = xmlRoot->children; entry != NULL && entry->type == XML_TEXT_NODE; entry = entry->next);
 	
+	if (entry == NULL && delta)
+		return 0;
 	if (entry == NULL) {
 		printtime(log);
 		fprintf(log, "Xml at %s is empty!\n", feed->url);
@@ -370,11 +1125,17 @@ static int getAtom(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 		fprintf(log, "Getting description data...\n");
 	}
 	
-	for (; entry != NULL && strcmp((char *)entry->name, "entry") != 0; entry = entry->next) {
-		if (entry->type == XML_TEXT_NODE)
+	char* hub  = NULL;
+	char* self = NULL;
+	for (; entry != NULL && entry->name != names[NAME_ENTRY]; entry = entry->next) {
+		if (entry->type != XML_ELEMENT_NODE)
 			continue;
-		printChildren(entry, feed->desc);
+		descElement(feed, entry, NULL);
+		hubLink(entry, &hub, &self);
 	}
+	fflush(feed->desc);
+	if (feed->websub != NULL && hub != NULL)
+		websubDiscover(feed->websub, feed, hub, self != NULL ? self : feed->url);
 	
 	if (v) {
 		printtime(log);
@@ -384,31 +1145,27 @@ static int getAtom(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 	}
 	
 	for (entry = xmlRoot->last; entry != NULL; entry = entry->prev) {
-		if (strcmp((char *)entry->name, "entry") == 0) {
+		if (entry->type == XML_ELEMENT_NODE && entry->name == names[NAME_ENTRY]) {
 			xmlNode* atomElem; 
+			char* link = NULL;
 			
-			for (atomElem = entry->children; atomElem != NULL && strcmp((char *)atomElem->name, "link") != 0; atomElem = atomElem->next);
-			
-			if (atomElem == NULL || atomElem->properties == NULL)
-				continue;
-			
-			xmlAttr* attr;
-			for (attr = atomElem->properties; attr != NULL && strcmp((char *)attr->name, "href") != 0; attr = attr->next);
-			
-			if (attr == NULL || attr->children == NULL || strcmp((char *)attr->children->content, "") == 0 || strcmp((char *)attr->children->content, "\n") == 0)
-				continue;
-			
-			char* link = noNewLines((char *)attr->children->content);
-			char search[strlen(link) + 8];
-			sprintf(search, "link: %s\n", link);
-			free(link);
-			
-			if (contains(feed->out, search))
-				continue;
+			//The first alternate link is the entry's link
+			for (atomElem = entry->children; atomElem != NULL; atomElem = atomElem->next) {
+				if (atomElem->type != XML_ELEMENT_NODE || atomElem->name != names[NAME_LINK])
+					continue;
+				
+				xmlChar* rel  = xmlGetProp(atomElem, (xmlChar *)"rel");
+				xmlChar* href = xmlGetProp(atomElem, (xmlChar *)"href");
+				if (href != NULL && *href != '\0' && (rel == NULL || strcmp((char *)rel, "alternate") == 0))
+					link = noNewLines((char *)href);
+				xmlFree(rel);
+				xmlFree(href);
+				
+				if (link != NULL)
+					break;
+			}
 			
-			printChildren(entry, feed->out);
-			fprintf(feed->out, "ITEMS\n");
-			fflush(feed->out);
+			count += writeItem(feed, entry, link, fetched, log, v);
 		}
 	}
 	
@@ -417,10 +1174,13 @@ static int getAtom(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 		fprintf(log, "Done getting new items.\n");
 	}
 	
-	return 0;
+	return count;
 }
 
-static int getRss(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log, int v) {
+//Returns the number of new items, -1 if there is no channel
+static int getRss(const xmlNode* xmlRoot, rssm_feeditem* feed, int delta, long fetched, FILE* log, int v) {
+	int count = 0;
+	
 	if (v) {
 		printtime(log);
 		fprintf(log, "rss found in xml on %s !\n", feed->url);
@@ -434,15 +1194,15 @@ static int getRss(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 	//Write the description of the rss channel to the desc fifo
 	xmlNode *channel;
 	xmlNode *channelElem = NULL;
-	for (channel = xmlRoot->children; channel != NULL && strcmp((char *)channel->name, "text") == 0; channel = channel->next);
+	for (channel = xmlRoot->children; channel != NULL && channel->name == xmlStringText; channel = channel->next);
 	
-	if (channel == NULL || strcmp((char *)channel->name, "channel") != 0) {
+	if (channel == NULL || channel->name != names[NAME_CHANNEL]) {
 		if (v) {
 			printtime(log);
 			fprintf(log, "No rss channel was found at url %s .\n", feed->url);
 		}
 		
-		fprintf(feed->desc, "No data found about rss channel.\n");
+		descField(feed, "error", "No data found about rss channel.");
 		fflush(feed->desc);
 		
 		return -1;
@@ -454,6 +1214,8 @@ static int getRss(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 	}
 	channelElem = channel->children;
 	
+	if (channelElem == NULL && delta)
+		return 0;
 	if (channelElem == NULL) {
 		printtime(log);
 		fprintf(log, "Error going through rss channel %s .\n", feed->tag);
@@ -467,28 +1229,17 @@ static int getRss(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 		fprintf(log, "Nothing found on rss channel %s .\n", feed->tag);
 	}
 	
-	for (; channelElem != NULL && strcmp((char *)channelElem->name, "item") != 0; channelElem = channelElem->next) {
-		if (channelElem->type == XML_TEXT_NODE)
+	char* hub  = NULL;
+	char* self = NULL;
+	for (; channelElem != NULL && channelElem->name != names[NAME_ITEM]; channelElem = channelElem->next) {
+		if (channelElem->type != XML_ELEMENT_NODE)
 			continue;
-		
-		xmlNode* tmp = channelElem->children;
-		for (tmp = channelElem->children; tmp != NULL; tmp = tmp->next) {
-			if (tmp->type != XML_TEXT_NODE) {
-				printChildren(tmp->parent, feed->desc);
-				fflush(feed->desc);
-				break;
-			}
-		}
-		
-		if (tmp == NULL && channelElem->children != NULL && strcmp((char *)channelElem->children->content, "") != 0 && 
-		   strncmp((char *)channelElem->children->content, "\n", 1) != 0) {
-			char toWrite[strlen((char *)channelElem->name) + strlen((char *)channelElem->children->content) + 4];
-			sprintf(toWrite, "%s: %s\n", (char *)channelElem->name, (char *)channelElem->children->content);
-			if (!contains(feed->desc, toWrite))
-				fprintf(feed->desc, toWrite);
-			fflush(feed->desc);
-		}
+		descElement(feed, channelElem, NULL);
+		hubLink(channelElem, &hub, &self);
 	}
+	fflush(feed->desc);
+	if (feed->websub != NULL && hub != NULL)
+		websubDiscover(feed->websub, feed, hub, self != NULL ? self : feed->url);
 	
 	if (v) {
 		printtime(log);
@@ -502,27 +1253,19 @@ static int getRss(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 		fprintf(log, "Error going through xml for %s .\n", feed->tag);
 	}
 	
-	for (;channelElem != NULL && (strcmp((char *)channelElem->name, "item") == 0 || channelElem->type == XML_TEXT_NODE); channelElem = channelElem->prev) {
+	for (;channelElem != NULL && (channelElem->name == names[NAME_ITEM] || channelElem->type == XML_TEXT_NODE); channelElem = channelElem->prev) {
 		if (channelElem->type == XML_TEXT_NODE)
 			continue;
 		
 		xmlNode* rssElem;
-		for (rssElem = channelElem->children; rssElem != NULL && strcmp((char *)rssElem->name, "link") != 0; rssElem = rssElem->next);
+		for (rssElem = channelElem->children; rssElem != NULL && rssElem->name != names[NAME_LINK]; rssElem = rssElem->next);
 		
-		if (rssElem == NULL || rssElem->children == NULL || rssElem->children->type != XML_TEXT_NODE)
-			continue;
+		//Items without a link are still identified by their guid or content
+		char* link = NULL;
+		if (rssElem != NULL && rssElem->children != NULL && rssElem->children->type == XML_TEXT_NODE)
+			link = noNewLines((char *)rssElem->children->content);
 		
-		char* tmp = noNewLines((char *)rssElem->children->content);
-		char check[strlen(tmp) + 8];
-		sprintf(check, "link: %s\n", tmp);
-		free(tmp);
-		
-		if (contains(feed->out, check))
-			continue;
-		
-		printChildren(channelElem, feed->out);
-		fprintf(feed->out, "ITEMS\n");
-		fflush(feed->out);
+		count += writeItem(feed, channelElem, link, fetched, log, v);
 	}
 	
 	if (v) {
@@ -530,5 +1273,5 @@ static int getRss(const xmlNode* xmlRoot, const rssm_feeditem* feed, FILE* log,
 		fprintf(log, "Done reading rss data for %s .\n", feed->tag);
 	}
 	
-	return 0;
+	return count;
 }
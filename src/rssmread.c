@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "rssmread.h"
+
+//Line ending every item
+#define SEP     "ITEMS\n"
+#define SEP_LEN 6
+
+//Is there an ITEMS line starting at pos
+static int isSep(const char* buf, size_t len, size_t pos) {
+	return pos + SEP_LEN <= len && (pos == 0 || buf[pos - 1] == '\n') && memcmp(buf + pos, SEP, SEP_LEN) == 0;
+}
+
+//Start of the line before the one starting at pos, pos must be past the start of the buffer
+static size_t lineBefore(const char* buf, size_t pos) {
+	const char* nl = pos > 1 ? memrchr(buf, '\n', pos - 1) : NULL;
+	return nl != NULL ? (size_t)(nl - buf) + 1 : 0;
+}
+
+int rssmOpen(rssm_file* f, const char* path) {
+	memset(f, 0, sizeof(rssm_file));
+	
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	
+	struct stat st;
+	if (fstat(fd, &st) != 0) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return -1;
+	}
+	
+	f->len = st.st_size;
+	if (f->len > 0) {
+		void* buf = mmap(NULL, f->len, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (buf == MAP_FAILED) {
+			int err = errno;
+			close(fd);
+			errno = err;
+			return -1;
+		}
+		f->buf = buf;
+		//Old items are read once, newest first
+		madvise(buf, f->len, MADV_RANDOM);
+	}
+	close(fd);
+	
+	//Items end with their ITEMS line, a last item without one is still being written
+	size_t pos = f->len;
+	while (pos > 0) {
+		pos = lineBefore(f->buf, pos);
+		if (isSep(f->buf, f->len, pos)) {
+			f->end = pos + SEP_LEN;
+			break;
+		}
+	}
+	
+	return 0;
+}
+
+void rssmClose(rssm_file* f) {
+	if (f->len > 0)
+		munmap((void *)f->buf, f->len);
+	memset(f, 0, sizeof(rssm_file));
+}
+
+void rssmNewest(const rssm_file* f, rssm_cursor* c) {
+	c->buf = f->buf;
+	c->pos = f->end;
+	c->end = f->end;
+}
+
+int rssmOlder(rssm_cursor* c, rssm_item* item) {
+	if (c->pos == 0)
+		return 0;
+	
+	//pos is just past the item's ITEMS line, its start is just past the ITEMS line before that
+	size_t sep = c->pos - SEP_LEN;
+	size_t start = sep;
+	while (start > 0) {
+		size_t line = lineBefore(c->buf, start);
+		if (isSep(c->buf, c->end, line))
+			break;
+		start = line;
+	}
+	
+	item->buf = c->buf + start;
+	item->len = sep - start;
+	item->off = start;
+	c->pos = start;
+	return 1;
+}
+
+void rssmOldest(const rssm_file* f, rssm_cursor* c) {
+	c->buf = f->buf;
+	c->pos = 0;
+	c->end = f->end;
+}
+
+int rssmNewer(rssm_cursor* c, rssm_item* item) {
+	if (c->pos >= c->end)
+		return 0;
+	
+	size_t pos = c->pos;
+	while (!isSep(c->buf, c->end, pos)) {
+		const char* nl = memchr(c->buf + pos, '\n', c->end - pos);
+		pos = (nl - c->buf) + 1;
+	}
+	
+	item->buf = c->buf + c->pos;
+	item->len = pos - c->pos;
+	item->off = c->pos;
+	c->pos = pos + SEP_LEN;
+	return 1;
+}
+
+void rssmFields(const rssm_item* item, rssm_cursor* c) {
+	c->buf = item->buf;
+	c->pos = 0;
+	c->end = item->len;
+}
+
+int rssmNextField(rssm_cursor* c, rssm_field* field) {
+	while (c->pos < c->end) {
+		const char* line = c->buf + c->pos;
+		const char* nl = memchr(line, '\n', c->end - c->pos);
+		size_t n = nl != NULL ? (size_t)(nl - line) : c->end - c->pos;
+		c->pos += n + 1;
+		
+		//Lines without a name, like the text of an element with children, aren't fields
+		const char* colon = memchr(line, ':', n);
+		if (colon == NULL || (size_t)(colon - line) + 1 >= n || colon[1] != ' ')
+			continue;
+		
+		field->name     = line;
+		field->nameLen  = colon - line;
+		field->value    = colon + 2;
+		field->valueLen = n - field->nameLen - 2;
+		return 1;
+	}
+	return 0;
+}
+
+int rssmGet(const rssm_item* item, const char* name, rssm_field* field) {
+	size_t len = strlen(name);
+	rssm_cursor c;
+	rssmFields(item, &c);
+	
+	while (rssmNextField(&c, field))
+		if (field->nameLen == len && memcmp(field->name, name, len) == 0)
+			return 1;
+	return 0;
+}
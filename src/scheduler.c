@@ -0,0 +1,524 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "scheduler.h"
+#include "rssmio.h"
+#include "keyset.h"
+
+static const char* tierNames[TIERS] = {"critical", "normal", "low"};
+
+//busy is one of these
+#define BUSY_QUEUED  1
+#define BUSY_RUNNING 2
+
+//Wall clock time with fractions of a second, due times are wall clock
+static double wallNow(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_REALTIME, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void pushQueue(rssm_sched* s, struct __tierqueue* q, size_t i) {
+	q->idx[(q->head + q->count) % s->cap] = i;
+	q->count++;
+	s->hot[i].busy = BUSY_QUEUED;
+}
+
+static int popQueue(rssm_sched* s, struct __tierqueue* q, size_t* idx) {
+	if (q->count == 0)
+		return -1;
+	*idx = q->idx[q->head];
+	q->head = (q->head + 1) % s->cap;
+	q->count--;
+	return 0;
+}
+
+//Take feed i out of q wherever it is, returns -1 if it isn't in q
+static int dropQueue(rssm_sched* s, struct __tierqueue* q, size_t i) {
+	size_t k;
+	for (k = 0; k < q->count; k++)
+		if (q->idx[(q->head + k) % s->cap] == i)
+			break;
+	if (k == q->count)
+		return -1;
+	
+	for (; k + 1 < q->count; k++)
+		q->idx[(q->head + k) % s->cap] = q->idx[(q->head + k + 1) % s->cap];
+	q->count--;
+	return 0;
+}
+
+//How often a feed is fetched by its priority, at most SCHED_EVERY_MAX
+static long tierEvery(rssm_sched* s, const rssm_priority* p) {
+	long every = s->normal;
+	if (p->every > 0)
+		every = p->every;
+	else if (p->tier == TIER_CRITICAL)
+		every = CRITICAL_EVERY;
+	else if (p->tier == TIER_LOW)
+		every = s->normal * LOW_CHECKS;
+	return every < SCHED_EVERY_MAX ? every : SCHED_EVERY_MAX;
+}
+
+//Set up the hot record of feed i, due right away
+static void hotInit(rssm_sched* s, size_t i, const rssm_feeditem* feed, time_t now) {
+	struct __hot* h = &s->hot[i];
+	memset(h, 0, sizeof(struct __hot));
+	h->due   = now;
+	h->every = tierEvery(s, &feed->priority);
+	h->tier  = feed->priority.tier;
+	h->hash  = keyHash(feed->tag, strlen(feed->tag));
+	h->shard = leaseShard(h->hash);
+}
+
+//Shards this node fetches, all of them unless feeds are shared with other nodes
+static uint64_t shardsHeld(rssm_sched* s) {
+	return s->leases != NULL ? leaseMask(s->leases) : ~0ULL;
+}
+
+//returns 1 if another node fetches feed i, or is about to
+static int elsewhere(rssm_sched* s, size_t i) {
+	return (s->draining >> s->hot[i].shard & 1) || (s->leases != NULL && !(leaseMask(s->leases) >> s->hot[i].shard & 1));
+}
+
+//Next feed a worker should fetch, asked for ones then the most urgent tier first, with the lock held
+//returns 0 and sets *idx if there is one
+static int takeFeed(rssm_sched* s, int reserved, size_t* idx) {
+	//Paused feeds can still be asked for, removed ones and ones another node took over not
+	while (popQueue(s, &s->urgent, idx) == 0) {
+		if (s->hot[*idx].held != SCHED_REMOVED && elsewhere(s, *idx) == 0)
+			return 0;
+		s->hot[*idx].busy = 0;
+	}
+	
+	int tiers = reserved ? TIER_CRITICAL + 1 : TIERS;
+	int t;
+	for (t = 0; t < tiers; t++) {
+		//Feeds held or whose shard went to another node after they were queued are dropped here
+		while (popQueue(s, &s->queue[t], idx) == 0) {
+			if (!s->hot[*idx].held && elsewhere(s, *idx) == 0)
+				return 0;
+			s->hot[*idx].busy = 0;
+		}
+	}
+	return -1;
+}
+
+static void* schedWorker(void* arg) {
+	rssm_sched* s = arg;
+	
+	pthread_mutex_lock(&s->lock);
+	int reserved = s->reserve > 0;
+	if (reserved)
+		s->reserve--;
+	
+	while (!s->stop) {
+		size_t i;
+		if (s->paused || takeFeed(s, reserved, &i) < 0) {
+			pthread_cond_wait(&s->work, &s->lock);
+			continue;
+		}
+		rssm_feeditem* feed = s->feeds[i];
+		s->running++;
+		s->hot[i].busy = BUSY_RUNNING;
+		time_t due = s->hot[i].due;
+		int stale  = s->hot[i].stale;
+		s->hot[i].stale = 0;
+		pthread_mutex_unlock(&s->lock);
+		
+		//The node that held its shard before wrote to it, what it wrote mustn't come out as new
+		if (stale && reloadFeed(feed, s->log, s->v) < 0) {
+			pthread_mutex_lock(&s->lock);
+			s->hot[i].stale = 1;
+			pthread_mutex_unlock(&s->lock);
+		}
+		
+		if (s->v) {
+			printtime(s->log);
+			fprintf(s->log, "Checking %s rss feed %s for new items...\n", tierNames[s->hot[i].tier], feed->tag);
+		}
+		int items = getNewRss(feed, s->log, s->v);
+		//Lag counts from when the feed was due, however long it sat in the queue
+		double lag = wallNow() - due;
+		
+		//One thread flushes while the others keep fetching
+		if (feed->budget != NULL && budgetWriteFull(feed->budget) && pthread_mutex_trylock(&s->flushLock) == 0) {
+			if (writerFlush(s->writer, s->feeds, s->log) < 0) {
+				printtime(s->log);
+				fprintf(s->log, "Error writing some of the new items.\n");
+			}
+			pthread_mutex_unlock(&s->flushLock);
+		}
+		
+		pthread_mutex_lock(&s->lock);
+		struct __tierstat* st = &s->stats[s->hot[i].tier];
+		st->fetches++;
+		if (items < 0)
+			st->failed++;
+		st->lagSum += lag;
+		if (lag > st->lagMax)
+			st->lagMax = lag;
+		
+		//Keep to the feed's cadence, but don't make up for fetches missed while overloaded
+		//Feeds a hub pushes are only polled as a safety net
+		struct __hot* h = &s->hot[i];
+		long every = h->every;
+		if (feed->websub != NULL && every < s->normal * WEBSUB_CHECKS && websubActive(feed))
+			every = s->normal * WEBSUB_CHECKS;
+		//A feed failing again and again is tried less and less often, until it works
+		if (items < 0 && h->fails < UINT16_MAX)
+			h->fails++;
+		else if (items >= 0)
+			h->fails = 0;
+		long wait = every;
+		int f;
+		for (f = 0; f < h->fails && wait < every * SCHED_BACKOFF; f++)
+			wait *= 2;
+		time_t now = time(NULL);
+		h->due += wait;
+		if (h->due < now)
+			h->due = now;
+		s->last[i]   = now;
+		s->result[i] = items;
+		s->hot[i].busy = 0;
+		//Asked for while it was running, so what was asked for may have been missed
+		if (s->hot[i].again) {
+			s->hot[i].again = 0;
+			pushQueue(s, &s->urgent, i);
+			pthread_cond_broadcast(&s->work);
+		}
+		s->done++;
+		s->running--;
+		//A drain waits for particular feeds rather than for every fetch
+		if (s->running == 0 || s->draining != 0)
+			pthread_cond_broadcast(&s->idle);
+	}
+	pthread_mutex_unlock(&s->lock);
+	
+	rssmioThreadDone();
+	return NULL;
+}
+
+//Free what schedStart allocated, newest first
+static void schedFree(rssm_sched* s) {
+	int t;
+	for (t = TIERS - 1; t >= 0; t--)
+		free(s->queue[t].idx);
+	free(s->urgent.idx);
+	free(s->result);
+	free(s->last);
+	free(s->hot);
+}
+
+int schedStart(rssm_sched* s, rssm_feeditem** feeds, int jobs, int mins, rssm_writer* writer, FILE* log, int v) {
+	memset(s, 0, sizeof(rssm_sched));
+	s->feeds  = feeds;
+	s->writer = writer;
+	s->log    = log;
+	s->v      = v;
+	while (feeds[s->nfeeds] != NULL)
+		s->nfeeds++;
+	if (s->nfeeds == 0)
+		return -1;
+	s->cap = s->nfeeds + SCHED_ADDS;
+	
+	s->hot    = calloc(s->cap, sizeof(struct __hot));
+	s->last   = calloc(s->cap, sizeof(time_t));
+	s->result = calloc(s->cap, sizeof(int));
+	s->urgent.idx = malloc(s->cap * sizeof(size_t));
+	int t;
+	for (t = 0; t < TIERS; t++)
+		s->queue[t].idx = malloc(s->cap * sizeof(size_t));
+	if (s->hot == NULL || s->last == NULL || s->result == NULL || s->urgent.idx == NULL || s->queue[0].idx == NULL || s->queue[1].idx == NULL || s->queue[2].idx == NULL) {
+		schedFree(s);
+		return -1;
+	}
+	
+	s->normal = mins > 0 ? mins * 60L : 300;
+	//Every feed's files were just read, whoever holds which shard
+	s->shards = ~0ULL;
+	time_t now = time(NULL);
+	int critical = 0;
+	size_t i;
+	for (i = 0; i < s->nfeeds; i++) {
+		hotInit(s, i, feeds[i], now);
+		critical |= feeds[i]->priority.tier == TIER_CRITICAL;
+	}
+	
+	pthread_mutex_init(&s->lock, NULL);
+	pthread_mutex_init(&s->flushLock, NULL);
+	pthread_cond_init(&s->work, NULL);
+	pthread_cond_init(&s->idle, NULL);
+	
+	if (jobs < 1)
+		jobs = 1;
+	if (jobs > POOL_MAX)
+		jobs = POOL_MAX;
+	
+	//The first worker to start takes the reserved place
+	s->reserve = critical ? 1 : 0;
+	int total = jobs + s->reserve;
+	for (; s->started < total; s->started++) {
+		if (pthread_create(&s->threads[s->started], NULL, schedWorker, s) != 0) {
+			printtime(log);
+			fprintf(log, "Could only start %d of %d fetch threads.\n", s->started, total);
+			break;
+		}
+	}
+	
+	if (s->started == 0) {
+		pthread_cond_destroy(&s->idle);
+		pthread_cond_destroy(&s->work);
+		pthread_mutex_destroy(&s->flushLock);
+		pthread_mutex_destroy(&s->lock);
+		schedFree(s);
+		return -1;
+	}
+	return 0;
+}
+
+void schedQueue(rssm_sched* s, time_t now) {
+	pthread_mutex_lock(&s->lock);
+	
+	//Only the hot records are read, and the leases once
+	uint64_t held = shardsHeld(s);
+	uint64_t taken = held & ~s->shards;
+	s->shards = held;
+	//Drained shards stay out until their leases are gone
+	s->draining &= held;
+	size_t i, queued = 0;
+	for (i = 0; i < s->nfeeds; i++) {
+		struct __hot* h = &s->hot[i];
+		if (taken >> h->shard & 1)
+			h->stale = 1;
+		if (h->busy || h->held || h->due > now || !((held & ~s->draining) >> h->shard & 1))
+			continue;
+		pushQueue(s, &s->queue[h->tier], i);
+		queued++;
+	}
+	
+	if (queued > 0)
+		pthread_cond_broadcast(&s->work);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void schedDrain(void* data, uint64_t shards) {
+	rssm_sched* s = data;
+	
+	pthread_mutex_lock(&s->lock);
+	s->draining |= shards;
+	size_t i, n = s->nfeeds;
+	for (i = 0; i < n; i++)
+		while (s->hot[i].busy == BUSY_RUNNING && shards >> s->hot[i].shard & 1)
+			pthread_cond_wait(&s->idle, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+	
+	pthread_mutex_lock(&s->flushLock);
+	if (writerFlush(s->writer, s->feeds, s->log) < 0) {
+		printtime(s->log);
+		fprintf(s->log, "Error writing some of the new items.\n");
+	}
+	pthread_mutex_unlock(&s->flushLock);
+	
+	//The next node reads the item files as soon as it has the leases
+	for (i = 0; i < n; i++) {
+		rssm_feeditem* feed = s->feeds[i];
+		if (!(shards >> s->hot[i].shard & 1))
+			continue;
+		pthread_mutex_lock(&feed->lock);
+		if (fflush(feed->out) == 0 && fsync(fileno(feed->out)) == 0) {
+			feed->dirty = 0;
+		} else {
+			printtime(s->log);
+			fprintf(s->log, "Error syncing %s before giving up its shard.\n", feed->path);
+		}
+		pthread_mutex_unlock(&feed->lock);
+	}
+}
+
+long schedAdd(rssm_sched* s, rssm_feeditem* feed) {
+	pthread_mutex_lock(&s->lock);
+	if (s->nfeeds == s->cap) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	
+	size_t i = s->nfeeds;
+	hotInit(s, i, feed, time(NULL));
+	s->last[i]   = 0;
+	s->result[i] = 0;
+	//The place after it is still NULL, so the list stays terminated for everyone walking it
+	//Walkers without the lock see the feed only once it is set up
+	__atomic_store_n(&s->feeds[i], feed, __ATOMIC_RELEASE);
+	s->nfeeds++;
+	
+	pthread_mutex_unlock(&s->lock);
+	return i;
+}
+
+long schedFind(rssm_sched* s, const char* tag) {
+	pthread_mutex_lock(&s->lock);
+	uint64_t hash = keyHash(tag, strlen(tag));
+	size_t i;
+	for (i = 0; i < s->nfeeds; i++)
+		if (s->hot[i].hash == hash && strcmp(s->feeds[i]->tag, tag) == 0)
+			break;
+	long found = i < s->nfeeds ? (long)i : -1;
+	pthread_mutex_unlock(&s->lock);
+	return found;
+}
+
+int schedNow(rssm_sched* s, size_t i) {
+	pthread_mutex_lock(&s->lock);
+	if (s->hot[i].held == SCHED_REMOVED || elsewhere(s, i)) {
+		pthread_mutex_unlock(&s->lock);
+		return s->hot[i].held == SCHED_REMOVED ? -1 : -2;
+	}
+	
+	//Its cadence starts over from this fetch
+	s->hot[i].due = time(NULL);
+	if (s->hot[i].busy == BUSY_RUNNING) {
+		s->hot[i].again = 1;
+	} else if (s->hot[i].busy == 0 || dropQueue(s, &s->queue[s->hot[i].tier], i) == 0) {
+		pushQueue(s, &s->urgent, i);
+		pthread_cond_broadcast(&s->work);
+	}
+	
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+int schedHold(rssm_sched* s, size_t i, int held) {
+	pthread_mutex_lock(&s->lock);
+	int ret = 0;
+	if (s->hot[i].held == SCHED_REMOVED && held != SCHED_REMOVED)
+		ret = -1;
+	else
+		s->hot[i].held = held;
+	if (held)
+		s->hot[i].again = 0;
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}
+
+int schedRevive(rssm_sched* s, size_t i, char* url) {
+	pthread_mutex_lock(&s->lock);
+	if (s->hot[i].held != SCHED_REMOVED || s->hot[i].busy) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	
+	//Nothing fetches it while it's removed and idle, so its url and ETag are free to change
+	rssm_feeditem* feed = s->feeds[i];
+	free(feed->url);
+	free(feed->etag);
+	feed->url  = url;
+	feed->etag = NULL;
+	s->hot[i].held = 0;
+	s->hot[i].due  = time(NULL);
+	
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+long schedEvery(rssm_sched* s, size_t i, long secs) {
+	pthread_mutex_lock(&s->lock);
+	if (secs > SCHED_EVERY_MAX)
+		secs = SCHED_EVERY_MAX;
+	s->hot[i].every = secs > 0 ? secs : tierEvery(s, &s->feeds[i]->priority);
+	//A shorter interval takes effect right away, a longer one after the next fetch
+	time_t next = time(NULL) + s->hot[i].every;
+	if (s->hot[i].due > next)
+		s->hot[i].due = next;
+	long every = s->hot[i].every;
+	pthread_mutex_unlock(&s->lock);
+	return every;
+}
+
+void schedDump(rssm_sched* s, long i, FILE* out) {
+	pthread_mutex_lock(&s->lock);
+	
+	size_t j = i < 0 ? 0 : (size_t)i;
+	size_t end = i < 0 ? s->nfeeds : j + 1;
+	for (; j < end; j++) {
+		rssm_feeditem* feed = s->feeds[j];
+		const char* state = "idle";
+		if (s->hot[j].held == SCHED_REMOVED)
+			state = "removed";
+		else if (s->hot[j].busy == BUSY_RUNNING)
+			state = "running";
+		else if (s->hot[j].busy == BUSY_QUEUED && !s->hot[j].held)
+			state = "queued";
+		else if (s->hot[j].held == SCHED_PAUSED)
+			state = "paused";
+		else if (elsewhere(s, j))
+			state = "elsewhere";
+		
+		int pushed = feed->websub != NULL && websubActive(feed);
+		fprintf(out, "%s\t%s\t%s\t%d\t%lld\t%lld\t%d\t%s\t%s\n", feed->tag, tierNames[s->hot[j].tier], state, (int)s->hot[j].every,
+		        (long long)s->hot[j].due, (long long)s->last[j], s->result[j], pushed ? "push" : "poll", feed->url);
+	}
+	
+	pthread_mutex_unlock(&s->lock);
+}
+
+size_t schedTake(rssm_sched* s) {
+	pthread_mutex_lock(&s->lock);
+	size_t done = s->done;
+	s->done = 0;
+	pthread_mutex_unlock(&s->lock);
+	return done;
+}
+
+void schedPause(rssm_sched* s) {
+	pthread_mutex_lock(&s->lock);
+	s->paused = 1;
+	while (s->running > 0)
+		pthread_cond_wait(&s->idle, &s->lock);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void schedResume(rssm_sched* s) {
+	pthread_mutex_lock(&s->lock);
+	s->paused = 0;
+	pthread_cond_broadcast(&s->work);
+	pthread_mutex_unlock(&s->lock);
+}
+
+void schedReport(rssm_sched* s, FILE* log) {
+	pthread_mutex_lock(&s->lock);
+	
+	printtime(log);
+	fprintf(log, "Freshness lag:");
+	int t;
+	for (t = 0; t < TIERS; t++) {
+		struct __tierstat* st = &s->stats[t];
+		fprintf(log, "%s %s %zu fetches", t > 0 ? "," : "", tierNames[t], st->fetches);
+		if (st->fetches > 0)
+			fprintf(log, " (%zu failed) avg %.2fs max %.2fs, %zu queued", st->failed, st->lagSum / st->fetches, st->lagMax, s->queue[t].count);
+	}
+	fprintf(log, ".\n");
+	memset(s->stats, 0, sizeof(s->stats));
+	
+	pthread_mutex_unlock(&s->lock);
+}
+
+void schedStop(rssm_sched* s) {
+	pthread_mutex_lock(&s->lock);
+	s->stop = 1;
+	pthread_cond_broadcast(&s->work);
+	pthread_mutex_unlock(&s->lock);
+	
+	int i;
+	for (i = 0; i < s->started; i++)
+		pthread_join(s->threads[i], NULL);
+	
+	pthread_mutex_destroy(&s->lock);
+	pthread_mutex_destroy(&s->flushLock);
+	pthread_cond_destroy(&s->work);
+	pthread_cond_destroy(&s->idle);
+	schedFree(s);
+}
@@ -0,0 +1,643 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include "search.h"
+#include "itemfile.h"
+
+//Lines of a rendered item that get indexed
+static const char* searchLines[] = {"title: ", "description: ", "summary: ", "category: ", NULL};
+
+//A segment file mapped for reading
+struct __segment {
+	char* map;
+	size_t len;
+	uint32_t base, end, nterms;
+	//offset of every dictionary entry, in term order
+	size_t* entries;
+	const unsigned char* postings;
+};
+
+//Bytes before the dictionary: magic, base, end and term count
+#define SEGMENT_HEAD (8 + 3 * sizeof(uint32_t))
+
+void searchWords(const char* text, size_t len, void (*fn)(const char* word, size_t len, void* data), void* data) {
+	char word[SEARCH_TERM];
+	size_t n = 0, i;
+	int markup = 0;
+	
+	for (i = 0; i <= len; i++) {
+		unsigned char c = i < len ? text[i] : ' ';
+		
+		//Descriptions are often html, tags aren't words
+		if (c == '<')
+			markup = 1;
+		int inWord = !markup && (c >= 0x80 || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'));
+		if (c == '>')
+			markup = 0;
+		
+		if (inWord) {
+			if (n < SEARCH_TERM)
+				word[n++] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+			continue;
+		}
+		
+		//Single letters are too common to be worth a posting list
+		if (n > 1)
+			fn(word, n, data);
+		n = 0;
+	}
+}
+
+//Posting list of a term, adding it if needed
+static struct __postings* getTerm(rssm_search* s, const char* word, size_t len) {
+	uint64_t h = keyHash(word, len);
+	uint64_t idx;
+	if (keysetGet(&s->termIndex, h, &idx))
+		return &s->terms[idx];
+	
+	if (s->nterms == s->termCap) {
+		size_t cap = s->termCap > 0 ? s->termCap * 2 : 1024;
+		struct __postings* tmp = realloc(s->terms, cap * sizeof(struct __postings));
+		if (tmp == NULL)
+			return NULL;
+		s->terms   = tmp;
+		s->termCap = cap;
+	}
+	
+	struct __postings* p = &s->terms[s->nterms];
+	p->term = malloc(len + 1);
+	if (p->term == NULL)
+		return NULL;
+	memcpy(p->term, word, len);
+	p->term[len] = '\0';
+	p->docs  = NULL;
+	p->count = 0;
+	p->cap   = 0;
+	
+	if (keysetPut(&s->termIndex, h, s->nterms) < 0) {
+		free(p->term);
+		return NULL;
+	}
+	s->nterms++;
+	return p;
+}
+
+//Add doc to a posting list, documents only ever come in increasing order
+static int addPosting(struct __postings* p, uint32_t doc) {
+	if (p->count > 0 && p->docs[p->count - 1] >= doc)
+		return 0;
+	
+	if (p->count == p->cap) {
+		size_t cap = p->cap > 0 ? p->cap * 2 : 4;
+		uint32_t* tmp = realloc(p->docs, cap * sizeof(uint32_t));
+		if (tmp == NULL)
+			return -1;
+		p->docs = tmp;
+		p->cap  = cap;
+	}
+	p->docs[p->count++] = doc;
+	return 0;
+}
+
+//Where searchAdd's words go
+struct __adding {
+	rssm_search* s;
+	uint32_t doc;
+};
+
+static void addWord(const char* word, size_t len, void* data) {
+	struct __adding* a = data;
+	struct __postings* p = getTerm(a->s, word, len);
+	if (p != NULL)
+		addPosting(p, a->doc);
+}
+
+int searchAdd(rssm_search* s, const char* tag, rssm_itemid id, const char* buf, size_t len) {
+	pthread_mutex_lock(&s->lock);
+	
+	if (s->ndocs == s->docCap) {
+		size_t cap = s->docCap > 0 ? s->docCap * 2 : 256;
+		rssm_searchdoc* tmp = realloc(s->docs, cap * sizeof(rssm_searchdoc));
+		if (tmp == NULL) {
+			pthread_mutex_unlock(&s->lock);
+			return -1;
+		}
+		s->docs   = tmp;
+		s->docCap = cap;
+	}
+	
+	struct __adding a = {s, s->base + s->ndocs};
+	rssm_searchdoc* d = &s->docs[s->ndocs++];
+	d->hi  = id.hi;
+	d->lo  = id.lo;
+	d->tag = keyHash(tag, strlen(tag));
+	
+	size_t pos = 0;
+	while (pos < len) {
+		const char* line = buf + pos;
+		const char* nl = memchr(line, '\n', len - pos);
+		size_t n = nl != NULL ? (size_t)(nl - line) : len - pos;
+		pos += n + 1;
+		
+		int i;
+		for (i = 0; searchLines[i] != NULL; i++) {
+			size_t plen = strlen(searchLines[i]);
+			if (n >= plen && memcmp(line, searchLines[i], plen) == 0) {
+				searchWords(line + plen, n - plen, addWord, &a);
+				break;
+			}
+		}
+	}
+	
+	pthread_mutex_unlock(&s->lock);
+	return 0;
+}
+
+static size_t putVarint(unsigned char* out, uint32_t val) {
+	size_t n = 0;
+	while (val >= 0x80) {
+		out[n++] = (val & 0x7f) | 0x80;
+		val >>= 7;
+	}
+	out[n++] = val;
+	return n;
+}
+
+static const unsigned char* getVarint(const unsigned char* p, const unsigned char* end, uint32_t* val) {
+	uint32_t ret = 0;
+	int shift = 0;
+	while (p < end && shift < 35) {
+		ret |= (uint32_t)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			*val = ret;
+			return p;
+		}
+		shift += 7;
+	}
+	return NULL;
+}
+
+static int termOrder(const void* a, const void* b) {
+	return strcmp((*(struct __postings **)a)->term, (*(struct __postings **)b)->term);
+}
+
+//Write terms as the segment for documents base to end - 1
+static int writeSegment(const char* dir, struct __postings* terms, size_t nterms, uint32_t base, uint32_t end) {
+	char path[strlen(dir) + 14];
+	char tmp[strlen(dir) + 18];
+	sprintf(path, "%s/seg %08x", dir, base);
+	sprintf(tmp, "%s.tmp", path);
+	
+	struct __postings** sorted = malloc((nterms + 1) * sizeof(struct __postings *));
+	if (sorted == NULL)
+		return -1;
+	size_t i;
+	for (i = 0; i < nterms; i++)
+		sorted[i] = &terms[i];
+	qsort(sorted, nterms, sizeof(struct __postings *), termOrder);
+	
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL) {
+		free(sorted);
+		return -1;
+	}
+	
+	uint32_t head[3] = {base, end, nterms};
+	fwrite(SEARCH_MAGIC, 1, 8, f);
+	fwrite(head, sizeof(uint32_t), 3, f);
+	
+	//Dictionary first, so every posting list's offset is known before it's encoded
+	uint32_t off = 0;
+	for (i = 0; i < nterms; i++) {
+		const struct __postings* p = sorted[i];
+		unsigned char len = strlen(p->term);
+		
+		uint32_t plen = 0, prev = base;
+		size_t k;
+		unsigned char scratch[5];
+		for (k = 0; k < p->count; k++) {
+			plen += putVarint(scratch, p->docs[k] - prev);
+			prev = p->docs[k];
+		}
+		
+		uint32_t entry[3] = {p->count, off, plen};
+		fwrite(&len, 1, 1, f);
+		fwrite(p->term, 1, len, f);
+		fwrite(entry, sizeof(uint32_t), 3, f);
+		off += plen;
+	}
+	
+	for (i = 0; i < nterms; i++) {
+		const struct __postings* p = sorted[i];
+		uint32_t prev = base;
+		size_t k;
+		for (k = 0; k < p->count; k++) {
+			unsigned char buf[5];
+			fwrite(buf, 1, putVarint(buf, p->docs[k] - prev), f);
+			prev = p->docs[k];
+		}
+	}
+	free(sorted);
+	
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0 || rename(tmp, path) != 0) {
+		remove(tmp);
+		return -1;
+	}
+	return 0;
+}
+
+//Map and check a segment file, building its dictionary offsets
+static int segmentOpen(struct __segment* seg, const char* path) {
+	memset(seg, 0, sizeof(struct __segment));
+	seg->map = mapFile(path, &seg->len);
+	if (seg->map == NULL)
+		return -1;
+	if (seg->len < SEGMENT_HEAD || memcmp(seg->map, SEARCH_MAGIC, 8) != 0)
+		goto bad;
+	
+	uint32_t head[3];
+	memcpy(head, seg->map + 8, sizeof(head));
+	seg->base   = head[0];
+	seg->end    = head[1];
+	seg->nterms = head[2];
+	
+	seg->entries = malloc((seg->nterms + 1) * sizeof(size_t));
+	if (seg->entries == NULL)
+		goto bad;
+	
+	size_t pos = SEGMENT_HEAD;
+	uint32_t i;
+	for (i = 0; i < seg->nterms; i++) {
+		if (pos >= seg->len)
+			goto bad;
+		seg->entries[i] = pos;
+		pos += 1 + (unsigned char)seg->map[pos] + 3 * sizeof(uint32_t);
+	}
+	if (pos > seg->len)
+		goto bad;
+	seg->postings = (const unsigned char *)seg->map + pos;
+	return 0;
+
+bad:
+	free(seg->entries);
+	unmapFile(seg->map, seg->len);
+	seg->entries = NULL;
+	seg->map     = NULL;
+	return -1;
+}
+
+static void segmentClose(struct __segment* seg) {
+	free(seg->entries);
+	unmapFile(seg->map, seg->len);
+}
+
+//Term, count and posting bytes of the nth dictionary entry
+static const char* segmentEntry(const struct __segment* seg, uint32_t n, size_t* len, uint32_t* entry) {
+	const char* e = seg->map + seg->entries[n];
+	*len = (unsigned char)e[0];
+	memcpy(entry, e + 1 + *len, 3 * sizeof(uint32_t));
+	return e + 1;
+}
+
+//Decode one posting list onto p, returns -1 if it's corrupt
+static int segmentPostings(const struct __segment* seg, const uint32_t* entry, struct __postings* p) {
+	const unsigned char* cur = seg->postings + entry[1];
+	const unsigned char* end = cur + entry[2];
+	if (end > (const unsigned char *)seg->map + seg->len)
+		return -1;
+	
+	uint32_t doc = seg->base, k;
+	for (k = 0; k < entry[0]; k++) {
+		uint32_t delta;
+		cur = getVarint(cur, end, &delta);
+		if (cur == NULL)
+			return -1;
+		doc += delta;
+		if (addPosting(p, doc) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+//Posting list of term in seg onto p, nothing if seg doesn't have it
+static int segmentFind(const struct __segment* seg, const char* term, struct __postings* p) {
+	size_t tlen = strlen(term);
+	uint32_t lo = 0, hi = seg->nterms;
+	
+	while (lo < hi) {
+		uint32_t mid = lo + (hi - lo) / 2;
+		size_t len;
+		uint32_t entry[3];
+		const char* t = segmentEntry(seg, mid, &len, entry);
+		
+		int cmp = memcmp(t, term, len < tlen ? len : tlen);
+		if (cmp == 0)
+			cmp = len < tlen ? -1 : len > tlen;
+		if (cmp == 0)
+			return segmentPostings(seg, entry, p);
+		if (cmp < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return 0;
+}
+
+static int segmentOrder(const void* a, const void* b) {
+	const struct __segment* x = a;
+	const struct __segment* y = b;
+	if (x->base != y->base)
+		return x->base < y->base ? -1 : 1;
+	//The bigger of two segments starting at the same document comes first
+	return x->end > y->end ? -1 : x->end < y->end;
+}
+
+//Open every segment under dir in document order
+//Segments covered by a merged one left over from a crash in the middle of a merge are dropped
+static long segmentList(const char* dir, struct __segment** segs) {
+	DIR* d = opendir(dir);
+	if (d == NULL)
+		return -1;
+	
+	size_t n = 0, cap = 0;
+	*segs = NULL;
+	struct dirent* ent;
+	while ((ent = readdir(d)) != NULL) {
+		unsigned base;
+		char tail;
+		if (sscanf(ent->d_name, "seg %8x%c", &base, &tail) != 1)
+			continue;
+		
+		if (n == cap) {
+			cap = cap > 0 ? cap * 2 : 16;
+			struct __segment* tmp = realloc(*segs, cap * sizeof(struct __segment));
+			if (tmp == NULL)
+				break;
+			*segs = tmp;
+		}
+		
+		char path[strlen(dir) + strlen(ent->d_name) + 2];
+		sprintf(path, "%s/%s", dir, ent->d_name);
+		if (segmentOpen(&(*segs)[n], path) == 0)
+			n++;
+	}
+	closedir(d);
+	
+	qsort(*segs, n, sizeof(struct __segment), segmentOrder);
+	
+	size_t i, kept = 0;
+	uint32_t covered = 0;
+	for (i = 0; i < n; i++) {
+		if (kept > 0 && (*segs)[i].end <= covered) {
+			segmentClose(&(*segs)[i]);
+			continue;
+		}
+		covered = (*segs)[i].end;
+		(*segs)[kept++] = (*segs)[i];
+	}
+	
+	return kept;
+}
+
+//Size tier of a segment, segments of the same tier get merged together
+static int segmentTier(const struct __segment* seg) {
+	uint32_t docs = (seg->end - seg->base) / SEARCH_MERGE;
+	int tier = 0;
+	while (docs > 0) {
+		docs /= SEARCH_MERGE;
+		tier++;
+	}
+	return tier;
+}
+
+//Merge segs[first] to segs[first + count - 1] into one segment
+static int segmentMerge(const char* dir, struct __segment* segs, size_t first, size_t count) {
+	rssm_search m;
+	memset(&m, 0, sizeof(rssm_search));
+	int ret = 0;
+	
+	//Segments are in document order, so appending keeps every posting list sorted
+	size_t i;
+	for (i = first; i < first + count && ret == 0; i++) {
+		uint32_t t;
+		for (t = 0; t < segs[i].nterms && ret == 0; t++) {
+			size_t len;
+			uint32_t entry[3];
+			const char* term = segmentEntry(&segs[i], t, &len, entry);
+			struct __postings* p = getTerm(&m, term, len);
+			if (p == NULL || segmentPostings(&segs[i], entry, p) < 0)
+				ret = -1;
+		}
+	}
+	
+	if (ret == 0)
+		ret = writeSegment(dir, m.terms, m.nterms, segs[first].base, segs[first + count - 1].end);
+	
+	//The merged segment replaced the first one, the rest go once it's safely written
+	for (i = first + 1; ret == 0 && i < first + count; i++) {
+		char path[strlen(dir) + 14];
+		sprintf(path, "%s/seg %08x", dir, segs[i].base);
+		remove(path);
+	}
+	
+	for (i = 0; i < m.nterms; i++) {
+		free(m.terms[i].term);
+		free(m.terms[i].docs);
+	}
+	free(m.terms);
+	keysetFree(&m.termIndex);
+	return ret;
+}
+
+//Merge the newest run of SEARCH_MERGE segments of the same tier until there is none
+static int searchMerge(rssm_search* s) {
+	int merged = 1;
+	while (merged) {
+		merged = 0;
+		
+		struct __segment* segs;
+		long n = segmentList(s->dir, &segs);
+		if (n < 0)
+			return -1;
+		
+		long i = n - 1;
+		while (i >= 0 && !merged) {
+			long run = i;
+			while (run > 0 && segmentTier(&segs[run - 1]) == segmentTier(&segs[i]))
+				run--;
+			
+			if (i - run + 1 >= SEARCH_MERGE) {
+				if (segmentMerge(s->dir, segs, run, i - run + 1) < 0) {
+					for (i = 0; i < n; i++)
+						segmentClose(&segs[i]);
+					free(segs);
+					return -1;
+				}
+				merged = 1;
+			}
+			i = run - 1;
+		}
+		
+		for (i = 0; i < n; i++)
+			segmentClose(&segs[i]);
+		free(segs);
+	}
+	
+	return 0;
+}
+
+int searchOpen(rssm_search* s, const char* dir) {
+	memset(s, 0, sizeof(rssm_search));
+	pthread_mutex_init(&s->lock, NULL);
+	
+	s->dir = malloc(strlen(dir) + 14);
+	sprintf(s->dir, "%s/.rssm search", dir);
+	if (mkdir(s->dir, 0755) != 0 && access(s->dir, W_OK) != 0)
+		return -1;
+	
+	//Documents on disk decide the next id, a record cut short by a crash is dropped
+	char docs[strlen(s->dir) + 6];
+	sprintf(docs, "%s/docs", s->dir);
+	struct stat st;
+	if (stat(docs, &st) == 0) {
+		s->base = st.st_size / sizeof(rssm_searchdoc);
+		if (st.st_size % sizeof(rssm_searchdoc) != 0 && truncate(docs, s->base * sizeof(rssm_searchdoc)) != 0)
+			return -1;
+	}
+	
+	return 0;
+}
+
+//Forget the in-memory segment
+static void dropSegment(rssm_search* s) {
+	size_t i;
+	for (i = 0; i < s->nterms; i++) {
+		free(s->terms[i].term);
+		free(s->terms[i].docs);
+	}
+	s->nterms = 0;
+	s->ndocs  = 0;
+	keysetFree(&s->termIndex);
+	memset(&s->termIndex, 0, sizeof(rssm_keyset));
+}
+
+int searchFlush(rssm_search* s) {
+	pthread_mutex_lock(&s->lock);
+	if (s->ndocs == 0) {
+		pthread_mutex_unlock(&s->lock);
+		return 0;
+	}
+	
+	//Documents go first so a segment never refers to a document that isn't there
+	char docs[strlen(s->dir) + 6];
+	sprintf(docs, "%s/docs", s->dir);
+	int fd = open(docs, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if (fd < 0) {
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	ssize_t bytes = s->ndocs * sizeof(rssm_searchdoc);
+	if (write(fd, s->docs, bytes) != bytes) {
+		//Keep the segment for the next check, unless the partial write can't be taken back
+		struct stat st;
+		if (ftruncate(fd, (off_t)s->base * sizeof(rssm_searchdoc)) != 0 && fstat(fd, &st) == 0) {
+			s->base = (st.st_size + sizeof(rssm_searchdoc) - 1) / sizeof(rssm_searchdoc);
+			dropSegment(s);
+		}
+		close(fd);
+		pthread_mutex_unlock(&s->lock);
+		return -1;
+	}
+	close(fd);
+	
+	//The documents are in the table either way, a segment that can't be written only loses their words
+	int ret = writeSegment(s->dir, s->terms, s->nterms, s->base, s->base + s->ndocs);
+	s->base += s->ndocs;
+	dropSegment(s);
+	if (ret == 0)
+		ret = searchMerge(s);
+	
+	pthread_mutex_unlock(&s->lock);
+	return ret;
+}
+
+void searchClose(rssm_search* s) {
+	dropSegment(s);
+	free(s->terms);
+	free(s->docs);
+	if (s->dir != NULL)
+		pthread_mutex_destroy(&s->lock);
+	free(s->dir);
+	memset(s, 0, sizeof(rssm_search));
+}
+
+long searchFind(const char* dir, char** terms, size_t nterms, uint32_t** docs) {
+	char path[strlen(dir) + 14];
+	sprintf(path, "%s/.rssm search", dir);
+	
+	struct __segment* segs;
+	long nsegs = segmentList(path, &segs);
+	if (nsegs < 0)
+		return -1;
+	
+	//Start from the first term's documents and keep the ones every other term has
+	struct __postings found = {NULL, NULL, 0, 0};
+	long ret = 0;
+	size_t t;
+	for (t = 0; t < nterms; t++) {
+		struct __postings p = {NULL, NULL, 0, 0};
+		long i;
+		for (i = 0; i < nsegs && ret == 0; i++)
+			if (segmentFind(&segs[i], terms[t], &p) < 0)
+				ret = -1;
+		
+		if (t == 0) {
+			found = p;
+		} else {
+			size_t a = 0, b = 0, kept = 0;
+			while (a < found.count && b < p.count) {
+				if (found.docs[a] < p.docs[b])
+					a++;
+				else if (found.docs[a] > p.docs[b])
+					b++;
+				else
+					found.docs[kept++] = found.docs[a++], b++;
+			}
+			found.count = kept;
+			free(p.docs);
+		}
+		
+		if (ret < 0 || found.count == 0)
+			break;
+	}
+	
+	long i;
+	for (i = 0; i < nsegs; i++)
+		segmentClose(&segs[i]);
+	free(segs);
+	
+	if (ret < 0) {
+		free(found.docs);
+		return -1;
+	}
+	*docs = found.docs;
+	return found.count;
+}
+
+rssm_searchdoc* searchDocs(const char* dir, size_t* count) {
+	char path[strlen(dir) + 19];
+	sprintf(path, "%s/.rssm search/docs", dir);
+	
+	size_t len;
+	char* buf = mapFile(path, &len);
+	if (buf == NULL)
+		return NULL;
+	
+	*count = len / sizeof(rssm_searchdoc);
+	return (rssm_searchdoc *)buf;
+}
@@ -0,0 +1,226 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "seen.h"
+
+#define SEEN_MAGIC  "RSSMSEEN"
+//bloom bits per item and probes per lookup, about a 1% false positive rate
+#define BLOOM_RATIO 16
+#define BLOOM_PROBES 7
+
+//Double hashing over the two halves of a remixed key
+static void bloomHashes(uint64_t key, uint64_t* h1, uint64_t* h2) {
+	key ^= key >> 31;
+	key *= 0x7fb5d329728ea185ULL;
+	key ^= key >> 27;
+	*h1 = key;
+	*h2 = (key >> 32) | 1;
+}
+
+static void bloomSet(rssm_seen* s, uint64_t key) {
+	uint64_t h1, h2;
+	bloomHashes(key, &h1, &h2);
+	
+	int i;
+	for (i = 0; i < BLOOM_PROBES; i++) {
+		uint64_t bit = (h1 + i * h2) & (s->bits - 1);
+		s->bloom[bit / 64] |= 1ULL << (bit % 64);
+	}
+}
+
+static int bloomTest(const rssm_seen* s, uint64_t key) {
+	uint64_t h1, h2;
+	bloomHashes(key, &h1, &h2);
+	
+	int i;
+	for (i = 0; i < BLOOM_PROBES; i++) {
+		uint64_t bit = (h1 + i * h2) & (s->bits - 1);
+		if ((s->bloom[bit / 64] & (1ULL << (bit % 64))) == 0)
+			return 0;
+	}
+	
+	return 1;
+}
+
+//Size the bloom filter for the current number of keys and refill it from the exact set
+static int bloomRebuild(rssm_seen* s) {
+	size_t bits = 4096;
+	while (bits < (s->keys.count + 1) * BLOOM_RATIO * 2)
+		bits *= 2;
+	
+	uint64_t* bloom = calloc(bits / 64, sizeof(uint64_t));
+	if (bloom == NULL)
+		return -1;
+	free(s->bloom);
+	s->bloom = bloom;
+	s->bits  = bits;
+	
+	size_t i;
+	for (i = 0; i < s->keys.cap; i++)
+		if (s->keys.keys[i] != 0)
+			bloomSet(s, s->keys.keys[i]);
+	
+	return 0;
+}
+
+//Index of tag in the tag table, adding it if needed
+static int tagId(rssm_seen* s, const char* tag, uint64_t* id) {
+	uint64_t h = keyHash(tag, strlen(tag));
+	if (keysetGet(&s->tagIndex, h, id) && strcmp(s->tags[*id], tag) == 0)
+		return 0;
+	
+	char** tags = realloc(s->tags, sizeof(char *) * (s->ntags + 1));
+	if (tags == NULL)
+		return -1;
+	s->tags = tags;
+	s->tags[s->ntags] = malloc(strlen(tag) + 1);
+	if (s->tags[s->ntags] == NULL)
+		return -1;
+	strcpy(s->tags[s->ntags], tag);
+	
+	*id = s->ntags++;
+	return keysetPut(&s->tagIndex, h, *id);
+}
+
+int seenLoad(rssm_seen* s, const char* path, int mode) {
+	memset(s, 0, sizeof(rssm_seen));
+	pthread_mutex_init(&s->lock, NULL);
+	s->mode = mode;
+	s->path = malloc(strlen(path) + 1);
+	if (s->path == NULL)
+		return -1;
+	strcpy(s->path, path);
+	
+	FILE* f = fopen(path, "r");
+	if (f == NULL)
+		return bloomRebuild(s);
+	
+	char magic[8];
+	uint32_t ntags;
+	uint64_t nkeys;
+	if (fread(magic, 1, 8, f) != 8 || memcmp(magic, SEEN_MAGIC, 8) != 0 || fread(&ntags, sizeof(ntags), 1, f) != 1)
+		goto corrupt;
+	
+	uint32_t i;
+	for (i = 0; i < ntags; i++) {
+		uint32_t len;
+		if (fread(&len, sizeof(len), 1, f) != 1 || len > 4096)
+			goto corrupt;
+		char tag[len + 1];
+		if (fread(tag, 1, len, f) != len)
+			goto corrupt;
+		tag[len] = '\0';
+		
+		uint64_t id;
+		if (tagId(s, tag, &id) < 0)
+			goto corrupt;
+	}
+	
+	if (fread(&nkeys, sizeof(nkeys), 1, f) != 1)
+		goto corrupt;
+	
+	uint64_t j;
+	for (j = 0; j < nkeys; j++) {
+		uint64_t kv[2];
+		if (fread(kv, sizeof(uint64_t), 2, f) != 2 || kv[1] >= s->ntags)
+			goto corrupt;
+		if (keysetPut(&s->keys, kv[0], kv[1]) < 0)
+			goto corrupt;
+	}
+	
+	fclose(f);
+	return bloomRebuild(s);
+	
+corrupt:
+	fclose(f);
+	keysetFree(&s->keys);
+	bloomRebuild(s);
+	return -1;
+}
+
+int seenCheck(const rssm_seen* s, uint64_t key, const char** origin) {
+	//Match the keyset, which stores a key of 0 as 1
+	if (key == 0)
+		key = 1;
+	if (!bloomTest(s, key))
+		return 0;
+	
+	uint64_t id;
+	if (!keysetGet(&s->keys, key, &id))
+		return 0;
+	
+	if (origin != NULL)
+		*origin = s->tags[id];
+	return 1;
+}
+
+int seenAdd(rssm_seen* s, uint64_t key, const char* tag) {
+	if (key == 0)
+		key = 1;
+	
+	uint64_t id;
+	if (tagId(s, tag, &id) < 0 || keysetPut(&s->keys, key, id) < 0)
+		return -1;
+	s->dirty = 1;
+	
+	if (s->keys.count * BLOOM_RATIO > s->bits)
+		return bloomRebuild(s);
+	bloomSet(s, key);
+	
+	return 0;
+}
+
+//Written to path.tmp first and renamed over so a crash never leaves half a set
+int seenSave(rssm_seen* s) {
+	if (!s->dirty)
+		return 0;
+	
+	char tmp[strlen(s->path) + 5];
+	sprintf(tmp, "%s.tmp", s->path);
+	
+	FILE* f = fopen(tmp, "w");
+	if (f == NULL)
+		return -1;
+	
+	uint32_t ntags = s->ntags;
+	uint64_t nkeys = s->keys.count;
+	fwrite(SEEN_MAGIC, 1, 8, f);
+	fwrite(&ntags, sizeof(ntags), 1, f);
+	
+	size_t i;
+	for (i = 0; i < s->ntags; i++) {
+		uint32_t len = strlen(s->tags[i]);
+		fwrite(&len, sizeof(len), 1, f);
+		fwrite(s->tags[i], 1, len, f);
+	}
+	
+	fwrite(&nkeys, sizeof(nkeys), 1, f);
+	for (i = 0; i < s->keys.cap; i++) {
+		if (s->keys.keys[i] == 0)
+			continue;
+		uint64_t kv[2] = {s->keys.keys[i], s->keys.vals[i]};
+		fwrite(kv, sizeof(uint64_t), 2, f);
+	}
+	
+	if (fclose(f) != 0 || rename(tmp, s->path) != 0) {
+		remove(tmp);
+		return -1;
+	}
+	
+	s->dirty = 0;
+	return 0;
+}
+
+void seenFree(rssm_seen* s) {
+	size_t i;
+	for (i = 0; i < s->ntags; i++)
+		free(s->tags[i]);
+	free(s->tags);
+	free(s->bloom);
+	free(s->path);
+	keysetFree(&s->keys);
+	keysetFree(&s->tagIndex);
+	pthread_mutex_destroy(&s->lock);
+	memset(s, 0, sizeof(rssm_seen));
+}
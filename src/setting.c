@@ -5,12 +5,32 @@
 #include <pwd.h>
 #include <argp.h>
 #include <signal.h>
+#include <errno.h>
+#include <limits.h>
 
 #include <iniparser.h>
 
 #include "setting.h"
 #include "rssmio.h"
 
+//A size like 512M in bytes, -1 if it isn't one or doesn't fit a long long
+static long long parseSize(const char* arg) {
+	char* unit;
+	errno = 0;
+	long long val = strtoll(arg, &unit, 10);
+	long long mult;
+	switch (*unit) {
+		case '\0': mult = 1; break;
+		case 'k': case 'K': mult = 1024; break;
+		case 'm': case 'M': mult = 1024 * 1024; break;
+		case 'g': case 'G': mult = 1024 * 1024 * 1024LL; break;
+		default: return -1;
+	}
+	if (unit == arg || errno == ERANGE || val < 0 || val > LLONG_MAX / mult)
+		return -1;
+	return val * mult;
+}
+
 //Parse an argument into a rssm_option struct
 error_t parseArg(int key, char* arg, struct argp_state *state) {
 	//Get the rssm_option struct
@@ -42,6 +62,75 @@ error_t parseArg(int key, char* arg, struct argp_state *state) {
 		case 'F':
 			opts->force = 1;
 			break;
+		case 'e':
+			opts->events = 1;
+			break;
+		case 'L':
+			if (strcmp(arg, "flat") == 0)
+				opts->layout = LAYOUT_FLAT;
+			else if (strcmp(arg, "sharded") == 0)
+				opts->layout = LAYOUT_SHARDED;
+			else
+				argp_error(state, "layout must be flat or sharded");
+			break;
+		case 'C':
+			opts->cat = arg;
+			break;
+		case 'W':
+			opts->websub = arg;
+			break;
+		case 'P':
+			opts->partition = arg;
+			break;
+		case 'A':
+			opts->archive = 1;
+			break;
+		case 'R':
+			opts->reprocess = arg;
+			opts->once      = 1;
+			break;
+		case 'O':
+			opts->format = formatParse(arg);
+			if (opts->format < 0)
+				argp_error(state, "output must be text, json or binary");
+			break;
+		case 'o':
+			opts->once = 1;
+			break;
+		case 'u':
+			opts->uring = 1;
+			break;
+		case 'S':
+			opts->search = 1;
+			break;
+		case 'm': {
+			long long val = parseSize(arg);
+			if (val <= 0)
+				argp_error(state, "memory must be a size like 512M");
+			opts->memory = val;
+			break;
+		}
+		case 'E': {
+			long long val = parseSize(arg);
+			if (val < 0)
+				argp_error(state, "enclosures must be a rate like 2M, or 0");
+			opts->enclosures = 1;
+			opts->rate = val;
+			break;
+		}
+		case 'j':
+			opts->jobs = atoi(arg);
+			if (opts->jobs < 1)
+				argp_error(state, "jobs must be at least 1");
+			break;
+		case 'x':
+			if (strcmp(arg, "skip") == 0)
+				opts->crossdedup = SEEN_SKIP;
+			else if (strcmp(arg, "ref") == 0)
+				opts->crossdedup = SEEN_REF;
+			else
+				argp_error(state, "crossdedup must be skip or ref");
+			break;
 		case ARGP_KEY_END:
 			break;
 		default:
@@ -186,6 +275,139 @@ char* getLogPath(const rssm_options *opts, int v) {
 	return ret;
 }
 
+//Parse a retention policy like "items=500 age=30d bytes=10M hot=100" into r
+//age takes s, m, h or d (the default), bytes takes k, M or G
+static void parseRetention(const char* str, rssm_retention* r, FILE* log) {
+	char copy[strlen(str) + 1];
+	strcpy(copy, str);
+	
+	char* save = NULL;
+	char* tok;
+	for (tok = strtok_r(copy, " \t,", &save); tok != NULL; tok = strtok_r(NULL, " \t,", &save)) {
+		char* eq = strchr(tok, '=');
+		if (eq == NULL) {
+			printtime(log);
+			fprintf(log, "Ignoring retention setting %s , it should look like name=value.\n", tok);
+			continue;
+		}
+		*eq = '\0';
+		
+		char* unit;
+		long val = strtol(eq + 1, &unit, 10);
+		
+		if (strcmp(tok, "items") == 0) {
+			r->items = val;
+		} else if (strcmp(tok, "age") == 0) {
+			switch (*unit) {
+				case 's': break;
+				case 'm': val *= 60; break;
+				case 'h': val *= 60 * 60; break;
+				default:  val *= 24 * 60 * 60; break;
+			}
+			r->age = val;
+		} else if (strcmp(tok, "hot") == 0) {
+			r->hot = val;
+		} else if (strcmp(tok, "bytes") == 0) {
+			switch (*unit) {
+				case 'k': case 'K': val *= 1024; break;
+				case 'm': case 'M': val *= 1024 * 1024; break;
+				case 'g': case 'G': val *= 1024 * 1024 * 1024; break;
+				default: break;
+			}
+			r->bytes = val;
+		} else {
+			printtime(log);
+			fprintf(log, "Unknown retention setting %s .\n", tok);
+		}
+	}
+}
+
+//Parse a priority like "critical 30s" into p, the interval is optional and takes s, m (the default), h or d
+int parsePriority(const char* str, rssm_priority* p, FILE* log) {
+	char copy[strlen(str) + 1];
+	strcpy(copy, str);
+	
+	char* save = NULL;
+	char* tok = strtok_r(copy, " \t,", &save);
+	if (tok == NULL)
+		return 0;
+	
+	if (strcmp(tok, "critical") == 0) {
+		p->tier = TIER_CRITICAL;
+	} else if (strcmp(tok, "normal") == 0) {
+		p->tier = TIER_NORMAL;
+	} else if (strcmp(tok, "low") == 0) {
+		p->tier = TIER_LOW;
+	} else {
+		printtime(log);
+		fprintf(log, "Unknown priority %s , it should be critical, normal or low.\n", tok);
+		return -1;
+	}
+	
+	tok = strtok_r(NULL, " \t,", &save);
+	if (tok == NULL)
+		return 0;
+	
+	char* unit;
+	long val = strtol(tok, &unit, 10);
+	switch (*unit) {
+		case 's': break;
+		case 'h': val *= 60 * 60; break;
+		case 'd': val *= 24 * 60 * 60; break;
+		default:  val *= 60; break;
+	}
+	if (val <= 0) {
+		printtime(log);
+		fprintf(log, "Ignoring priority interval %s .\n", tok);
+		return -1;
+	}
+	p->every = val;
+	return 0;
+}
+
+rssm_feeditem* newFeed(const char* tag, const char* url) {
+	rssm_feeditem* feed = malloc(sizeof(rssm_feeditem));
+	if (feed == NULL)
+		return NULL;
+	memset(feed, 0, sizeof(rssm_feeditem));
+	feed->tag = malloc(sizeof(char) * (strlen(tag) + 1));
+	feed->url = malloc(sizeof(char) * (strlen(url) + 1));
+	if (feed->tag == NULL || feed->url == NULL) {
+		free(feed->tag);
+		free(feed->url);
+		free(feed);
+		return NULL;
+	}
+	strcpy(feed->tag, tag);
+	strcpy(feed->url, url);
+	
+	pthread_mutex_init(&feed->lock, NULL);
+	feed->priority.tier = TIER_NORMAL;
+	feed->stream.fd     = -1;
+	feed->stream.format = -1;
+	return feed;
+}
+
+void freeFeed(rssm_feeditem* feed) {
+	if (feed->tag != NULL)
+		free(feed->tag);
+	if (feed->url != NULL)
+		free(feed->url);
+	if (feed->desc != NULL)
+		fclose(feed->desc);
+	if (feed->out != NULL)
+		fclose(feed->out);
+	if (feed->path != NULL)
+		free(feed->path);
+	free(feed->etag);
+	streamClose(&feed->stream);
+	pthread_mutex_destroy(&feed->lock);
+	keysetFree(&feed->ids);
+	keysetFree(&feed->fields);
+	pendingFree(&feed->pending);
+	free(feed);
+}
+
 rssm_feeditem** getFeeds(const char* list, FILE* log, int v) {
 	//ini dictionary from the list file
 	if (v) {
@@ -215,20 +437,36 @@ rssm_feeditem** getFeeds(const char* list, FILE* log, int v) {
 		raise(SIGKILL);
 	}
 	
+	//[retention] holds per tag policies, "default" applies to tags without one
+	const char* defRetention = iniparser_getstring(d, "retention:default", NULL);
+	//[priority] works the same way, tags without one are normal
+	const char* defPriority = iniparser_getstring(d, "priority:default", NULL);
+	//and [output], tags without one use -O
+	const char* defOutput = iniparser_getstring(d, "output:default", NULL);
+	
 	size_t i = 0;
 	for (i=0; i<tagNum; i++) {
-		feeds[i] = malloc(sizeof(rssm_feeditem));
-		char* tag = malloc(sizeof(char) * (strlen(name[i]) + 1));
-		strcpy(tag, name[i] + 4);
+		//keys are "rss:<tag>"
+		const char* tag = name[i] + 4;
+		feeds[i] = newFeed(tag, iniparser_getstring(d, name[i], ""));
+		
+		char key[strlen(tag) + 11];
+		sprintf(key, "retention:%s", tag);
+		const char* retention = iniparser_getstring(d, key, defRetention);
+		if (retention != NULL)
+			parseRetention(retention, &feeds[i]->retention, log);
 		
-		const char* val = iniparser_getstring(d, name[i], "");
-		char* url = malloc(sizeof(char) * (strlen(val) + 1));
-		strcpy(url, val);
+		sprintf(key, "priority:%s", tag);
+		const char* priority = iniparser_getstring(d, key, defPriority);
+		if (priority != NULL)
+			parsePriority(priority, &feeds[i]->priority, log);
 		
-		feeds[i]->tag  = tag;
-		feeds[i]->url  = url;
-		feeds[i]->out  = NULL;
-		feeds[i]->desc = NULL;
+		sprintf(key, "output:%s", tag);
+		const char* output = iniparser_getstring(d, key, defOutput);
+		if (output != NULL && (feeds[i]->stream.format = formatParse(output)) < 0) {
+			printtime(log);
+			fprintf(log, "Unknown output format %s for %s , it should be text, json or binary.\n", output, tag);
+		}
 	}
 	feeds[i] = NULL;
 	
@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/uio.h>
+#include <sys/stat.h>
+
+#include "wal.h"
+#include "setting.h"
+#include "rssmio.h"
+#include "itemfile.h"
+#include "index.h"
+
+//Header of a record, followed by the tag and then the item
+struct __walhead {
+	char magic[4];
+	uint32_t taglen, len;
+	uint32_t pad;
+	uint64_t hi, lo;
+	//hash of the tag and the item, a record cut short by a crash won't match it
+	uint64_t sum;
+};
+
+//FNV-1a over the tag then the item
+static uint64_t recordSum(const char* tag, size_t taglen, const char* buf, size_t len) {
+	uint64_t h = 14695981039346656037ULL;
+	size_t i;
+	for (i = 0; i < taglen; i++) {
+		h ^= (unsigned char)tag[i];
+		h *= 1099511628211ULL;
+	}
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)buf[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+int walOpen(rssm_wal* w, const char* dir) {
+	w->path = malloc(strlen(dir) + 12);
+	sprintf(w->path, "%s/.rssm wal", dir);
+	w->pending = 0;
+	pthread_mutex_init(&w->lock, NULL);
+	
+	w->fd = open(w->path, O_RDWR | O_APPEND | O_CREAT, 0644);
+	return w->fd < 0 ? -1 : 0;
+}
+
+int walAppend(rssm_wal* w, const char* tag, rssm_itemid id, const char* buf, size_t len) {
+	struct __walhead head;
+	memcpy(head.magic, WAL_MAGIC, 4);
+	head.taglen = strlen(tag);
+	head.len    = len;
+	head.pad    = 0;
+	head.hi     = id.hi;
+	head.lo     = id.lo;
+	head.sum    = recordSum(tag, head.taglen, buf, len);
+	
+	struct iovec iov[3] = {
+		{&head, sizeof(head)},
+		{(char *)tag, head.taglen},
+		{(char *)buf, len}
+	};
+	ssize_t total = sizeof(head) + head.taglen + len;
+	
+	//Fetch threads share the log, each record has to land in one piece
+	pthread_mutex_lock(&w->lock);
+	ssize_t ret = writev(w->fd, iov, 3);
+	if (ret == total)
+		w->pending++;
+	pthread_mutex_unlock(&w->lock);
+	
+	return ret == total ? 0 : -1;
+}
+
+int walCommit(rssm_wal* w) {
+	pthread_mutex_lock(&w->lock);
+	int ret = 0;
+	if (w->pending > 0) {
+		ret = fdatasync(w->fd);
+		if (ret == 0)
+			w->pending = 0;
+	}
+	pthread_mutex_unlock(&w->lock);
+	
+	return ret == 0 ? 0 : -1;
+}
+
+int walFull(rssm_wal* w) {
+	struct stat st;
+	return fstat(w->fd, &st) == 0 && st.st_size >= WAL_MAX;
+}
+
+int walCheckpoint(rssm_wal* w, rssm_feeditem** feeds, FILE* log) {
+	int ret = 0;
+	
+	size_t i;
+	rssm_feeditem* feed;
+	for (i = 0; (feed = feedAt(feeds, i)) != NULL; i++) {
+		pthread_mutex_lock(&feed->lock);
+		//Items that haven't reached the item file yet are only in the log
+		if (feed->pending.len > 0) {
+			printtime(log);
+			fprintf(log, "%s still has items to write, keeping them in the write-ahead log.\n", feed->tag);
+			ret = -1;
+		}
+		if (feed->dirty) {
+			if (fflush(feed->out) == 0 && fsync(fileno(feed->out)) == 0) {
+				feed->dirty = 0;
+			} else {
+				printtime(log);
+				fprintf(log, "Error syncing %s , keeping its items in the write-ahead log.\n", feed->path);
+				ret = -1;
+			}
+		}
+		pthread_mutex_unlock(&feed->lock);
+	}
+	
+	//The log can only go once everything in it is in a synced item file
+	if (ret == 0) {
+		pthread_mutex_lock(&w->lock);
+		if (ftruncate(w->fd, 0) != 0 || fdatasync(w->fd) != 0)
+			ret = -1;
+		w->pending = 0;
+		pthread_mutex_unlock(&w->lock);
+	}
+	
+	return ret;
+}
+
+int walReplay(rssm_wal* w, rssm_feeditem** feeds, rssm_leases* leases, FILE* log, int v) {
+	size_t len;
+	char* buf = mapFile(w->path, &len);
+	if (buf == NULL)
+		return -1;
+	
+	//Look feeds up by tag
+	rssm_keyset tags;
+	memset(&tags, 0, sizeof(rssm_keyset));
+	size_t i;
+	for (i = 0; feeds[i] != NULL; i++)
+		keysetPut(&tags, keyHash(feeds[i]->tag, strlen(feeds[i]->tag)), i);
+	
+	//The item files of shards held elsewhere are that node's to write
+	uint64_t held = leases != NULL ? leaseMask(leases) : ~0ULL;
+	int count = 0, elsewhere = 0;
+	size_t off = 0;
+	while (off + sizeof(struct __walhead) <= len) {
+		struct __walhead head;
+		memcpy(&head, buf + off, sizeof(head));
+		
+		const char* tag  = buf + off + sizeof(head);
+		const char* item = tag + head.taglen;
+		if (memcmp(head.magic, WAL_MAGIC, 4) != 0 || (size_t)head.taglen + head.len > len - off - sizeof(head))
+			break;
+		//Anything past a record that doesn't check out was never committed
+		if (recordSum(tag, head.taglen, item, head.len) != head.sum)
+			break;
+		off += sizeof(head) + head.taglen + head.len;
+		
+		uint64_t idx;
+		if (!keysetGet(&tags, keyHash(tag, head.taglen), &idx) || strlen(feeds[idx]->tag) != head.taglen ||
+				memcmp(feeds[idx]->tag, tag, head.taglen) != 0)
+			continue;
+		
+		rssm_feeditem* feed = feeds[idx];
+		if (!leaseOwns(held, feed->tag)) {
+			elsewhere++;
+			continue;
+		}
+		
+		//Items already in the item file, its cold storage or expired don't need redoing
+		rssm_itemid id = {head.hi, head.lo};
+		if (identityHas(&feed->ids, id))
+			continue;
+		identityAdd(&feed->ids, id);
+		
+		fseek(feed->out, 0, SEEK_END);
+		long start = ftell(feed->out);
+		if (fwrite(item, 1, head.len, feed->out) != head.len) {
+			printtime(log);
+			fprintf(log, "Error writing a logged item back to %s .\n", feed->path);
+			continue;
+		}
+		fflush(feed->out);
+		feed->dirty = 1;
+		count++;
+		indexAppend(feed->path, item, head.len, start);
+		if (feed->search != NULL)
+			searchAdd(feed->search, feed->tag, id, item, head.len);
+		
+		if (feed->events != NULL) {
+			char hex[IDENTITY_HEX + 1];
+			identityFormat(id, hex);
+			eventItem(feed->events, feed->tag, start, head.len, hex);
+		}
+	}
+	
+	if (v && off < len) {
+		printtime(log);
+		fprintf(log, "Dropped %zu bytes of uncommitted records from %s .\n", len - off, w->path);
+	}
+	if (elsewhere > 0) {
+		printtime(log);
+		fprintf(log, "Left %d logged items to the nodes holding their feeds' shards.\n", elsewhere);
+	}
+	
+	keysetFree(&tags);
+	unmapFile(buf, len);
+	return count;
+}
+
+void walClose(rssm_wal* w) {
+	if (w->fd >= 0)
+		close(w->fd);
+	if (w->path != NULL)
+		pthread_mutex_destroy(&w->lock);
+	free(w->path);
+	w->fd   = -1;
+	w->path = NULL;
+}
@@ -0,0 +1,565 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/random.h>
+#include <netinet/in.h>
+
+#include <curl/curl.h>
+
+#include "websub.h"
+#include "setting.h"
+#include "rssmio.h"
+#include "keyset.h"
+#include "hmac.h"
+
+//Longest request line and headers read
+#define HEAD_MAX 8192
+
+int websubOpen(rssm_websub* w, const char* base, rssm_feeditem** feeds, FILE* log, int v) {
+	memset(w, 0, sizeof(rssm_websub));
+	w->fd    = -1;
+	w->feeds = feeds;
+	w->log   = log;
+	w->v     = v;
+	pthread_mutex_init(&w->lock, NULL);
+	pthread_mutex_init(&w->ingest, NULL);
+	
+	//Callback urls are base/<id>, so base doesn't keep a trailing /
+	w->base = malloc(strlen(base) + 1);
+	if (w->base == NULL)
+		return -1;
+	strcpy(w->base, base);
+	while (*w->base != '\0' && w->base[strlen(w->base) - 1] == '/')
+		w->base[strlen(w->base) - 1] = '\0';
+	
+	//Port from http://host:port/path, 80 without one
+	const char* host = strstr(w->base, "://");
+	host = host != NULL ? host + 3 : w->base;
+	const char* colon = strchr(host, ':');
+	const char* slash = strchr(host, '/');
+	long port = 80;
+	if (colon != NULL && (slash == NULL || colon < slash))
+		port = strtol(colon + 1, NULL, 10);
+	if (port <= 0 || port > 65535)
+		return -1;
+	
+	size_t i;
+	for (i = 0; feeds[i] != NULL; i++)
+		websubAdd(w, feeds[i]);
+	
+	w->fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (w->fd < 0)
+		return -1;
+	int on = 1;
+	setsockopt(w->fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	
+	struct sockaddr_in addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family      = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port        = htons(port);
+	if (bind(w->fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(w->fd, 16) != 0) {
+		close(w->fd);
+		w->fd = -1;
+		return -1;
+	}
+	
+	return 0;
+}
+
+void websubAdd(rssm_websub* w, rssm_feeditem* feed) {
+	sprintf(feed->hub.id, "%016" PRIx64, keyHash(feed->tag, strlen(feed->tag)));
+}
+
+//Feed whose callback path ends in id, NULL if none
+static rssm_feeditem* feedById(rssm_websub* w, const char* id, size_t len) {
+	size_t i;
+	rssm_feeditem* feed;
+	for (i = 0; (feed = feedAt(w->feeds, i)) != NULL; i++)
+		if (len == 16 && memcmp(feed->hub.id, id, 16) == 0)
+			return feed;
+	return NULL;
+}
+
+static void reply(int fd, const char* status, const char* body) {
+	char head[256];
+	int len = snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n", status, strlen(body));
+	if (write(fd, head, len) < 0 || write(fd, body, strlen(body)) < 0)
+		return;
+}
+
+static int hexVal(char c) {
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	return -1;
+}
+
+//The percent decoded value of name in a query string, NULL if it isn't there
+static char* queryParam(const char* query, const char* name) {
+	size_t nlen = strlen(name);
+	const char* p = query;
+	while (p != NULL && *p != '\0') {
+		const char* end = strchr(p, '&');
+		size_t len = end != NULL ? (size_t)(end - p) : strlen(p);
+		
+		if (len > nlen && strncmp(p, name, nlen) == 0 && p[nlen] == '=') {
+			char* out = malloc(len - nlen);
+			if (out == NULL)
+				return NULL;
+			size_t i, j = 0;
+			for (i = nlen + 1; i < len; i++) {
+				if (p[i] == '+') {
+					out[j++] = ' ';
+				} else if (p[i] == '%' && i + 2 < len && hexVal(p[i+1]) >= 0 && hexVal(p[i+2]) >= 0) {
+					out[j++] = hexVal(p[i+1]) * 16 + hexVal(p[i+2]);
+					i += 2;
+				} else {
+					out[j++] = p[i];
+				}
+			}
+			out[j] = '\0';
+			return out;
+		}
+		p = end != NULL ? end + 1 : NULL;
+	}
+	return NULL;
+}
+
+//A hub checking that we asked for a subscription
+static void verify(rssm_websub* w, int fd, rssm_feeditem* feed, const char* query) {
+	char* mode      = queryParam(query, "hub.mode");
+	char* topic     = queryParam(query, "hub.topic");
+	char* challenge = queryParam(query, "hub.challenge");
+	char* lease     = queryParam(query, "hub.lease_seconds");
+	char* nonce     = queryParam(query, "n");
+	
+	//Only an answer to the request we're waiting on, a hub given up on or a replayed verification gets nothing
+	pthread_mutex_lock(&w->lock);
+	rssm_hub* h = &feed->hub;
+	int ours = h->state == HUB_PENDING && h->topic != NULL && topic != NULL && strcmp(h->topic, topic) == 0 &&
+	           nonce != NULL && strcmp(h->nonce, nonce) == 0;
+	
+	if (ours && mode != NULL && strcmp(mode, "subscribe") == 0 && challenge != NULL) {
+		long secs = lease != NULL ? strtol(lease, NULL, 10) : 0;
+		h->state   = HUB_ACTIVE;
+		h->expires = time(NULL) + (secs > 0 && secs < WEBSUB_LEASE ? secs : WEBSUB_LEASE);
+		//A fetch may find another hub and free this one once the lock is released
+		printtime(w->log);
+		fprintf(w->log, "Hub %s is now pushing %s .\n", h->hub, feed->tag);
+		pthread_mutex_unlock(&w->lock);
+		
+		reply(fd, "200 OK", challenge);
+	} else if (ours && mode != NULL && strcmp(mode, "denied") == 0) {
+		h->state = HUB_DENIED;
+		printtime(w->log);
+		fprintf(w->log, "Hub %s denied the subscription to %s , polling it.\n", h->hub, feed->tag);
+		pthread_mutex_unlock(&w->lock);
+		
+		reply(fd, "200 OK", "");
+	} else {
+		pthread_mutex_unlock(&w->lock);
+		reply(fd, "404 Not Found", "");
+	}
+	
+	free(mode);
+	free(topic);
+	free(challenge);
+	free(lease);
+	free(nonce);
+}
+
+//returns 1 if sig ("sha1=<hex>" or "sha256=<hex>") signs body with secret
+static int signedBy(const char* sig, const char* secret, const char* body, size_t len) {
+	uint8_t mac[SHA256_LEN];
+	size_t macLen;
+	const char* hex;
+	if (strncasecmp(sig, "sha1=", 5) == 0) {
+		hmacSha1(secret, strlen(secret), body, len, mac);
+		macLen = SHA1_LEN;
+		hex = sig + 5;
+	} else if (strncasecmp(sig, "sha256=", 7) == 0) {
+		hmacSha256(secret, strlen(secret), body, len, mac);
+		macLen = SHA256_LEN;
+		hex = sig + 7;
+	} else {
+		return 0;
+	}
+	
+	if (strlen(hex) < macLen * 2)
+		return 0;
+	
+	//Every byte is compared so how long the check takes doesn't tell a forger how much of the mac was right
+	size_t i;
+	int diff = 0;
+	for (i = 0; i < macLen; i++) {
+		//A digit that isn't hex is -1, which sets bits above the low four
+		int hi = hexVal(hex[i*2]), lo = hexVal(hex[i*2+1]);
+		diff |= ((hi | lo) & ~0xf) | ((hi * 16 + lo) ^ mac[i]);
+	}
+	return diff == 0;
+}
+
+//New content from a hub, written like a fetch of the feed
+static void push(rssm_websub* w, int fd, rssm_feeditem* feed, const char* sig, const char* body, size_t len) {
+	//A lease being renewed is still live, a 410 would make the hub drop it
+	pthread_mutex_lock(&w->lock);
+	int active = feed->hub.state == HUB_ACTIVE || (feed->hub.state == HUB_PENDING && feed->hub.expires > time(NULL));
+	char secret[sizeof(feed->hub.secret)];
+	strcpy(secret, feed->hub.secret);
+	pthread_mutex_unlock(&w->lock);
+	
+	if (!active) {
+		reply(fd, "410 Gone", "");
+		return;
+	}
+	
+	//Anything not signed with our secret is acknowledged and dropped, as the spec asks
+	reply(fd, "202 Accepted", "");
+	if (sig == NULL || !signedBy(sig, secret, body, len)) {
+		printtime(w->log);
+		fprintf(w->log, "Ignoring a push to %s that isn't signed by its hub.\n", feed->tag);
+		return;
+	}
+	
+	//Every node sharing the feeds is subscribed, only the one holding the feed's shard writes it
+	if (w->leases != NULL && !leaseOwns(leaseMask(w->leases), feed->tag)) {
+		if (w->v) {
+			printtime(w->log);
+			fprintf(w->log, "Leaving a push to %s to the node holding its shard.\n", feed->tag);
+		}
+		return;
+	}
+	
+	pthread_mutex_lock(&w->ingest);
+	int items = pushRss(feed, body, len, w->log, w->v);
+	pthread_mutex_lock(&w->lock);
+	w->pushed++;
+	pthread_mutex_unlock(&w->lock);
+	pthread_mutex_unlock(&w->ingest);
+	
+	if (w->v) {
+		printtime(w->log);
+		fprintf(w->log, "Hub pushed %d new items of %s .\n", items, feed->tag);
+	}
+}
+
+//Read one request off fd and answer it
+static void serve(rssm_websub* w, int fd) {
+	char head[HEAD_MAX + 1];
+	size_t got = 0;
+	char* end = NULL;
+	while (end == NULL && got < HEAD_MAX) {
+		ssize_t n = read(fd, head + got, HEAD_MAX - got);
+		if (n <= 0)
+			return;
+		got += n;
+		head[got] = '\0';
+		end = strstr(head, "\r\n\r\n");
+	}
+	if (end == NULL) {
+		reply(fd, "431 Request Header Fields Too Large", "");
+		return;
+	}
+	*end = '\0';
+	
+	//Request line: METHOD /path?query HTTP/1.x
+	char* method = head;
+	char* target = strchr(method, ' ');
+	if (target == NULL) {
+		reply(fd, "400 Bad Request", "");
+		return;
+	}
+	*target++ = '\0';
+	char* sp = strchr(target, ' ');
+	char* line = strstr(target, "\r\n");
+	if (sp == NULL) {
+		reply(fd, "400 Bad Request", "");
+		return;
+	}
+	*sp = '\0';
+	
+	char* query = strchr(target, '?');
+	if (query != NULL)
+		*query++ = '\0';
+	char* id = strrchr(target, '/');
+	id = id != NULL ? id + 1 : target;
+	rssm_feeditem* feed = feedById(w, id, strlen(id));
+	if (feed == NULL) {
+		reply(fd, "404 Not Found", "");
+		return;
+	}
+	
+	if (strcmp(method, "GET") == 0) {
+		verify(w, fd, feed, query != NULL ? query : "");
+		return;
+	}
+	if (strcmp(method, "POST") != 0) {
+		reply(fd, "405 Method Not Allowed", "");
+		return;
+	}
+	
+	long length = -1;
+	char* sig = NULL;
+	for (; line != NULL; line = strstr(line + 2, "\r\n")) {
+		char* h = line + 2;
+		if (strncasecmp(h, "Content-Length:", 15) == 0)
+			length = strtol(h + 15, NULL, 10);
+		else if (strncasecmp(h, "X-Hub-Signature:", 16) == 0)
+			sig = h + 16 + strspn(h + 16, " ");
+	}
+	//Cut the headers apart now that they've all been found
+	for (line = strstr(sp + 1, "\r\n"); line != NULL; line = strstr(line + 1, "\r\n"))
+		*line = '\0';
+	if (sig != NULL)
+		sig[strcspn(sig, " \t")] = '\0';
+	
+	if (length < 0 || length > WEBSUB_BODY) {
+		reply(fd, length < 0 ? "411 Length Required" : "413 Content Too Large", "");
+		return;
+	}
+	
+	char* body = malloc(length + 1);
+	if (body == NULL) {
+		reply(fd, "503 Service Unavailable", "");
+		return;
+	}
+	size_t have = got - (end + 4 - head);
+	if (have > (size_t)length)
+		have = length;
+	memcpy(body, end + 4, have);
+	while (have < (size_t)length) {
+		ssize_t n = read(fd, body + have, length - have);
+		if (n <= 0)
+			break;
+		have += n;
+	}
+	body[have] = '\0';
+	
+	if (have < (size_t)length)
+		reply(fd, "400 Bad Request", "");
+	else
+		push(w, fd, feed, sig, body, have);
+	free(body);
+}
+
+static void* listenThread(void* arg) {
+	rssm_websub* w = arg;
+	
+	while (!w->stop) {
+		//Wake up every second to notice being stopped
+		struct pollfd p = {w->fd, POLLIN, 0};
+		if (poll(&p, 1, 1000) <= 0)
+			continue;
+		
+		int fd = accept(w->fd, NULL, NULL);
+		if (fd < 0)
+			continue;
+		//A hub that stops sending mustn't hold up the others
+		struct timeval tv = {5, 0};
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+		serve(w, fd);
+		close(fd);
+	}
+	
+	rssmioThreadDone();
+	return NULL;
+}
+
+static size_t discard(void* ptr, size_t size, size_t nmemb, void* data) {
+	return size * nmemb;
+}
+
+//Ask a hub to push topic to callback, returns 0 if it accepted the request
+static int subscribe(const char* hub, const char* topic, const char* callback, const char* secret, FILE* log) {
+	CURL* curl = curl_easy_init();
+	if (curl == NULL)
+		return -1;
+	
+	char* t = curl_easy_escape(curl, topic, 0);
+	char* c = curl_easy_escape(curl, callback, 0);
+	char* form = malloc(strlen(t) + strlen(c) + strlen(secret) + 128);
+	if (t == NULL || c == NULL || form == NULL) {
+		curl_free(t);
+		curl_free(c);
+		free(form);
+		curl_easy_cleanup(curl);
+		return -1;
+	}
+	sprintf(form, "hub.mode=subscribe&hub.topic=%s&hub.callback=%s&hub.lease_seconds=%ld&hub.secret=%s", t, c, WEBSUB_LEASE, secret);
+	
+	curl_easy_setopt(curl, CURLOPT_URL, hub);
+	curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(curl, CURLOPT_TIMEOUT, 30L);
+	curl_easy_setopt(curl, CURLOPT_POSTFIELDS, form);
+	curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, discard);
+	
+	long code = 0;
+	CURLcode res = curl_easy_perform(curl);
+	if (res == CURLE_OK)
+		curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &code);
+	else {
+		printtime(log);
+		fprintf(log, "Curl error subscribing to %s : %s\n", hub, curl_easy_strerror(res));
+	}
+	
+	curl_free(t);
+	curl_free(c);
+	free(form);
+	curl_easy_cleanup(curl);
+	
+	return code == 202 || code == 204 ? 0 : -1;
+}
+
+//Subscribe to new hubs, renew leases about to run out and give up on hubs that never verified
+static void* subscribeThread(void* arg) {
+	rssm_websub* w = arg;
+	
+	while (!w->stop) {
+		sleep(1);
+		
+		time_t now = time(NULL);
+		size_t i;
+		rssm_feeditem* feed;
+		for (i = 0; !w->stop && (feed = feedAt(w->feeds, i)) != NULL; i++) {
+			rssm_hub* h = &feed->hub;
+			
+			pthread_mutex_lock(&w->lock);
+			if (h->state == HUB_PENDING && now >= h->retry) {
+				h->state = h->expires > now ? HUB_ACTIVE : HUB_NONE;
+				h->retry = now + WEBSUB_RETRY;
+			}
+			//Leases are renewed once a tenth of them is left
+			int due = h->hub != NULL && now >= h->retry && (h->state == HUB_NONE ||
+			          (h->state == HUB_ACTIVE && h->expires - now < WEBSUB_LEASE / 10));
+			if (!due) {
+				pthread_mutex_unlock(&w->lock);
+				continue;
+			}
+			
+			//Renewals keep the secret so pushes signed with it still count while the hub verifies, and the nonce so the callback stays the same
+			uint8_t raw[28];
+			if (h->secret[0] == '\0' && getrandom(raw, sizeof(raw), 0) == sizeof(raw)) {
+				int j;
+				for (j = 0; j < 20; j++)
+					sprintf(h->secret + j * 2, "%02x", raw[j]);
+				for (j = 0; j < 8; j++)
+					sprintf(h->nonce + j * 2, "%02x", raw[20 + j]);
+			}
+			char* hub   = strdup(h->hub);
+			char* topic = strdup(h->topic);
+			char secret[sizeof(h->secret)];
+			strcpy(secret, h->secret);
+			//Pending until the hub verifies, which it may do before answering us
+			h->state = HUB_PENDING;
+			h->retry = now + WEBSUB_RETRY;
+			pthread_mutex_unlock(&w->lock);
+			
+			char callback[strlen(w->base) + 38];
+			sprintf(callback, "%s/%s?n=%s", w->base, h->id, h->nonce);
+			if (hub != NULL && topic != NULL && subscribe(hub, topic, callback, secret, w->log) == 0) {
+				if (w->v) {
+					printtime(w->log);
+					fprintf(w->log, "Asked %s to push %s .\n", hub, feed->tag);
+				}
+			} else {
+				printtime(w->log);
+				fprintf(w->log, "Hub %s refused %s , polling it.\n", hub != NULL ? hub : "", feed->tag);
+				pthread_mutex_lock(&w->lock);
+				if (h->state == HUB_PENDING)
+					h->state = h->expires > now ? HUB_ACTIVE : HUB_NONE;
+				pthread_mutex_unlock(&w->lock);
+			}
+			free(hub);
+			free(topic);
+		}
+	}
+	
+	return NULL;
+}
+
+int websubStart(rssm_websub* w) {
+	if (pthread_create(&w->listener, NULL, listenThread, w) != 0)
+		return -1;
+	if (pthread_create(&w->subscriber, NULL, subscribeThread, w) != 0) {
+		w->stop = 1;
+		pthread_join(w->listener, NULL);
+		return -1;
+	}
+	w->started = 1;
+	return 0;
+}
+
+void websubDiscover(rssm_websub* w, rssm_feeditem* feed, const char* hub, const char* topic) {
+	rssm_hub* h = &feed->hub;
+	
+	pthread_mutex_lock(&w->lock);
+	if (h->hub == NULL || strcmp(h->hub, hub) != 0 || strcmp(h->topic, topic) != 0) {
+		char* newHub   = strdup(hub);
+		char* newTopic = strdup(topic);
+		if (newHub != NULL && newTopic != NULL) {
+			free(h->hub);
+			free(h->topic);
+			h->hub     = newHub;
+			h->topic   = newTopic;
+			h->state   = HUB_NONE;
+			h->expires = 0;
+			h->retry   = 0;
+			h->secret[0] = '\0';
+			h->nonce[0]  = '\0';
+		} else {
+			free(newHub);
+			free(newTopic);
+		}
+	}
+	pthread_mutex_unlock(&w->lock);
+}
+
+int websubActive(rssm_feeditem* feed) {
+	rssm_websub* w = feed->websub;
+	
+	pthread_mutex_lock(&w->lock);
+	int active = (feed->hub.state == HUB_ACTIVE || feed->hub.state == HUB_PENDING) && feed->hub.expires > time(NULL);
+	pthread_mutex_unlock(&w->lock);
+	
+	return active;
+}
+
+size_t websubTake(rssm_websub* w) {
+	pthread_mutex_lock(&w->lock);
+	size_t pushed = w->pushed;
+	w->pushed = 0;
+	pthread_mutex_unlock(&w->lock);
+	return pushed;
+}
+
+void websubClose(rssm_websub* w) {
+	w->stop = 1;
+	if (w->started) {
+		pthread_join(w->listener, NULL);
+		pthread_join(w->subscriber, NULL);
+	}
+	if (w->fd >= 0)
+		close(w->fd);
+	
+	size_t i;
+	for (i = 0; w->feeds != NULL && w->feeds[i] != NULL; i++) {
+		free(w->feeds[i]->hub.hub);
+		free(w->feeds[i]->hub.topic);
+		w->feeds[i]->hub.hub   = NULL;
+		w->feeds[i]->hub.topic = NULL;
+	}
+	free(w->base);
+	pthread_mutex_destroy(&w->lock);
+	pthread_mutex_destroy(&w->ingest);
+	w->fd = -1;
+}
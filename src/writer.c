@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+#include "writer.h"
+#include "setting.h"
+#include "rssmio.h"
+#include "index.h"
+
+//A feed's pending buffer and where it goes in the item file
+struct __job {
+	rssm_feeditem* feed;
+	int fd;
+	off_t off;
+	//bytes written so far
+	size_t done;
+};
+
+//Map the rings of a new io_uring, there is no liburing so this is done by hand
+static int ringSetup(rssm_writer* w) {
+	struct io_uring_params p;
+	memset(&p, 0, sizeof(p));
+	
+	int fd = syscall(__NR_io_uring_setup, WRITER_RING, &p);
+	if (fd < 0)
+		return -1;
+	
+	w->sqLen   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	w->cqLen   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	w->sqesLen = p.sq_entries * sizeof(struct io_uring_sqe);
+	//Newer kernels put both rings in one mapping
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (w->cqLen > w->sqLen)
+			w->sqLen = w->cqLen;
+		w->cqLen = w->sqLen;
+	}
+	
+	w->sqMap = mmap(NULL, w->sqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	if (w->sqMap == MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+	
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		w->cqMap = w->sqMap;
+	} else {
+		w->cqMap = mmap(NULL, w->cqLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+		if (w->cqMap == MAP_FAILED) {
+			munmap(w->sqMap, w->sqLen);
+			close(fd);
+			return -1;
+		}
+	}
+	
+	w->sqes = mmap(NULL, w->sqesLen, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+	if (w->sqes == MAP_FAILED) {
+		if (w->cqMap != w->sqMap)
+			munmap(w->cqMap, w->cqLen);
+		munmap(w->sqMap, w->sqLen);
+		close(fd);
+		return -1;
+	}
+	
+	char* sq = w->sqMap;
+	char* cq = w->cqMap;
+	w->sqHead  = (unsigned *)(sq + p.sq_off.head);
+	w->sqTail  = (unsigned *)(sq + p.sq_off.tail);
+	w->sqMask  = (unsigned *)(sq + p.sq_off.ring_mask);
+	w->sqArray = (unsigned *)(sq + p.sq_off.array);
+	w->cqHead  = (unsigned *)(cq + p.cq_off.head);
+	w->cqTail  = (unsigned *)(cq + p.cq_off.tail);
+	w->cqMask  = (unsigned *)(cq + p.cq_off.ring_mask);
+	w->cqes    = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	w->entries = p.sq_entries;
+	w->ring    = fd;
+	
+	return 0;
+}
+
+static void ringClose(rssm_writer* w) {
+	munmap(w->sqes, w->sqesLen);
+	if (w->cqMap != w->sqMap)
+		munmap(w->cqMap, w->cqLen);
+	munmap(w->sqMap, w->sqLen);
+	close(w->ring);
+	w->ring = -1;
+}
+
+//Submit a write for every job, WRITER_RING at a time, and wait for them all
+//Jobs the kernel didn't take are left with nothing done for the pwrite loop
+static int ringWrite(rssm_writer* w, struct __job* jobs, size_t n) {
+	size_t start;
+	for (start = 0; start < n; start += w->entries) {
+		unsigned k = n - start < w->entries ? n - start : w->entries;
+		unsigned first = *w->sqTail;
+		unsigned tail  = first;
+		
+		unsigned i;
+		for (i = 0; i < k; i++, tail++) {
+			struct __job* j = &jobs[start + i];
+			unsigned idx = tail & *w->sqMask;
+			struct io_uring_sqe* sqe = &w->sqes[idx];
+			
+			memset(sqe, 0, sizeof(struct io_uring_sqe));
+			sqe->opcode    = IORING_OP_WRITE;
+			sqe->fd        = j->fd;
+			sqe->addr      = (unsigned long)j->feed->pending.buf;
+			sqe->len       = j->feed->pending.len;
+			sqe->off       = j->off;
+			sqe->user_data = start + i;
+			w->sqArray[idx] = idx;
+		}
+		__atomic_store_n(w->sqTail, tail, __ATOMIC_RELEASE);
+		
+		int sub = syscall(__NR_io_uring_enter, w->ring, k, k, IORING_ENTER_GETEVENTS, NULL, 0);
+		if (sub < 0)
+			sub = 0;
+		//Take back whatever the kernel didn't consume
+		if ((unsigned)sub < k)
+			__atomic_store_n(w->sqTail, first + sub, __ATOMIC_RELEASE);
+		
+		unsigned reaped = 0;
+		while (reaped < (unsigned)sub) {
+			unsigned head = *w->cqHead;
+			unsigned ctail = __atomic_load_n(w->cqTail, __ATOMIC_ACQUIRE);
+			
+			if (head == ctail) {
+				if (syscall(__NR_io_uring_enter, w->ring, 0, 1, IORING_ENTER_GETEVENTS, NULL, 0) < 0 && errno != EINTR)
+					return -1;
+				continue;
+			}
+			
+			for (; head != ctail; head++, reaped++) {
+				struct io_uring_cqe* cqe = &w->cqes[head & *w->cqMask];
+				if (cqe->res > 0)
+					jobs[cqe->user_data].done = cqe->res;
+			}
+			__atomic_store_n(w->cqHead, head, __ATOMIC_RELEASE);
+		}
+		
+		if ((unsigned)sub < k)
+			return -1;
+	}
+	
+	return 0;
+}
+
+int writerOpen(rssm_writer* w, int uring) {
+	memset(w, 0, sizeof(rssm_writer));
+	w->ring = -1;
+	
+	return uring && ringSetup(w) == 0;
+}
+
+int writerQueue(rssm_pending* p, rssm_itemid id, const char* buf, size_t len) {
+	if (p->len + len > p->cap) {
+		size_t cap = p->cap > 0 ? p->cap * 2 : 4096;
+		while (cap < p->len + len)
+			cap *= 2;
+		char* tmp = realloc(p->buf, cap);
+		if (tmp == NULL)
+			return -1;
+		p->buf = tmp;
+		p->cap = cap;
+	}
+	if (p->count == p->itemCap) {
+		size_t cap = p->itemCap > 0 ? p->itemCap * 2 : 16;
+		struct __pendingItem* tmp = realloc(p->items, cap * sizeof(struct __pendingItem));
+		if (tmp == NULL)
+			return -1;
+		p->items   = tmp;
+		p->itemCap = cap;
+	}
+	
+	p->items[p->count].off = p->len;
+	p->items[p->count].len = len;
+	p->items[p->count].id  = id;
+	p->count++;
+	
+	memcpy(p->buf + p->len, buf, len);
+	p->len += len;
+	return 0;
+}
+
+int writerFlush(rssm_writer* w, rssm_feeditem** feeds, FILE* log) {
+	//Fetches queue items under the feed's lock, so the pending buffers are only looked at holding it
+	//A shard given up or lost since its items were fetched is written by the node holding it now
+	uint64_t held = w->leases != NULL ? leaseMask(w->leases) : ~0ULL;
+	size_t n = 0, i;
+	rssm_feeditem* feed;
+	for (i = 0; (feed = feedAt(feeds, i)) != NULL; i++) {
+		pthread_mutex_lock(&feed->lock);
+		if (feed->pending.len > 0 && !leaseOwns(held, feed->tag)) {
+			printtime(log);
+			fprintf(log, "Dropping %zu items of %s , another node holds its shard now.\n", feed->pending.count, feed->tag);
+			if (feed->budget != NULL)
+				budgetRelease(feed->budget, BUDGET_WRITE, feed->pending.len);
+			pendingFree(&feed->pending);
+		}
+		if (feed->pending.len > 0)
+			n++;
+		pthread_mutex_unlock(&feed->lock);
+	}
+	if (n == 0)
+		return 0;
+	
+	struct __job* jobs = malloc(n * sizeof(struct __job));
+	if (jobs == NULL)
+		return -1;
+	
+	//Feeds stay locked until their write is done so compaction can't move the end of the file
+	//Fetches may still be queueing items when flushing early, feeds that got some since the count wait
+	size_t max = n;
+	n = 0;
+	for (i = 0; (feed = feedAt(feeds, i)) != NULL && n < max; i++) {
+		pthread_mutex_lock(&feed->lock);
+		if (feed->pending.len == 0) {
+			pthread_mutex_unlock(&feed->lock);
+			continue;
+		}
+		
+		struct stat st;
+		fflush(feed->out);
+		if (fstat(fileno(feed->out), &st) != 0) {
+			pthread_mutex_unlock(&feed->lock);
+			printtime(log);
+			fprintf(log, "Error finding the end of %s .\n", feed->path);
+			continue;
+		}
+		
+		jobs[n].feed = feed;
+		jobs[n].fd   = fileno(feed->out);
+		jobs[n].off  = st.st_size;
+		jobs[n].done = 0;
+		n++;
+	}
+	
+	if (w->ring >= 0 && ringWrite(w, jobs, n) < 0) {
+		printtime(log);
+		fprintf(log, "Error submitting to the io_uring, writing with pwrite from now on.\n");
+		ringClose(w);
+	}
+	
+	int ret = 0;
+	for (i = 0; i < n; i++) {
+		struct __job* j = &jobs[i];
+		rssm_feeditem* feed = j->feed;
+		rssm_pending* p = &feed->pending;
+		
+		//Short io_uring writes and the fallback both finish here
+		while (j->done < p->len) {
+			ssize_t wrote = pwrite(j->fd, p->buf + j->done, p->len - j->done, j->off + j->done);
+			if (wrote < 0 && errno == EINTR)
+				continue;
+			if (wrote <= 0)
+				break;
+			j->done += wrote;
+		}
+		
+		if (j->done < p->len) {
+			//Keep the items for the next check rather than leaving part of one in the file
+			printtime(log);
+			fprintf(log, "Error writing %zu items to %s , trying again next check.\n", p->count, feed->path);
+			if (ftruncate(j->fd, j->off) != 0) {
+				printtime(log);
+				fprintf(log, "Error truncating %s .\n", feed->path);
+			}
+			ret = -1;
+			pthread_mutex_unlock(&feed->lock);
+			continue;
+		}
+		
+		if (indexAppend(feed->path, p->buf, p->len, j->off) < 0) {
+			printtime(log);
+			fprintf(log, "Error indexing the new items of %s .\n", feed->path);
+		}
+		
+		size_t k;
+		for (k = 0; feed->events != NULL && k < p->count; k++) {
+			char hex[IDENTITY_HEX + 1];
+			identityFormat(p->items[k].id, hex);
+			if (eventItem(feed->events, feed->tag, j->off + p->items[k].off, p->items[k].len, hex) < 0) {
+				printtime(log);
+				fprintf(log, "Error writing an event for %s .\n", feed->tag);
+			}
+		}
+		
+		if (ret >= 0)
+			ret += p->count;
+		if (feed->budget != NULL)
+			budgetRelease(feed->budget, BUDGET_WRITE, p->len);
+		p->len   = 0;
+		p->count = 0;
+		//Under a memory budget the buffers don't stay around between checks
+		if (feed->budget != NULL && feed->budget->limit > 0)
+			pendingFree(p);
+		feed->dirty = 1;
+		pthread_mutex_unlock(&feed->lock);
+	}
+	
+	free(jobs);
+	return ret;
+}
+
+void writerClose(rssm_writer* w) {
+	if (w->ring >= 0)
+		ringClose(w);
+}
+
+void pendingFree(rssm_pending* p) {
+	free(p->buf);
+	free(p->items);
+	memset(p, 0, sizeof(rssm_pending));
+}
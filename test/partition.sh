@@ -0,0 +1,128 @@
+#!/bin/sh
+#Runs several rssm daemons sharing one -P directory against a local feed server and checks that every
+#feed's item file ends up with each of its items exactly once while nodes join, leave and die
+#Needs bin/rssm built and python3, takes a bit over two minutes because leases run out after 30s
+#usage: test/partition.sh [NODES] (default 3), KEEP=1 keeps the directory with the nodes' logs
+
+cd "$(dirname "$0")/.." || exit 1
+RSSM=${RSSM:-$PWD/bin/rssm}
+PORT=${PORT:-18751}
+NODES=${1:-3}
+FEEDS=16
+T=$(mktemp -d /tmp/rssm-partition.XXXXXX)
+
+cleanup() {
+	for f in "$T"/*.pid; do
+		[ -f "$f" ] && kill "$(cat "$f")" 2>/dev/null
+	done
+	sleep 1
+	if [ -n "$KEEP" ]; then
+		echo "kept $T"
+	else
+		rm -rf "$T"
+	fi
+}
+trap cleanup EXIT INT TERM
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+#Every feed has the first n items, n is read from a file on every request so the feeds can grow mid-run
+echo 2 > "$T/n"
+cat > "$T/srv.py" <<EOF
+import http.server
+class H(http.server.BaseHTTPRequestHandler):
+    def do_GET(self):
+        n = int(open("$T/n").read())
+        items = ''.join(f'<item><title>{self.path} {k}</title><guid>{self.path}-{k}</guid></item>' for k in range(n))
+        body = f'<?xml version="1.0"?><rss version="2.0"><channel><title>{self.path}</title>{items}</channel></rss>'.encode()
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+    def log_message(self, *a):
+        pass
+http.server.ThreadingHTTPServer(('127.0.0.1', $PORT), H).serve_forever()
+EOF
+python3 "$T/srv.py" 2>/dev/null & echo $! > "$T/srv.pid"
+
+echo "[rss]" > "$T/feeds.ini"
+i=1
+while [ $i -le $FEEDS ]; do
+	echo "f$i = http://127.0.0.1:$PORT/f$i" >> "$T/feeds.ini"
+	i=$((i + 1))
+done
+echo "[priority]" >> "$T/feeds.ini"
+i=1
+while [ $i -le $FEEDS ]; do
+	echo "f$i = critical 2s" >> "$T/feeds.ini"
+	i=$((i + 1))
+done
+
+#Each node has its own -d for its lock, log and write-ahead log, the item files are under -P
+start() {
+	mkdir -p "$T/d$1"
+	"$RSSM" -D -f "$T/feeds.ini" -d "$T/d$1" -P "$T/P" > "$T/n$1.log" 2>&1 &
+	echo $! > "$T/n$1.pid"
+}
+stop() {
+	kill -"$2" "$(cat "$T/n$1.pid")" 2>/dev/null
+	wait "$(cat "$T/n$1.pid")" 2>/dev/null
+	rm -f "$T/n$1.pid"
+}
+
+sleep 1
+start 1
+sleep 3
+n=2
+while [ $n -le "$NODES" ]; do
+	start $n
+	n=$((n + 1))
+done
+
+#The nodes rebalance at their next lease round, giving shards up while items keep coming
+sleep 12
+echo 4 > "$T/n"
+sleep 12
+owners=$(cat "$T"/P/shards/[0-9]* | cut -d' ' -f1 | sort -u | wc -l)
+[ "$owners" -eq "$NODES" ] || fail "the shards are held by $owners nodes instead of $NODES"
+
+#A node leaving gives its shards up right away
+stop 2 TERM
+echo 6 > "$T/n"
+sleep 12
+
+#A node that dies keeps its shards until their leases run out
+if [ "$NODES" -ge 3 ]; then
+	pid=$(cat "$T/n3.pid")
+	stop 3 KILL
+	#It never got to remove its lock file
+	for lock in /tmp/rssm.*.lock; do
+		[ "$(cat "$lock" 2>/dev/null)" = "$pid" ] && rm -f "$lock"
+	done
+	echo 8 > "$T/n"
+	sleep 45
+fi
+WANT=$(cat "$T/n")
+
+n=1
+while [ $n -le "$NODES" ]; do
+	[ -f "$T/n$n.pid" ] && stop $n TERM
+	n=$((n + 1))
+done
+
+#Every feed has each of its items once, no node wrote one twice or cut another's off
+i=1
+while [ $i -le $FEEDS ]; do
+	file="$T/P/feeds/f$i"
+	[ -f "$file" ] || fail "f$i has no item file"
+	total=$(grep -c '^guid:' "$file")
+	unique=$(grep '^guid:' "$file" | sort -u | wc -l)
+	[ "$total" -eq "$unique" ] || fail "f$i has $total items but only $unique distinct ones"
+	[ "$unique" -eq "$WANT" ] || fail "f$i has $unique of its $WANT items"
+	i=$((i + 1))
+done
+
+echo "ok: $NODES nodes, $FEEDS feeds with $WANT items each, no duplicates"
@@ -0,0 +1,143 @@
+#!/bin/sh
+#Runs an rssm daemon with -W against a local stand-in for a WebSub hub and checks that it subscribes, only answers the
+#verification of the request it sent, and writes pushes signed with its secret while dropping the rest
+#Needs bin/rssm built and python3, takes about 15 seconds
+#usage: test/websub.sh, KEEP=1 keeps the directory with the daemon's and the hub's logs
+
+cd "$(dirname "$0")/.." || exit 1
+RSSM=${RSSM:-$PWD/bin/rssm}
+PORT=${PORT:-18760}
+CB=$((PORT + 1))
+T=$(mktemp -d /tmp/rssm-websub.XXXXXX)
+
+cleanup() {
+	for f in "$T"/*.pid; do
+		[ -f "$f" ] && kill "$(cat "$f")" 2>/dev/null
+	done
+	sleep 1
+	if [ -n "$KEEP" ]; then
+		echo "kept $T"
+	else
+		rm -rf "$T"
+	fi
+}
+trap cleanup EXIT INT TERM
+
+fail() {
+	echo "FAIL: $*"
+	exit 1
+}
+
+#Serves the feed naming itself as hub, and on a subscription goes through verifying it and pushing like a hub would,
+#writing "<step> <status>" to hub.log for every request it made to the callback
+cat > "$T/hub.py" <<EOF
+import http.server, threading, urllib.parse, urllib.request, urllib.error, hmac, hashlib, time
+FEED = 'http://127.0.0.1:$PORT/f'
+out = open('$T/hub.log', 'w')
+def note(step, status):
+    out.write(f'{step} {status}\n')
+    out.flush()
+def doc(items):
+    it = ''.join(f'<item><title>{i}</title><guid>g-{i}</guid></item>' for i in items)
+    return f'<?xml version="1.0"?><rss version="2.0" xmlns:atom="http://www.w3.org/2005/Atom"><channel><title>f</title><atom:link rel="hub" href="http://127.0.0.1:$PORT/hub"/><atom:link rel="self" href="{FEED}"/>{it}</channel></rss>'.encode()
+def call(url, body=None, headers={}):
+    try:
+        r = urllib.request.urlopen(urllib.request.Request(url, data=body, headers=headers))
+        return r.status, r.read().decode()
+    except urllib.error.HTTPError as e:
+        return e.code, ''
+def verify(cb, query, step):
+    q = urllib.parse.urlencode(query)
+    status, body = call(cb + ('&' if '?' in cb else '?') + q)
+    note(step, status if status != 200 or body == query.get('hub.challenge', '') else f'{status}-{body}')
+def push(cb, secret, step, sig):
+    b = doc([step])
+    status, _ = call(cb, b, {'X-Hub-Signature': sig(b, hmac.new(secret, b, hashlib.sha256).hexdigest()), 'Content-Type': 'application/rss+xml'})
+    note(step, status)
+def job(form):
+    time.sleep(0.5)
+    cb, topic, secret = form['hub.callback'][0], form['hub.topic'][0], form['hub.secret'][0].encode()
+    note('nonce', 'n=' in cb)
+    ok = {'hub.mode': 'subscribe', 'hub.topic': topic, 'hub.challenge': 'c1', 'hub.lease_seconds': '99999999999999999999'}
+    base = cb.split('?')[0]
+    verify(base, ok, 'no-nonce')
+    verify(base + '?n=0000000000000000', ok, 'bad-nonce')
+    verify(cb, dict(ok, **{'hub.topic': FEED + 'x'}), 'bad-topic')
+    verify(cb, ok, 'verify')
+    verify(cb, dict(ok, **{'hub.challenge': 'c2'}), 'replay')
+    verify(cb, {'hub.mode': 'denied', 'hub.topic': topic}, 'late-denial')
+    push(cb, secret, 'sha256', lambda b, s: 'sha256=' + s)
+    push(cb, secret, 'sha1', lambda b, s: 'sha1=' + hmac.new(secret, b, hashlib.sha1).hexdigest())
+    push(cb, secret, 'forged', lambda b, s: 'sha256=' + s[:-1] + ('0' if s[-1] != '0' else '1'))
+    push(cb, secret, 'badhex', lambda b, s: 'sha256=' + s[:-2] + '0g')
+    push(cb, secret, 'short', lambda b, s: 'sha256=' + s[:40])
+    push(cb, secret, 'unsigned', lambda b, s: '')
+    note('done', 0)
+class H(http.server.BaseHTTPRequestHandler):
+    def do_GET(self):
+        b = doc(['polled'])
+        self.send_response(200)
+        self.send_header('Content-Length', str(len(b)))
+        self.end_headers()
+        self.wfile.write(b)
+    def do_POST(self):
+        form = urllib.parse.parse_qs(self.rfile.read(int(self.headers['Content-Length'])).decode())
+        self.send_response(202)
+        self.send_header('Content-Length', '0')
+        self.end_headers()
+        if form.get('hub.topic') == [FEED]:
+            threading.Thread(target=job, args=(form,)).start()
+    def log_message(self, *a):
+        pass
+http.server.ThreadingHTTPServer(('127.0.0.1', $PORT), H).serve_forever()
+EOF
+python3 "$T/hub.py" 2>/dev/null & echo $! > "$T/hub.pid"
+
+printf '[rss]\nf = http://127.0.0.1:%s/f\n[priority]\nf = critical 2s\n' "$PORT" > "$T/feeds.ini"
+sleep 1
+mkdir -p "$T/d"
+"$RSSM" -D -f "$T/feeds.ini" -d "$T/d" -W "http://127.0.0.1:$CB/cb" > "$T/rssm.log" 2>&1 &
+echo $! > "$T/rssm.pid"
+
+#The first fetch finds the hub, the subscriber asks it within a second and it verifies and pushes right away
+i=0
+while ! grep -q '^done' "$T/hub.log" 2>/dev/null; do
+	i=$((i + 1))
+	[ $i -le 20 ] || fail "the hub never finished, rssm never subscribed or stopped answering it"
+	sleep 1
+done
+#Pushes are written with the next flush
+sleep 3
+kill -TERM "$(cat "$T/rssm.pid")"
+wait "$(cat "$T/rssm.pid")" 2>/dev/null
+rm -f "$T/rssm.pid"
+
+expect() {
+	got=$(grep "^$1 " "$T/hub.log" | cut -d' ' -f2)
+	[ "$got" = "$2" ] || fail "$1 got $got instead of $2"
+}
+expect nonce True
+#Verifications that aren't for the pending request are turned away
+expect no-nonce 404
+expect bad-nonce 404
+expect bad-topic 404
+expect verify 200
+#Once subscribed a verification or a denial can't change anything
+expect replay 404
+expect late-denial 404
+#Every push is acknowledged, as the spec asks, even the ones dropped
+for step in sha256 sha1 forged badhex short unsigned; do
+	expect $step 202
+done
+
+file="$T/d/f"
+[ -f "$file" ] || fail "f has no item file"
+for title in polled sha256 sha1; do
+	grep -q "^title: $title\$" "$file" || fail "$title is missing from the item file"
+done
+for title in forged badhex short unsigned; do
+	grep -q "^title: $title\$" "$file" && fail "the $title push was written"
+done
+grep -q "denied" "$T/rssm.log" && fail "the late denial was taken"
+
+echo "ok: subscribed, verified only our own request and wrote only signed pushes"